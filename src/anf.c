@@ -0,0 +1,1812 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "anf.h"
+#include "anf_checkpoint.h"
+#include "cgraph.h"
+#include "hll.h"
+#include "hll_kernels.h"
+#include "scheduler.h"
+#include "topology.h"
+#include "../lib/murmur2.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define ANF_ALIGNMENT 64
+#define ANF_CHUNKS_PER_THREAD 64
+
+/* Number of node ids hashed per block when seeding */
+#define ANF_SEED_BLOCK 256
+
+/* Largest rank a register can take (a hash whose last 64 - p bits are zero) */
+#define ANF_MAX_RANK 65
+
+/* Seed table entries pack a register index and a rank */
+#define SEED_ENTRY(index, rank) ((uint32_t)(((index) << 8) | (rank)))
+#define SEED_INDEX(entry) ((entry) >> 8)
+#define SEED_RANK(entry) ((uint8_t)((entry) & 255))
+
+/* Seed table structure definition */
+struct AnfSeeds {
+    uint32_t* entries;            /* Packed (index, rank) of every node */
+    uint64_t numNodes;            /* Number of nodes */
+    unsigned short p;             /* 2^p = number of registers */
+    uint64_t seed;                /* MurmurHash64A seed */
+};
+
+/* Counter array structure definition */
+struct AnfCounters {
+    uint8_t* current;             /* Registers of every counter, this round */
+    uint8_t* next;                /* Registers of every counter, next round */
+    void* slab;                   /* Allocation backing both buffers */
+    uint8_t* pages;               /* Untouched pages backing both buffers, for NUMA placement, or NULL */
+    uint64_t pagesSize;           /* Size of the pages in bytes */
+    uint64_t numCounters;         /* Number of counters */
+    uint64_t size;                /* Number of registers per counter */
+    unsigned width;               /* Bits per register: 8, or 5 or 6 packed into words */
+    uint64_t bytes;               /* Bytes per counter */
+    uint64_t seed;                /* MurmurHash64A seed */
+    unsigned short p;             /* 2^p = number of registers */
+    double* tauTable;             /* tau((m - c)/m) for c = 0 ... m */
+    double* sigmaTable;           /* sigma(c/m) for c = 0 ... m */
+    uint8_t* map;                 /* File mapping backing both buffers, or NULL */
+    uint64_t mapSize;             /* Size of the mapping in bytes */
+    char* path;                   /* Mapped file, removed when the counters are freed */
+};
+
+/* Gets the bytes per counter of 2^p registers of width bits: a byte per
+ * register, or 64 / width registers packed into each 64-bit word */
+static inline uint64_t counterBytes(unsigned short p, unsigned width)
+{
+    uint64_t perWord = 64 / width;
+
+    return width == 8 ? 1ULL << p : ((1ULL << p) + perWord - 1) / perWord * sizeof(uint64_t);
+}
+
+/* Gets register index of a counter with registers of width bits */
+static inline uint8_t getRegister(unsigned width, const uint8_t* regs, uint64_t index)
+{
+    if (width == 8) {
+        return regs[index];
+    }
+
+    uint64_t perWord = 64 / width;
+
+    return (uint8_t)((((const uint64_t*)regs)[index / perWord] >> (index % perWord * width)) &
+                     ((1ULL << width) - 1));
+}
+
+/* Raises register index of a counter with registers of width bits to
+ * rank, which saturates at the largest value the width holds. Returns true
+ * if the register grew. */
+static inline bool raiseRegister(unsigned width, uint8_t* regs, uint64_t index, uint8_t rank)
+{
+    uint64_t top = (1ULL << width) - 1;
+
+    if (rank > top) {
+        rank = (uint8_t)top;
+    }
+
+    if (rank <= getRegister(width, regs, index)) {
+        return false;
+    }
+
+    if (width == 8) {
+        regs[index] = rank;
+    } else {
+        uint64_t perWord = 64 / width;
+        uint64_t* word = (uint64_t*)regs + index / perWord;
+        unsigned shift = (unsigned)(index % perWord * width);
+
+        *word = (*word & ~(top << shift)) | ((uint64_t)rank << shift);
+    }
+
+    return true;
+}
+
+/* Estimates the cardinality of one counter from its estimator statistics.
+ * This is hll_cardinality's estimator with the histogram walk replaced by
+ * a single sum of 2^-r and tau/sigma read from the per-p tables. */
+static inline double estimateSums(const AnfCounters* counters, const HllRegisterSums* sums)
+{
+    double alpha = 0.7213475;
+    double m = (double)counters->size;
+    unsigned short q = 64 - counters->p;
+
+    double z = ldexp(m * counters->tauTable[sums->matches], -(int)q) + sums->inverseSum;
+    z += m * counters->sigmaTable[sums->zeros];
+
+    return alpha * m * (m/z);
+}
+
+/* Estimates the cardinality of one counter from its registers. kernels are
+ * the fixed-size byte kernels for the counters' p. */
+static inline double estimateRegisters(const AnfCounters* counters, const HllFixedKernels* kernels,
+                                       const uint8_t* regs)
+{
+    HllRegisterSums sums;
+
+    if (counters->width == 8) {
+        kernels->sums(regs, &sums);
+    } else {
+        hll_register_sums_packed((const uint64_t*)regs, counters->size, counters->width,
+                                 (uint8_t)(64 - counters->p), (uint8_t)(counters->p + 1), &sums);
+    }
+
+    return estimateSums(counters, &sums);
+}
+
+/* Maps a zero-filled file of size bytes at path, or returns NULL */
+static uint8_t* mapFile(const char* path, uint64_t size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(size >> 32),
+                                        (DWORD)(size & 0xFFFFFFFFULL), NULL);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+
+    /* The view keeps the mapping alive on its own */
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+
+    return (uint8_t*)view;
+#else
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+    if (fd < 0) return NULL;
+
+    /* Truncating to size gives a sparse file that reads as zeros */
+    void* view = ftruncate(fd, (off_t)size) == 0 ?
+                 mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+    close(fd);
+
+    return view == MAP_FAILED ? NULL : (uint8_t*)view;
+#endif
+}
+
+/* Unmaps a file mapping */
+static void unmapFile(uint8_t* map, uint64_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(map);
+#else
+    munmap(map, size);
+#endif
+}
+
+/* Creates a counter array in RAM, or in a mapped file if path is not NULL.
+ * Counters in RAM are left untouched if untouched is set, so that their
+ * pages can still be placed; they must be zeroed (touched) before use. */
+static AnfCounters* initCounters(uint64_t numCounters, unsigned short p, uint64_t seed, unsigned width,
+                                 const char* path, bool untouched)
+{
+    if (p < 4 || p > 16 || (width != 5 && width != 6 && width != 8)) return NULL;
+
+    AnfCounters* counters = (AnfCounters*)calloc(1, sizeof(AnfCounters));
+
+    if (!counters) return NULL;
+
+    counters->p = p;
+    counters->seed = seed;
+    counters->numCounters = numCounters;
+    counters->size = 1UL << p;
+    counters->width = width;
+    counters->bytes = counterBytes(p, width);
+
+    uint64_t bytes = numCounters * counters->bytes;
+    counters->tauTable = (double*)malloc((counters->size + 1) * sizeof(double));
+    counters->sigmaTable = (double*)malloc((counters->size + 1) * sizeof(double));
+
+    if (path) {
+        counters->mapSize = 2 * bytes > 0 ? 2 * bytes : 1;
+        counters->path = (char*)malloc(strlen(path) + 1);
+
+        if (counters->path) {
+            strcpy(counters->path, path);
+            counters->map = mapFile(path, counters->mapSize);
+        }
+    } else if (untouched) {
+        counters->pagesSize = 2 * bytes > 0 ? 2 * bytes : 1;
+        counters->pages = (uint8_t*)topo_alloc_pages(counters->pagesSize);
+    } else {
+        counters->slab = calloc(2 * bytes + ANF_ALIGNMENT, sizeof(uint8_t));
+    }
+
+    if ((!counters->slab && !counters->map && !counters->pages) || !counters->tauTable || !counters->sigmaTable) {
+        anf_counters_free(counters);
+        return NULL;
+    }
+
+    /* Register counts only take m + 1 values, so tau and sigma are tabulated */
+    for (uint64_t c = 0; c <= counters->size; c++) {
+        double m = (double)counters->size;
+        counters->tauTable[c] = tau((m - (double)c)/m);
+        counters->sigmaTable[c] = sigma((double)c/m);
+    }
+
+    /* Align the first buffer; both buffers are multiples of 8 bytes long,
+     * so packed words stay aligned. Mappings are page aligned already. */
+    if (counters->map) {
+        counters->current = counters->map;
+    } else if (counters->pages) {
+        counters->current = counters->pages;
+    } else {
+        uintptr_t base = ((uintptr_t)counters->slab + ANF_ALIGNMENT - 1) & ~(uintptr_t)(ANF_ALIGNMENT - 1);
+        counters->current = (uint8_t*)base;
+    }
+
+    counters->next = counters->current + bytes;
+
+    return counters;
+}
+
+/* Create a new counter array */
+AnfCounters* anf_counters_init(uint64_t numCounters, unsigned short p, uint64_t seed)
+{
+    return initCounters(numCounters, p, seed, 8, NULL, false);
+}
+
+/* Create a new counter array backed by a file */
+AnfCounters* anf_counters_init_mapped(uint64_t numCounters, unsigned short p, uint64_t seed, const char* path)
+{
+    return path ? initCounters(numCounters, p, seed, 8, path, false) : NULL;
+}
+
+/* Create a new counter array with registers of a given width */
+AnfCounters* anf_counters_init_width(uint64_t numCounters, unsigned short p, uint64_t seed, unsigned width,
+                                     const char* path)
+{
+    return initCounters(numCounters, p, seed, width, path, false);
+}
+
+/* Copy a counter array into registers of another width */
+AnfCounters* anf_counters_convert(AnfCounters* counters, unsigned width)
+{
+    AnfCounters* converted = initCounters(counters->numCounters, counters->p, counters->seed, width, NULL, false);
+
+    if (!converted) return NULL;
+
+    for (uint64_t i = 0; i < counters->numCounters; i++) {
+        const uint8_t* src = anf_counters_current(counters, i);
+        uint8_t* dst = anf_counters_current(converted, i);
+
+        for (uint64_t index = 0; index < counters->size; index++) {
+            raiseRegister(width, dst, index, getRegister(counters->width, src, index));
+        }
+    }
+
+    /* Runs expect the next buffer to match the current one */
+    memcpy(converted->next, converted->current, counters->numCounters * converted->bytes);
+
+    return converted;
+}
+
+/* Free a counter array */
+void anf_counters_free(AnfCounters* counters)
+{
+    if (!counters) return;
+
+    if (counters->map) {
+        unmapFile(counters->map, counters->mapSize);
+        remove(counters->path);
+    }
+
+    free(counters->path);
+    free(counters->slab);
+    topo_free_pages(counters->pages, counters->pagesSize);
+    free(counters->tauTable);
+    free(counters->sigmaTable);
+    free(counters);
+}
+
+/* Hint how counters first ... first + count - 1 of a buffer will be used */
+void anf_counters_advise(AnfCounters* counters, bool next, uint64_t first, uint64_t count, AnfAccess access)
+{
+#ifndef _WIN32
+    if (!counters->map || count == 0) return;
+
+    /* posix_madvise wants a page aligned start */
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uint8_t* buffer = next ? counters->next : counters->current;
+    uintptr_t start = (uintptr_t)(buffer + first * counters->bytes);
+    uintptr_t end = start + count * counters->bytes;
+    int advice = POSIX_MADV_NORMAL;
+
+    start &= ~(page - 1);
+
+    switch (access) {
+    case ANF_ACCESS_SEQUENTIAL: advice = POSIX_MADV_SEQUENTIAL; break;
+    case ANF_ACCESS_RANDOM: advice = POSIX_MADV_RANDOM; break;
+    case ANF_ACCESS_SOON: advice = POSIX_MADV_WILLNEED; break;
+    }
+
+    posix_madvise((void*)start, end - start, advice);
+#else
+    (void)counters; (void)next; (void)first; (void)count; (void)access;
+#endif
+}
+
+/* Swap the current and next buffers */
+void anf_counters_swap(AnfCounters* counters)
+{
+    uint8_t* tmp = counters->current;
+    counters->current = counters->next;
+    counters->next = tmp;
+}
+
+/* Get the current registers of counter i */
+uint8_t* anf_counters_current(AnfCounters* counters, uint64_t i)
+{
+    return counters->current + i * counters->bytes;
+}
+
+/* Get the next registers of counter i */
+uint8_t* anf_counters_next(AnfCounters* counters, uint64_t i)
+{
+    return counters->next + i * counters->bytes;
+}
+
+/* Add an element to counter i, the same way hll_add does */
+bool anf_counters_add(AnfCounters* counters, uint64_t i, const uint8_t* data, uint64_t dataLen)
+{
+    uint64_t hash, index, newFsb;
+    uint8_t* regs = anf_counters_current(counters, i);
+
+    hash = MurmurHash64A((void*)data, dataLen, counters->seed);
+
+    index = (hash >> (64 - counters->p)); /* Use the first p bits as an index */
+    newFsb = hash << counters->p; /* Remove the first p bits */
+    newFsb = clz(newFsb) + 1; /* Find the first set bit in the remaining bits */
+
+    return raiseRegister(counters->width, regs, index, (uint8_t)newFsb);
+}
+
+/* Get the cardinality estimate of counter i */
+uint64_t anf_counters_cardinality(AnfCounters* counters, uint64_t i)
+{
+    return (uint64_t)round(estimateRegisters(counters, hll_fixed_kernels(counters->p),
+                                             anf_counters_current(counters, i)));
+}
+
+/* Get the cardinality estimates of a range of counters */
+double anf_counters_cardinalities(AnfCounters* counters, uint64_t first, uint64_t count, double* estimates)
+{
+    const HllFixedKernels* kernels = hll_fixed_kernels(counters->p);
+    const uint8_t* regs = anf_counters_current(counters, first);
+    double total = 0.0;
+
+    for (uint64_t i = 0; i < count; i++, regs += counters->bytes) {
+        estimates[i] = estimateRegisters(counters, kernels, regs);
+        total += estimates[i];
+    }
+
+    return total;
+}
+
+/* Get the number of counters */
+uint64_t anf_counters_count(AnfCounters* counters)
+{
+    return counters->numCounters;
+}
+
+/* Get the number of registers per counter */
+uint64_t anf_counters_size(AnfCounters* counters)
+{
+    return counters->size;
+}
+
+/* Get the register width */
+unsigned anf_counters_width(AnfCounters* counters)
+{
+    return counters->width;
+}
+
+/* Get the number of bytes per counter */
+uint64_t anf_counters_bytes(AnfCounters* counters)
+{
+    return counters->bytes;
+}
+
+/* Copy the registers of counter i out as bytes */
+void anf_counters_get_registers(AnfCounters* counters, uint64_t i, uint8_t* out)
+{
+    const uint8_t* regs = anf_counters_current(counters, i);
+
+    for (uint64_t index = 0; index < counters->size; index++) {
+        out[index] = getRegister(counters->width, regs, index);
+    }
+}
+
+/* Computes the (index, rank) pairs of nodes first ... first + count - 1,
+ * count <= ANF_SEED_BLOCK, keyed by ids[node] or else the node itself.
+ * Node ids are hashed as 8-byte keys, like
+ * hll_add over a uint64_t, through the batch hashing kernel. */
+static inline void hashNodes(const uint64_t* ids, uint64_t first, uint64_t count, unsigned short p, uint64_t seed,
+                             uint64_t* indexes, uint8_t* ranks)
+{
+    uint64_t keys[ANF_SEED_BLOCK];
+
+    for (uint64_t j = 0; j < count; j++) {
+        keys[j] = ids ? ids[first + j] : first + j;
+    }
+
+    hll_hash_keys(keys, count, sizeof(uint64_t), seed, p, indexes, ranks);
+}
+
+/* Create a seed table */
+AnfSeeds* anf_seeds_init(uint64_t numNodes, unsigned short p, uint64_t seed)
+{
+    uint64_t indexes[ANF_SEED_BLOCK];
+    uint8_t ranks[ANF_SEED_BLOCK];
+
+    if (p < 4 || p > 16) return NULL;
+
+    AnfSeeds* seeds = (AnfSeeds*)malloc(sizeof(AnfSeeds));
+
+    if (!seeds) return NULL;
+
+    seeds->numNodes = numNodes;
+    seeds->p = p;
+    seeds->seed = seed;
+    seeds->entries = (uint32_t*)malloc((numNodes ? numNodes : 1) * sizeof(uint32_t));
+
+    if (!seeds->entries) {
+        free(seeds);
+        return NULL;
+    }
+
+    for (uint64_t i = 0; i < numNodes; i += ANF_SEED_BLOCK) {
+        uint64_t count = numNodes - i < ANF_SEED_BLOCK ? numNodes - i : ANF_SEED_BLOCK;
+
+        hashNodes(NULL, i, count, p, seed, indexes, ranks);
+
+        for (uint64_t j = 0; j < count; j++) {
+            seeds->entries[i + j] = SEED_ENTRY(indexes[j], ranks[j]);
+        }
+    }
+
+    return seeds;
+}
+
+/* Free a seed table */
+void anf_seeds_free(AnfSeeds* seeds)
+{
+    if (!seeds) return;
+
+    free(seeds->entries);
+    free(seeds);
+}
+
+/* Fill in the default options */
+void anf_options_init(AnfOptions* options)
+{
+    options->p = 10;
+    options->seed = 12345;
+    options->threads = 0;
+    options->strategy = ANF_STRATEGY_AUTO;
+    options->sparseFraction = 0.05;
+    options->pushFraction = 0.05;
+    options->seeds = NULL;
+    options->counterPath = NULL;
+    options->onRound = NULL;
+    options->onRoundArg = NULL;
+    options->checkpointPath = NULL;
+    options->checkpointRounds = 1;
+    options->resumePath = NULL;
+    options->registerWidth = 8;
+    options->nodeIds = NULL;
+    options->placement = ANF_PLACEMENT_DEFAULT;
+    options->pinThreads = false;
+}
+
+/* Parse a strategy name */
+bool anf_strategy_parse(const char* name, AnfStrategy* strategy)
+{
+    static const char* names[] = {"auto", "dense", "sparse", "push", "full"};
+
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *strategy = (AnfStrategy)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Parse a placement name */
+bool anf_placement_parse(const char* name, AnfPlacement* placement)
+{
+    static const char* names[] = {"default", "first-touch", "interleave", "partitioned"};
+
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *placement = (AnfPlacement)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Log a round as JSON */
+bool anf_log_round_json(const AnfRoundStats* stats, void* file)
+{
+    fprintf((FILE*)file,
+            "{\"round\": %llu, \"seconds\": %.6f, \"sparse\": %s, \"push\": %s, \"active\": %llu, "
+            "\"modified\": %llu, \"merges\": %llu, \"registers_changed\": %llu, \"bytes_touched\": %llu, "
+            "\"neighborhood\": %llu}\n",
+            (unsigned long long)stats->round, stats->seconds, stats->sparse ? "true" : "false",
+            stats->push ? "true" : "false",
+            (unsigned long long)stats->active, (unsigned long long)stats->modified,
+            (unsigned long long)stats->merges, (unsigned long long)stats->registersChanged,
+            (unsigned long long)stats->bytesTouched, (unsigned long long)stats->neighborhood);
+    fflush((FILE*)file);
+
+    return true;
+}
+
+/* Gets a monotonic time in seconds */
+static double now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* Per-thread round totals, padded to a cache line */
+typedef struct ThreadTotals {
+    int64_t delta;                /* Change in the sum of the thread's estimates */
+    uint64_t modified;            /* Number of the thread's counters that changed */
+    uint64_t active;              /* Number of counters the thread recomputed */
+    uint64_t merges;              /* Successor counters merged */
+    uint64_t copies;              /* Counters copied from current to next */
+    uint64_t registers;           /* Registers raised, if counted */
+    uint64_t inArcs;              /* Arcs into the changed counters, once the transpose exists */
+    char pad[64 - sizeof(int64_t) - 6 * sizeof(uint64_t)];
+} ThreadTotals;
+
+/* State shared by the workers of a HyperANF run */
+typedef struct AnfRun {
+    const Graph* graph;           /* Graph being processed, or NULL */
+    const CompressedGraph* compressed; /* Compressed graph being processed, or NULL */
+    Graph* transpose;             /* Predecessor lists, built on first sparse round */
+    AnfCounters* counters;        /* Counter arena */
+    const HllFixedKernels* kernels; /* Merge and estimator kernels for the counters' p */
+    uint64_t* estimates;          /* Last cardinality estimate of each node */
+    ThreadTotals* totals;         /* Per-thread round totals */
+    _Atomic uint64_t* modified;   /* Nodes whose counter changed last round */
+    _Atomic uint64_t* nextModified; /* Nodes whose counter changes this round */
+    _Atomic uint64_t* check;      /* Sparse frontier: nodes to recompute, or NULL */
+    bool full;                    /* Merge every successor of every node */
+    bool countRegisters;          /* Count the registers each changed counter raises */
+    const AnfSeeds* seeds;        /* Cached seed table, or NULL */
+    const uint64_t* nodeIds;      /* Id each node is seeded with, or NULL for its own */
+    const AnfCheckpoint* restore; /* Checkpoint being resumed, or NULL */
+    uint64_t seedEstimates[ANF_MAX_RANK + 1]; /* Estimate of a counter with one register of each rank */
+} AnfRun;
+
+/* Tests bit i of a bitmap */
+static inline bool testBit(_Atomic uint64_t* bits, uint64_t i)
+{
+    return (atomic_load_explicit(&bits[i >> 6], memory_order_relaxed) >> (i & 63)) & 1;
+}
+
+/* Sets bit i of a bitmap; chunks may share a word, so this is atomic */
+static inline void setBit(_Atomic uint64_t* bits, uint64_t i)
+{
+    atomic_fetch_or_explicit(&bits[i >> 6], 1ULL << (i & 63), memory_order_relaxed);
+}
+
+/* Gets a word of a bitmap with the bits outside [begin, end) cleared */
+static inline uint64_t clipWord(uint64_t bits, uint64_t word, uint64_t begin, uint64_t end)
+{
+    if (word == begin >> 6) {
+        bits &= ~0ULL << (begin & 63);
+    }
+    if (word == (end - 1) >> 6 && (end & 63) != 0) {
+        bits &= ~0ULL >> (64 - (end & 63));
+    }
+
+    return bits;
+}
+
+/* Seeds nodes [begin, end) with their own ids. A freshly seeded counter
+ * has a single nonzero register, so its estimate only depends on the rank
+ * and is read from a table instead of scanning the registers. */
+static void seedTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    AnfRun* run = (AnfRun*)arg;
+    AnfCounters* counters = run->counters;
+    uint64_t indexes[ANF_SEED_BLOCK];
+    uint8_t ranks[ANF_SEED_BLOCK];
+    int64_t delta = 0;
+
+    for (uint64_t i = begin; i < end; i += ANF_SEED_BLOCK) {
+        uint64_t count = end - i < ANF_SEED_BLOCK ? end - i : ANF_SEED_BLOCK;
+
+        if (run->seeds) {
+            for (uint64_t j = 0; j < count; j++) {
+                uint32_t entry = run->seeds->entries[run->nodeIds ? run->nodeIds[i + j] : i + j];
+
+                indexes[j] = SEED_INDEX(entry);
+                ranks[j] = SEED_RANK(entry);
+            }
+        } else {
+            hashNodes(run->nodeIds, i, count, counters->p, counters->seed, indexes, ranks);
+        }
+
+        for (uint64_t j = 0; j < count; j++) {
+            raiseRegister(counters->width, anf_counters_current(counters, i + j), indexes[j], ranks[j]);
+            run->estimates[i + j] = run->seedEstimates[ranks[j]];
+            delta += (int64_t)run->seedEstimates[ranks[j]];
+            setBit(run->nextModified, i + j);
+        }
+    }
+
+    run->totals[thread].delta += delta;
+    run->totals[thread].modified += end - begin;
+    run->totals[thread].active += end - begin;
+    run->totals[thread].registers += end - begin;
+}
+
+/* Restores the counters of nodes [begin, end) from the checkpoint, into
+ * both buffers and converting the register width if it differs, and
+ * estimates them */
+static void resumeTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    AnfRun* run = (AnfRun*)arg;
+    AnfCounters* counters = run->counters;
+    const AnfCheckpoint* restore = run->restore;
+
+    for (uint64_t v = begin; v < end; v++) {
+        const uint8_t* src = restore->registers + v * restore->counterBytes;
+        uint8_t* dst = anf_counters_current(counters, v);
+
+        if (restore->width == counters->width) {
+            memcpy(dst, src, counters->bytes);
+        } else {
+            for (uint64_t index = 0; index < counters->size; index++) {
+                raiseRegister(counters->width, dst, index, getRegister(restore->width, src, index));
+            }
+        }
+
+        memcpy(anf_counters_next(counters, v), dst, counters->bytes);
+        run->estimates[v] = (uint64_t)round(estimateRegisters(counters, run->kernels, dst));
+    }
+}
+
+/* Maxes registers of the counters' shape into others; returns true if any
+ * register grew */
+static inline bool maxRegisters(const AnfCounters* counters, const HllFixedKernels* kernels, uint8_t* dst,
+                                const uint8_t* src)
+{
+    if (counters->width == 8) {
+        return kernels->max(dst, src);
+    }
+
+    return hll_max_packed((uint64_t*)dst, (const uint64_t*)src, counters->bytes / sizeof(uint64_t), counters->width);
+}
+
+/* Maxes a counter into another; returns true if any register grew */
+static inline bool maxCounter(const AnfRun* run, uint8_t* dst, const uint8_t* src)
+{
+    return maxRegisters(run->counters, run->kernels, dst, src);
+}
+
+/* Merges current[w] into next[v] if successor w can add anything: only
+ * successors modified last round can, since the others' counters were
+ * already merged into current[v] last round. next[v] starts as a copy of
+ * current[v], made on the first merge. */
+static inline void mergeSuccessor(AnfRun* run, uint64_t w, uint8_t* dst, const uint8_t* own,
+                                  bool* copied, bool* changed, ThreadTotals* totals)
+{
+    AnfCounters* counters = run->counters;
+
+    if (run->full || testBit(run->modified, w)) {
+        if (!*copied) {
+            memcpy(dst, own, counters->bytes);
+            *copied = true;
+            totals->copies++;
+        }
+
+        *changed |= maxCounter(run, dst, anf_counters_current(counters, w));
+        totals->merges++;
+    }
+}
+
+/* Counts the registers of next that differ from current */
+static inline uint64_t countChanged(const AnfCounters* counters, const uint8_t* current, const uint8_t* next)
+{
+    uint64_t n = 0;
+
+    if (counters->width == 8) {
+        for (uint64_t i = 0; i < counters->size; i++) {
+            n += current[i] != next[i];
+        }
+    } else {
+        n = hll_count_diff_packed((const uint64_t*)current, (const uint64_t*)next,
+                                  counters->bytes / sizeof(uint64_t), counters->width);
+    }
+
+    return n;
+}
+
+/* Re-estimates a counter whose registers grew from own to dst */
+static inline void recordChange(AnfRun* run, uint64_t v, const uint8_t* own, const uint8_t* dst,
+                                ThreadTotals* totals)
+{
+    AnfCounters* counters = run->counters;
+
+    if (run->countRegisters) {
+        totals->registers += countChanged(counters, own, dst);
+    }
+
+    if (run->transpose) {
+        totals->inArcs += graph_degree(run->transpose, v);
+    }
+
+    uint64_t estimate = (uint64_t)round(estimateRegisters(counters, run->kernels, dst));
+
+    totals->delta += (int64_t)estimate - (int64_t)run->estimates[v];
+    totals->modified++;
+    run->estimates[v] = estimate;
+}
+
+/* Computes next[v]. If nothing is merged, next[v] only needs a copy when v
+ * itself changed last round, since otherwise the next buffer still holds
+ * the same registers. */
+static inline void updateNode(AnfRun* run, uint64_t v, ThreadTotals* totals)
+{
+    AnfCounters* counters = run->counters;
+    uint8_t* dst = anf_counters_next(counters, v);
+    const uint8_t* own = anf_counters_current(counters, v);
+    bool copied = false;
+    bool changed = false;
+
+    totals->active++;
+
+    if (run->compressed) {
+        CGraphReader reader;
+        uint64_t w;
+
+        cgraph_reader_init(&reader, run->compressed, v);
+
+        while (cgraph_reader_next(&reader, &w)) {
+            mergeSuccessor(run, w, dst, own, &copied, &changed, totals);
+        }
+    } else {
+        const uint64_t* successors = graph_successors(run->graph, v);
+        uint64_t degree = graph_degree(run->graph, v);
+
+        for (uint64_t k = 0; k < degree; k++) {
+            mergeSuccessor(run, successors[k], dst, own, &copied, &changed, totals);
+        }
+    }
+
+    if (!copied && testBit(run->modified, v)) {
+        memcpy(dst, own, counters->bytes);
+        totals->copies++;
+    }
+
+    if (changed) {
+        recordChange(run, v, own, dst, totals);
+        setBit(run->nextModified, v);
+    }
+}
+
+/* Computes next[v] for nodes [begin, end): every node in a dense sweep,
+ * only the frontier and last round's modified nodes in a sparse round */
+static void roundTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    AnfRun* run = (AnfRun*)arg;
+    ThreadTotals* totals = &run->totals[thread];
+
+    if (run->check == NULL) {
+        /* Out of core: start reading the chunk's own counters before the sweep */
+        anf_counters_advise(run->counters, false, begin, end - begin, ANF_ACCESS_SOON);
+        anf_counters_advise(run->counters, true, begin, end - begin, ANF_ACCESS_SOON);
+
+        for (uint64_t v = begin; v < end; v++) {
+            updateNode(run, v, totals);
+        }
+        return;
+    }
+
+    for (uint64_t word = begin >> 6; word <= (end - 1) >> 6 && begin < end; word++) {
+        uint64_t bits = clipWord(atomic_load_explicit(&run->check[word], memory_order_relaxed) |
+                                 atomic_load_explicit(&run->modified[word], memory_order_relaxed),
+                                 word, begin, end);
+
+        for (; bits != 0; bits &= bits - 1) {
+            updateNode(run, (word << 6) + (uint64_t)__builtin_ctzll(bits), totals);
+        }
+    }
+}
+
+/* Marks the predecessors of last round's modified nodes in [begin, end) */
+static void frontierTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    AnfRun* run = (AnfRun*)arg;
+
+    for (uint64_t w = begin; w < end; w++) {
+        if (testBit(run->modified, w)) {
+            const uint64_t* predecessors = graph_successors(run->transpose, w);
+
+            for (uint64_t k = 0; k < graph_degree(run->transpose, w); k++) {
+                setBit(run->check, predecessors[k]);
+            }
+        }
+    }
+}
+
+/* Push round, first step: next[v] already equals current[v] except for
+ * nodes modified last round, so copy those in [begin, end) */
+static void pushCopyTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    AnfRun* run = (AnfRun*)arg;
+    AnfCounters* counters = run->counters;
+
+    for (uint64_t word = begin >> 6; word <= (end - 1) >> 6 && begin < end; word++) {
+        uint64_t bits = clipWord(atomic_load_explicit(&run->modified[word], memory_order_relaxed), word, begin, end);
+
+        for (; bits != 0; bits &= bits - 1) {
+            uint64_t v = (word << 6) + (uint64_t)__builtin_ctzll(bits);
+
+            memcpy(anf_counters_next(counters, v), anf_counters_current(counters, v), counters->bytes);
+            run->totals[thread].copies++;
+        }
+    }
+}
+
+/* Push round, second step: maxes current[w] of each node w in [begin, end)
+ * modified last round into next[v] of its predecessors v. Other threads
+ * may push into the same counter, so the max is atomic. */
+static void pushTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    AnfRun* run = (AnfRun*)arg;
+    AnfCounters* counters = run->counters;
+
+    for (uint64_t word = begin >> 6; word <= (end - 1) >> 6 && begin < end; word++) {
+        uint64_t bits = clipWord(atomic_load_explicit(&run->modified[word], memory_order_relaxed), word, begin, end);
+
+        for (; bits != 0; bits &= bits - 1) {
+            uint64_t w = (word << 6) + (uint64_t)__builtin_ctzll(bits);
+            const uint64_t* predecessors = graph_successors(run->transpose, w);
+            const uint8_t* src = anf_counters_current(counters, w);
+
+            for (uint64_t k = 0; k < graph_degree(run->transpose, w); k++) {
+                uint8_t* dst = anf_counters_next(counters, predecessors[k]);
+                bool grew = counters->width == 8 ?
+                            hll_atomic_max_u8(dst, src, counters->bytes) :
+                            hll_atomic_max_packed((uint64_t*)dst, (const uint64_t*)src,
+                                                  counters->bytes / sizeof(uint64_t), counters->width);
+
+                if (grew) {
+                    setBit(run->nextModified, predecessors[k]);
+                }
+            }
+
+            run->totals[thread].merges += graph_degree(run->transpose, w);
+        }
+    }
+}
+
+/* Push round, last step: re-estimates the counters in [begin, end) that
+ * pushes raised */
+static void pushEstimateTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    AnfRun* run = (AnfRun*)arg;
+    AnfCounters* counters = run->counters;
+    ThreadTotals* totals = &run->totals[thread];
+
+    for (uint64_t word = begin >> 6; word <= (end - 1) >> 6 && begin < end; word++) {
+        uint64_t bits = clipWord(atomic_load_explicit(&run->nextModified[word], memory_order_relaxed),
+                                 word, begin, end);
+
+        for (; bits != 0; bits &= bits - 1) {
+            uint64_t v = (word << 6) + (uint64_t)__builtin_ctzll(bits);
+
+            totals->active++;
+            recordChange(run, v, anf_counters_current(counters, v), anf_counters_next(counters, v), totals);
+        }
+    }
+}
+
+/* Zeroes counters [begin, end) of both buffers, which places their pages
+ * on the NUMA node of the thread touching them first */
+static void touchTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    AnfCounters* counters = ((AnfRun*)arg)->counters;
+
+    memset(anf_counters_current(counters, begin), 0, (end - begin) * counters->bytes);
+    memset(anf_counters_next(counters, begin), 0, (end - begin) * counters->bytes);
+}
+
+/* Runs one task over every chunk and sums the per-thread totals */
+static void runTask(Scheduler* sched, AnfRun* run, const uint64_t* bounds, uint64_t numChunks,
+                    sched_task_fn task, ThreadTotals* sum)
+{
+    unsigned T = sched_threads(sched);
+
+    memset(run->totals, 0, T * sizeof(ThreadTotals));
+    sched_run(sched, bounds, numChunks, task, run);
+
+    memset(sum, 0, sizeof(ThreadTotals));
+    for (unsigned t = 0; t < T; t++) {
+        sum->delta += run->totals[t].delta;
+        sum->modified += run->totals[t].modified;
+        sum->active += run->totals[t].active;
+        sum->merges += run->totals[t].merges;
+        sum->copies += run->totals[t].copies;
+        sum->registers += run->totals[t].registers;
+        sum->inArcs += run->totals[t].inArcs;
+    }
+}
+
+/* Sets the placement policy of untouched counter pages, then touches the
+ * counters of each chunk from the thread that owns it */
+static void placeCounters(Scheduler* sched, AnfRun* run, const uint64_t* bounds, uint64_t numChunks,
+                          AnfPlacement placement)
+{
+    AnfCounters* counters = run->counters;
+    ThreadTotals sum;
+
+    if (placement == ANF_PLACEMENT_INTERLEAVE) {
+        topo_interleave(counters->pages, counters->pagesSize);
+    } else if (placement == ANF_PLACEMENT_PARTITIONED) {
+        /* The nodes each thread starts on go to that thread's NUMA node */
+        for (unsigned t = 0; t < sched_threads(sched); t++) {
+            uint64_t first;
+            uint64_t end;
+
+            sched_thread_chunks(sched, numChunks, t, &first, &end);
+
+            if (first == end) continue;
+
+            uint64_t size = (bounds[end] - bounds[first]) * counters->bytes;
+
+            topo_prefer(anf_counters_current(counters, bounds[first]), size, sched_thread_node(sched, t));
+            topo_prefer(anf_counters_next(counters, bounds[first]), size, sched_thread_node(sched, t));
+        }
+    }
+
+    runTask(sched, run, bounds, numChunks, touchTask, &sum);
+}
+
+/* Reports a round to the callback; returns false if it stops the run. A
+ * merge reads a successor counter and rewrites next[v], a copy reads
+ * current[v] and writes next[v], and each changed counter is read once
+ * more to estimate it. */
+static bool reportRound(const AnfOptions* options, const AnfRun* run, uint64_t round, double start,
+                        bool sparse, bool push, const ThreadTotals* sum, uint64_t neighborhood)
+{
+    uint64_t size = run->counters->bytes;
+    AnfRoundStats stats;
+
+    if (!options->onRound) {
+        return true;
+    }
+
+    stats.round = round;
+    stats.seconds = now() - start;
+    stats.sparse = sparse;
+    stats.push = push;
+    stats.active = sum->active;
+    stats.modified = sum->modified;
+    stats.merges = sum->merges;
+    stats.registersChanged = sum->registers;
+    stats.bytesTouched = round == 0 ? sum->active : (2 * sum->merges + 2 * sum->copies + sum->modified) * size;
+    stats.neighborhood = neighborhood;
+
+    return options->onRound(&stats, options->onRoundArg);
+}
+
+/* Swaps the modified bitmaps and clears the one for the coming round */
+static void swapModified(AnfRun* run, uint64_t words)
+{
+    _Atomic uint64_t* tmp = run->modified;
+    run->modified = run->nextModified;
+    run->nextModified = tmp;
+    memset((void*)run->nextModified, 0, words * sizeof(uint64_t));
+}
+
+/* Restores the counters, modified nodes and neighborhood function of a
+ * checkpoint, which may have another register width. Every next counter is
+ * set equal to its current one. Returns false if the checkpoint does not
+ * belong to this graph and options. */
+static bool resumeRun(Scheduler* sched, AnfRun* run, const uint64_t* bounds, uint64_t numChunks,
+                      const AnfOptions* options, uint64_t** nf, uint64_t* capacity, uint64_t* rounds,
+                      ThreadTotals* sum)
+{
+    AnfCheckpoint* checkpoint = anf_checkpoint_load(options->resumePath);
+    uint64_t N = anf_counters_count(run->counters);
+    uint64_t arcs = run->graph ? run->graph->numEdges : run->compressed->numEdges;
+    bool ok = false;
+
+    if (!checkpoint || checkpoint->numNodes != N || checkpoint->numEdges != arcs ||
+        checkpoint->p != options->p || checkpoint->seed != options->seed ||
+        (checkpoint->width != 5 && checkpoint->width != 6 && checkpoint->width != 8) ||
+        checkpoint->counterBytes != counterBytes(checkpoint->p, checkpoint->width)) {
+        goto done;
+    }
+
+    while (*capacity <= checkpoint->rounds) {
+        uint64_t* grown = (uint64_t*)realloc(*nf, 2 * *capacity * sizeof(uint64_t));
+
+        if (!grown) {
+            goto done;
+        }
+
+        *nf = grown;
+        *capacity *= 2;
+    }
+
+    memcpy(*nf, checkpoint->nf, checkpoint->rounds * sizeof(uint64_t));
+    memcpy((void*)run->nextModified, checkpoint->modified, (N + 63) / 64 * sizeof(uint64_t));
+    *rounds = checkpoint->rounds;
+
+    run->restore = checkpoint;
+    runTask(sched, run, bounds, numChunks, resumeTask, sum);
+    run->restore = NULL;
+
+    for (uint64_t w = 0; w < (N + 63) / 64; w++) {
+        sum->modified += (uint64_t)__builtin_popcountll(checkpoint->modified[w]);
+    }
+
+    ok = true;
+
+done:
+    anf_checkpoint_free(checkpoint);
+
+    return ok;
+}
+
+/* Starts writing a checkpoint of the round just completed: the current
+ * counters and the nodes modified in it. Neither changes until the round
+ * after next, so the writer overlaps the next round. */
+static AnfCheckpointWriter* startCheckpoint(const AnfOptions* options, const AnfRun* run, const uint64_t* nf,
+                                            uint64_t rounds)
+{
+    uint64_t N = anf_counters_count(run->counters);
+    AnfCheckpoint checkpoint;
+
+    checkpoint.numNodes = N;
+    checkpoint.numEdges = run->graph ? run->graph->numEdges : run->compressed->numEdges;
+    checkpoint.p = options->p;
+    checkpoint.seed = options->seed;
+    checkpoint.width = anf_counters_width(run->counters);
+    checkpoint.counterBytes = anf_counters_bytes(run->counters);
+    checkpoint.rounds = rounds;
+    checkpoint.nf = nf;
+    checkpoint.modified = (const uint64_t*)run->nextModified;
+    checkpoint.registers = N > 0 ? anf_counters_current(run->counters, 0) : NULL;
+    checkpoint.map = NULL;
+    checkpoint.mapSize = 0;
+
+    return anf_checkpoint_write_async(options->checkpointPath, &checkpoint);
+}
+
+/* Incremental run structure definition. Layer t holds the round t counter
+ * of every node, in slots for nodeCapacity nodes. */
+struct AnfIncremental {
+    AnfCounters* shape;           /* Empty counter array giving p, width, seed and estimator tables */
+    const HllFixedKernels* kernels; /* Merge and estimator kernels for p */
+    uint8_t** layers;             /* Counters of rounds 0 ... numLayers - 1 */
+    uint64_t* changes;            /* Counters that differ between layers t - 1 and t */
+    uint64_t* nf;                 /* Neighborhood function, one entry per layer */
+    uint64_t numLayers;           /* T + 1 */
+    uint64_t layerCapacity;       /* Room in layers, changes and nf */
+    uint64_t numNodes;            /* Number of nodes */
+    uint64_t nodeCapacity;        /* Room for nodes in each layer and the arrays below */
+    Graph* transpose;             /* Predecessor lists of the initial graph */
+    uint64_t baseNodes;           /* Nodes of the initial graph */
+    uint64_t* addedHead;          /* First added arc into each node, or UINT64_MAX */
+    uint64_t* addedSource;        /* Source of each added arc */
+    uint64_t* addedNext;          /* Next added arc into the same node, or UINT64_MAX */
+    uint64_t numAdded;            /* Number of added arcs */
+    uint64_t addedCapacity;       /* Room in addedSource and addedNext */
+    uint64_t* changed;            /* Nodes whose counter changed last round */
+    uint64_t* nextChanged;        /* Nodes whose counter changes this round */
+    uint8_t* differed;            /* For nodes in changed: if their counter differed from the next round's */
+    uint8_t* nextDiffered;        /* The same for nodes in nextChanged */
+    uint64_t* touched;            /* Nodes merged into this round */
+    uint64_t* touchedEstimates;   /* Their estimates before the round */
+    uint8_t* touchedDiffered;     /* If they differed from the round below before it */
+    uint64_t* touchedStamp;       /* Round stamp at which each node was last merged into */
+    uint64_t* changedStamp;       /* Round stamp at which each node last changed */
+    uint64_t stamp;               /* Stamp of the round being updated */
+    bool failed;                  /* If an update ran out of memory */
+};
+
+/* Grows an array of count elements of size bytes to capacity elements,
+ * filling the new ones with byte fill. Returns false if memory runs out. */
+static bool growArray(void** array, uint64_t count, uint64_t capacity, size_t size, int fill)
+{
+    uint8_t* grown = (uint8_t*)realloc(*array, (capacity ? capacity : 1) * size);
+
+    if (!grown) return false;
+
+    memset(grown + count * size, fill, (capacity - count) * size);
+    *array = grown;
+
+    return true;
+}
+
+/* Makes room for one more layer. Returns false if memory runs out. */
+static bool reserveLayer(AnfIncremental* incremental)
+{
+    uint64_t count = incremental->layerCapacity;
+    uint64_t capacity = count ? 2 * count : 16;
+
+    if (incremental->numLayers < count) return true;
+
+    if (!growArray((void**)&incremental->layers, count, capacity, sizeof(uint8_t*), 0) ||
+        !growArray((void**)&incremental->changes, count, capacity, sizeof(uint64_t), 0) ||
+        !growArray((void**)&incremental->nf, count, capacity, sizeof(uint64_t), 0)) {
+        return false;
+    }
+
+    incremental->layerCapacity = capacity;
+
+    return true;
+}
+
+/* Copies the current counters of a run into a new layer, with the number
+ * of counters that changed in the round. Returns false if memory runs out. */
+static bool keepLayer(AnfIncremental* incremental, AnfCounters* counters, uint64_t changes)
+{
+    uint64_t N = anf_counters_count(counters);
+
+    if (!reserveLayer(incremental)) return false;
+
+    uint8_t* layer = (uint8_t*)malloc((N ? N : 1) * counters->bytes);
+
+    if (!layer) return false;
+
+    if (N > 0) {
+        memcpy(layer, anf_counters_current(counters, 0), N * counters->bytes);
+    }
+
+    incremental->layers[incremental->numLayers] = layer;
+    incremental->changes[incremental->numLayers++] = changes;
+
+    return true;
+}
+
+/* Runs HyperANF over a CSR or a compressed graph, keeping the counters of
+ * every round in keep if it is not NULL */
+static uint64_t* runAnf(const Graph* graph, const CompressedGraph* compressed, const AnfOptions* options,
+                        uint64_t* rounds, AnfIncremental* keep)
+{
+    uint64_t N = graph ? graph->numNodes : compressed->numNodes;
+    uint64_t words = (N + 63) / 64 + 1;
+    uint64_t capacity = 16;
+    uint64_t* nf = (uint64_t*)malloc(capacity * sizeof(uint64_t));
+    AnfRun run = {graph, compressed, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                  options->strategy == ANF_STRATEGY_FULL, options->onRound != NULL, NULL, options->nodeIds, NULL,
+                  {0}};
+    Scheduler* sched = sched_init(options->threads);
+    _Atomic uint64_t* frontier = NULL;
+    uint64_t* bounds = NULL;
+    AnfCheckpointWriter* writer = NULL;
+    uint64_t writerRounds = 0;
+    AnfPlacement placement = options->placement;
+
+    /* Partitioning binds each thread's counters to the node it runs on, so
+     * it needs pinned threads; without them it falls back to first touch */
+    if (sched && (options->pinThreads || placement == ANF_PLACEMENT_PARTITIONED) && !sched_pin(sched) &&
+        placement == ANF_PLACEMENT_PARTITIONED) {
+        placement = ANF_PLACEMENT_FIRST_TOUCH;
+    }
+
+    run.counters = initCounters(N, options->p, options->seed, options->registerWidth, options->counterPath,
+                                placement != ANF_PLACEMENT_DEFAULT);
+    run.kernels = hll_fixed_kernels(options->p);
+    run.estimates = (uint64_t*)malloc((N ? N : 1) * sizeof(uint64_t));
+    run.modified = (_Atomic uint64_t*)calloc(words, sizeof(uint64_t));
+    run.nextModified = (_Atomic uint64_t*)calloc(words, sizeof(uint64_t));
+    frontier = (_Atomic uint64_t*)calloc(words, sizeof(uint64_t));
+
+    if (!nf || !sched || !run.counters || !run.estimates || !run.modified || !run.nextModified || !frontier) {
+        goto fail;
+    }
+
+    /* Split the nodes into chunks of equal arc count, several per thread so
+     * that stealing can even out hubs */
+    unsigned T = sched_threads(sched);
+    uint64_t maxChunks = (uint64_t)T * ANF_CHUNKS_PER_THREAD;
+    run.totals = (ThreadTotals*)calloc(T, sizeof(ThreadTotals));
+    bounds = (uint64_t*)malloc((maxChunks + 1) * sizeof(uint64_t));
+
+    if (!run.totals || !bounds) {
+        goto fail;
+    }
+
+    /* Compressed byte offsets stand in for arc counts as the cost of a node */
+    uint64_t numChunks = sched_balance(graph ? graph->offsets : compressed->offsets, N, maxChunks, bounds);
+    ThreadTotals sum;
+
+    if (run.counters->pages) {
+        placeCounters(sched, &run, bounds, numChunks, placement);
+    }
+
+    double start = now();
+    uint64_t arcs = graph ? graph->numEdges : compressed->numEdges;
+    bool arcsCounted = false;
+
+    if (options->seeds && options->seeds->numNodes == N && options->seeds->p == options->p &&
+        options->seeds->seed == options->seed) {
+        run.seeds = options->seeds;
+    }
+
+    /* Tabulate the estimate of a counter holding a single register of each
+     * rank, as saturated by the register width */
+    uint8_t* scratch = (uint8_t*)calloc(anf_counters_bytes(run.counters), sizeof(uint8_t));
+
+    if (!scratch) {
+        goto fail;
+    }
+
+    for (unsigned r = 0; r <= ANF_MAX_RANK; r++) {
+        memset(scratch, 0, anf_counters_bytes(run.counters));
+        raiseRegister(options->registerWidth, scratch, 0, (uint8_t)r);
+        run.seedEstimates[r] = (uint64_t)round(estimateRegisters(run.counters, run.kernels, scratch));
+    }
+
+    free(scratch);
+
+    if (options->resumePath) {
+        if (!resumeRun(sched, &run, bounds, numChunks, options, &nf, &capacity, rounds, &sum)) {
+            goto fail;
+        }
+    } else {
+        /* Each node adds itself, so every counter starts out modified */
+        runTask(sched, &run, bounds, numChunks, seedTask, &sum);
+        nf[0] = (uint64_t)sum.delta;
+        *rounds = 1;
+
+        if (keep && !keepLayer(keep, run.counters, sum.modified)) {
+            goto fail;
+        }
+
+        if (!reportRound(options, &run, 0, start, false, false, &sum, nf[0])) {
+            goto fail;
+        }
+    }
+
+    do {
+        /* Arcs into last round's modified nodes: the work of a push round.
+         * Until the transpose exists, guess from the average in-degree. */
+        double pushArcs = arcsCounted ? (double)sum.inArcs
+                                      : (double)sum.modified * (double)arcs / (double)(N > 0 ? N : 1);
+        bool sparse = options->strategy == ANF_STRATEGY_SPARSE || options->strategy == ANF_STRATEGY_PUSH ||
+                      (options->strategy == ANF_STRATEGY_AUTO && sum.modified < options->sparseFraction * N);
+        bool push = sparse && graph && !run.full &&
+                    (options->strategy == ANF_STRATEGY_PUSH || (options->strategy == ANF_STRATEGY_AUTO &&
+                                                                 pushArcs < options->pushFraction * arcs));
+
+        start = now();
+
+        /* The checkpointed counters are about to be overwritten */
+        if (writer && *rounds > writerRounds) {
+            bool written = anf_checkpoint_wait(writer);
+
+            writer = NULL;
+            if (!written) {
+                goto fail;
+            }
+        }
+
+        swapModified(&run, words);
+        run.check = NULL;
+
+        /* Each thread writes next in runs of whole chunks, in node order;
+         * successor counters are read from all over current */
+        anf_counters_advise(run.counters, false, 0, N, ANF_ACCESS_RANDOM);
+        anf_counters_advise(run.counters, true, 0, N, ANF_ACCESS_SEQUENTIAL);
+
+        /* Small frontier: only predecessors of modified nodes can change.
+         * Compressed graphs are too big to transpose and always sweep. */
+        if (sparse && !run.full && graph && !run.transpose) {
+            run.transpose = graph_transpose(graph);
+        }
+
+        push = push && run.transpose;
+        arcsCounted = run.transpose != NULL;
+
+        if (push) {
+            /* Tiny frontier: modified counters are maxed straight into
+             * their predecessors, as in top-down BFS */
+            ThreadTotals copies, pushes;
+
+            anf_counters_advise(run.counters, true, 0, N, ANF_ACCESS_RANDOM);
+            runTask(sched, &run, bounds, numChunks, pushCopyTask, &copies);
+            runTask(sched, &run, bounds, numChunks, pushTask, &pushes);
+            runTask(sched, &run, bounds, numChunks, pushEstimateTask, &sum);
+            sum.copies = copies.copies;
+            sum.merges = pushes.merges;
+        } else {
+            if (sparse && run.transpose && !run.full) {
+                memset((void*)frontier, 0, words * sizeof(uint64_t));
+                run.check = frontier;
+                runTask(sched, &run, bounds, numChunks, frontierTask, &sum);
+            }
+
+            runTask(sched, &run, bounds, numChunks, roundTask, &sum);
+        }
+
+        anf_counters_swap(run.counters);
+
+        if (keep && !keepLayer(keep, run.counters, sum.modified)) {
+            goto fail;
+        }
+
+        if (*rounds == capacity) {
+            capacity *= 2;
+            uint64_t* grown = (uint64_t*)realloc(nf, capacity * sizeof(uint64_t));
+
+            if (!grown) {
+                goto fail;
+            }
+
+            nf = grown;
+        }
+
+        nf[*rounds] = (uint64_t)((int64_t)nf[*rounds - 1] + sum.delta);
+
+        if (!reportRound(options, &run, *rounds, start, run.check != NULL || push, push, &sum, nf[*rounds])) {
+            goto fail;
+        }
+
+        (*rounds)++;
+
+        if (options->checkpointPath && sum.modified > 0 &&
+            *rounds % (options->checkpointRounds > 0 ? options->checkpointRounds : 1) == 0) {
+            if (writer && !anf_checkpoint_wait(writer)) {
+                writer = NULL;
+                goto fail;
+            }
+
+            writer = startCheckpoint(options, &run, nf, *rounds);
+            writerRounds = *rounds;
+
+            if (!writer) {
+                goto fail;
+            }
+        }
+    } while (sum.modified > 0);
+
+    if (writer && !anf_checkpoint_wait(writer)) {
+        writer = NULL;
+        goto fail;
+    }
+
+    sched_free(sched);
+    graph_free(run.transpose);
+    anf_counters_free(run.counters);
+    free(run.estimates);
+    free(run.totals);
+    free((void*)run.modified);
+    free((void*)run.nextModified);
+    free((void*)frontier);
+    free(bounds);
+
+    return nf;
+
+fail:
+    anf_checkpoint_wait(writer);
+    sched_free(sched);
+    graph_free(run.transpose);
+    anf_counters_free(run.counters);
+    free(run.estimates);
+    free(run.totals);
+    free((void*)run.modified);
+    free((void*)run.nextModified);
+    free((void*)frontier);
+    free(bounds);
+    free(nf);
+
+    return NULL;
+}
+
+/* Run HyperANF */
+uint64_t* anf_run(const Graph* graph, const AnfOptions* options, uint64_t* rounds)
+{
+    return runAnf(graph, NULL, options, rounds, NULL);
+}
+
+/* Run HyperANF over a compressed graph */
+uint64_t* anf_run_compressed(const CompressedGraph* graph, const AnfOptions* options, uint64_t* rounds)
+{
+    return runAnf(NULL, graph, options, rounds, NULL);
+}
+
+/* Gets the rounded estimate of a counter of an incremental run */
+static inline uint64_t estimateLayer(const AnfIncremental* incremental, const uint8_t* regs)
+{
+    return (uint64_t)round(estimateRegisters(incremental->shape, incremental->kernels, regs));
+}
+
+/* Makes room for capacity nodes in every layer and per-node array. Returns
+ * false if memory runs out, leaving the run as it was. */
+static bool reserveNodes(AnfIncremental* incremental, uint64_t capacity)
+{
+    uint64_t count = incremental->nodeCapacity;
+    uint64_t bytes = incremental->shape->bytes;
+
+    if (capacity <= count) return true;
+
+    for (uint64_t t = 0; t < incremental->numLayers; t++) {
+        if (!growArray((void**)&incremental->layers[t], incremental->numNodes * bytes, capacity * bytes, 1, 0)) {
+            return false;
+        }
+    }
+
+    if (!growArray((void**)&incremental->addedHead, count, capacity, sizeof(uint64_t), 0xFF) ||
+        !growArray((void**)&incremental->changed, count, capacity, sizeof(uint64_t), 0) ||
+        !growArray((void**)&incremental->nextChanged, count, capacity, sizeof(uint64_t), 0) ||
+        !growArray((void**)&incremental->differed, count, capacity, sizeof(uint8_t), 0) ||
+        !growArray((void**)&incremental->nextDiffered, count, capacity, sizeof(uint8_t), 0) ||
+        !growArray((void**)&incremental->touched, count, capacity, sizeof(uint64_t), 0) ||
+        !growArray((void**)&incremental->touchedEstimates, count, capacity, sizeof(uint64_t), 0) ||
+        !growArray((void**)&incremental->touchedDiffered, count, capacity, sizeof(uint8_t), 0) ||
+        !growArray((void**)&incremental->touchedStamp, count, capacity, sizeof(uint64_t), 0) ||
+        !growArray((void**)&incremental->changedStamp, count, capacity, sizeof(uint64_t), 0)) {
+        return false;
+    }
+
+    incremental->nodeCapacity = capacity;
+
+    return true;
+}
+
+/* Makes room for capacity added arcs. Returns false if memory runs out. */
+static bool reserveArcs(AnfIncremental* incremental, uint64_t capacity)
+{
+    uint64_t count = incremental->addedCapacity;
+
+    if (capacity <= count) return true;
+
+    capacity = capacity > 2 * count ? capacity : 2 * count;
+
+    if (!growArray((void**)&incremental->addedSource, count, capacity, sizeof(uint64_t), 0) ||
+        !growArray((void**)&incremental->addedNext, count, capacity, sizeof(uint64_t), 0)) {
+        return false;
+    }
+
+    incremental->addedCapacity = capacity;
+
+    return true;
+}
+
+/* Seeds nodes numNodes ... with their own ids. With no arcs out yet, their
+ * counters hold only themselves in every round. */
+static void seedNodes(AnfIncremental* incremental, uint64_t numNodes)
+{
+    AnfCounters* shape = incremental->shape;
+
+    for (uint64_t v = incremental->numNodes; v < numNodes; v++) {
+        uint64_t index;
+        uint8_t rank;
+
+        hashNodes(NULL, v, 1, shape->p, shape->seed, &index, &rank);
+
+        for (uint64_t t = 0; t < incremental->numLayers; t++) {
+            uint8_t* regs = incremental->layers[t] + v * shape->bytes;
+
+            memset(regs, 0, shape->bytes);
+            raiseRegister(shape->width, regs, index, rank);
+        }
+
+        uint64_t estimate = estimateLayer(incremental, incremental->layers[0] + v * shape->bytes);
+
+        for (uint64_t t = 0; t < incremental->numLayers; t++) {
+            incremental->nf[t] += estimate;
+        }
+    }
+
+    incremental->numNodes = numNodes;
+}
+
+/* Adds a layer T + 1 equal to layer T. Returns false if memory runs out. */
+static bool extendLayers(AnfIncremental* incremental)
+{
+    uint64_t T = incremental->numLayers - 1;
+    uint64_t bytes = incremental->shape->bytes;
+
+    if (!reserveLayer(incremental)) return false;
+
+    uint8_t* layer = (uint8_t*)malloc((incremental->nodeCapacity ? incremental->nodeCapacity : 1) * bytes);
+
+    if (!layer) return false;
+
+    memcpy(layer, incremental->layers[T], incremental->numNodes * bytes);
+    incremental->layers[T + 1] = layer;
+    incremental->changes[T + 1] = 0;
+    incremental->nf[T + 1] = incremental->nf[T];
+    incremental->numLayers++;
+
+    return true;
+}
+
+/* Maxes src into the round t counter of node x. The first merge into x in
+ * a round records its estimate, and whether it differed from its counter a
+ * round below and above, before the round changes them. */
+static inline void mergeInto(AnfIncremental* incremental, uint64_t t, uint64_t x, const uint8_t* src,
+                             uint64_t* numTouched, AnfUpdateStats* stats)
+{
+    uint64_t bytes = incremental->shape->bytes;
+    uint8_t* dst = incremental->layers[t] + x * bytes;
+
+    if (incremental->touchedStamp[x] != incremental->stamp) {
+        uint64_t k = (*numTouched)++;
+        const uint8_t* below = incremental->layers[t - 1] + x * bytes;
+
+        incremental->touchedStamp[x] = incremental->stamp;
+        incremental->touched[k] = x;
+        incremental->touchedEstimates[k] = estimateLayer(incremental, dst);
+
+        /* A counter changed last round no longer matches its old self there */
+        incremental->touchedDiffered[k] = incremental->changedStamp[x] == incremental->stamp - 1 ?
+                                          incremental->differed[x] : memcmp(dst, below, bytes) != 0;
+        incremental->nextDiffered[x] = t + 1 < incremental->numLayers &&
+                                       memcmp(dst, incremental->layers[t + 1] + x * bytes, bytes) != 0;
+        stats->active++;
+    }
+
+    if (maxRegisters(incremental->shape, incremental->kernels, dst, src)) {
+        incremental->changedStamp[x] = incremental->stamp;
+    }
+
+    stats->merges++;
+}
+
+/* Updates round t: a counter can only grow through its own or a
+ * successor's round t - 1 counter that changed, or through an added arc.
+ * Returns the number of counters that changed. */
+static uint64_t updateRound(AnfIncremental* incremental, uint64_t t, uint64_t numChanged, uint64_t numArcs,
+                            const uint64_t* sources, const uint64_t* targets, AnfUpdateStats* stats)
+{
+    uint64_t bytes = incremental->shape->bytes;
+    const uint8_t* below = incremental->layers[t - 1];
+    const uint8_t* layer = incremental->layers[t];
+    uint64_t lastStamp = incremental->stamp++;
+    uint64_t numTouched = 0;
+    uint64_t numNext = 0;
+    int64_t delta = 0;
+
+    for (uint64_t i = 0; i < numChanged; i++) {
+        uint64_t x = incremental->changed[i];
+
+        mergeInto(incremental, t, x, below + x * bytes, &numTouched, stats);
+    }
+
+    /* Push each changed counter into its predecessors */
+    for (uint64_t i = 0; i < numChanged; i++) {
+        uint64_t w = incremental->changed[i];
+        const uint8_t* src = below + w * bytes;
+
+        if (w < incremental->baseNodes) {
+            const uint64_t* predecessors = graph_successors(incremental->transpose, w);
+            uint64_t degree = graph_degree(incremental->transpose, w);
+
+            for (uint64_t k = 0; k < degree; k++) {
+                mergeInto(incremental, t, predecessors[k], src, &numTouched, stats);
+            }
+        }
+
+        for (uint64_t a = incremental->addedHead[w]; a != UINT64_MAX; a = incremental->addedNext[a]) {
+            mergeInto(incremental, t, incremental->addedSource[a], src, &numTouched, stats);
+        }
+    }
+
+    /* New arcs into unchanged counters were not pushed above */
+    for (uint64_t e = 0; e < numArcs; e++) {
+        if (incremental->changedStamp[targets[e]] != lastStamp) {
+            mergeInto(incremental, t, sources[e], below + targets[e] * bytes, &numTouched, stats);
+        }
+    }
+
+    for (uint64_t k = 0; k < numTouched; k++) {
+        uint64_t x = incremental->touched[k];
+        bool differs = memcmp(layer + x * bytes, below + x * bytes, bytes) != 0;
+
+        incremental->changes[t] += (uint64_t)differs - incremental->touchedDiffered[k];
+
+        if (incremental->changedStamp[x] == incremental->stamp) {
+            delta += (int64_t)estimateLayer(incremental, layer + x * bytes) - (int64_t)incremental->touchedEstimates[k];
+            incremental->nextChanged[numNext++] = x;
+        }
+    }
+
+    incremental->nf[t] = (uint64_t)((int64_t)incremental->nf[t] + delta);
+    stats->modified += numNext;
+
+    uint64_t* changed = incremental->changed;
+    incremental->changed = incremental->nextChanged;
+    incremental->nextChanged = changed;
+
+    uint8_t* differed = incremental->differed;
+    incremental->differed = incremental->nextDiffered;
+    incremental->nextDiffered = differed;
+
+    return numNext;
+}
+
+/* Drops the layers past the first round in which no counter changed */
+static void trimLayers(AnfIncremental* incremental)
+{
+    uint64_t T = 1;
+
+    while (T + 1 < incremental->numLayers && incremental->changes[T] > 0) {
+        T++;
+    }
+
+    for (uint64_t t = T + 1; t < incremental->numLayers; t++) {
+        free(incremental->layers[t]);
+    }
+
+    incremental->numLayers = T + 1;
+}
+
+/* Run HyperANF keeping every round */
+AnfIncremental* anf_incremental_init(const Graph* graph, const AnfOptions* options)
+{
+    if (options->resumePath) return NULL;
+
+    AnfIncremental* incremental = (AnfIncremental*)calloc(1, sizeof(AnfIncremental));
+
+    if (!incremental) return NULL;
+
+    incremental->shape = initCounters(0, options->p, options->seed, options->registerWidth, NULL, false);
+    incremental->kernels = hll_fixed_kernels(options->p);
+    incremental->transpose = graph_transpose(graph);
+
+    if (!incremental->shape || !incremental->transpose) {
+        anf_incremental_free(incremental);
+        return NULL;
+    }
+
+    uint64_t rounds;
+    uint64_t* nf = runAnf(graph, NULL, options, &rounds, incremental);
+
+    /* The layers hold every node already */
+    incremental->numNodes = graph->numNodes;
+    incremental->baseNodes = graph->numNodes;
+
+    if (!nf || !reserveNodes(incremental, graph->numNodes)) {
+        free(nf);
+        anf_incremental_free(incremental);
+        return NULL;
+    }
+
+    memcpy(incremental->nf, nf, rounds * sizeof(uint64_t));
+    free(nf);
+
+    return incremental;
+}
+
+/* Add arcs and update the neighborhood function */
+bool anf_incremental_add_arcs(AnfIncremental* incremental, uint64_t numArcs, const uint64_t* sources,
+                              const uint64_t* targets, AnfUpdateStats* stats)
+{
+    AnfUpdateStats ignored;
+    double start = now();
+    uint64_t numNodes = incremental->numNodes;
+    uint64_t numChanged = 0;
+
+    if (!stats) stats = &ignored;
+    memset(stats, 0, sizeof(AnfUpdateStats));
+
+    if (incremental->failed) return false;
+
+    for (uint64_t e = 0; e < numArcs; e++) {
+        if (sources[e] >= numNodes) numNodes = sources[e] + 1;
+        if (targets[e] >= numNodes) numNodes = targets[e] + 1;
+    }
+
+    uint64_t capacity = incremental->nodeCapacity;
+
+    if (numNodes > capacity) {
+        capacity = numNodes > 2 * capacity ? numNodes : 2 * capacity;
+    }
+
+    if (!reserveNodes(incremental, capacity) || !reserveArcs(incremental, incremental->numAdded + numArcs)) {
+        return false;
+    }
+
+    stats->addedNodes = numNodes - incremental->numNodes;
+    seedNodes(incremental, numNodes);
+
+    for (uint64_t e = 0; e < numArcs; e++) {
+        uint64_t a = incremental->numAdded++;
+
+        incremental->addedSource[a] = sources[e];
+        incremental->addedNext[a] = incremental->addedHead[targets[e]];
+        incremental->addedHead[targets[e]] = a;
+    }
+
+    /* No counter changed in the round before round 1 */
+    incremental->stamp++;
+
+    for (uint64_t t = 1; t < incremental->numLayers || numChanged > 0; t++) {
+        if (t == incremental->numLayers && !extendLayers(incremental)) {
+            incremental->failed = true;
+            return false;
+        }
+
+        numChanged = updateRound(incremental, t, numChanged, numArcs, sources, targets, stats);
+        stats->rounds++;
+    }
+
+    trimLayers(incremental);
+    stats->seconds = now() - start;
+
+    return true;
+}
+
+/* Get the neighborhood function of an incremental run */
+const uint64_t* anf_incremental_nf(const AnfIncremental* incremental, uint64_t* rounds)
+{
+    *rounds = incremental->numLayers;
+
+    return incremental->nf;
+}
+
+/* Get the number of nodes of an incremental run */
+uint64_t anf_incremental_nodes(const AnfIncremental* incremental)
+{
+    return incremental->numNodes;
+}
+
+/* Free an incremental run */
+void anf_incremental_free(AnfIncremental* incremental)
+{
+    if (!incremental) return;
+
+    for (uint64_t t = 0; t < incremental->numLayers; t++) {
+        free(incremental->layers[t]);
+    }
+
+    anf_counters_free(incremental->shape);
+    graph_free(incremental->transpose);
+    free(incremental->layers);
+    free(incremental->changes);
+    free(incremental->nf);
+    free(incremental->addedHead);
+    free(incremental->addedSource);
+    free(incremental->addedNext);
+    free(incremental->changed);
+    free(incremental->nextChanged);
+    free(incremental->differed);
+    free(incremental->nextDiffered);
+    free(incremental->touched);
+    free(incremental->touchedEstimates);
+    free(incremental->touchedDiffered);
+    free(incremental->touchedStamp);
+    free(incremental->changedStamp);
+    free(incremental);
+}
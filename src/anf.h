@@ -0,0 +1,243 @@
+#ifndef ANF_H
+#define ANF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "graph.h"
+#include "cgraph.h"
+
+/* Array of HyperLogLog counters, one per node, for HyperANF. All registers
+ * live in a single aligned slab holding a current and a next buffer of
+ * numCounters counters of 2^p registers; the buffers swap each round.
+ * Registers take a byte each unless the array is created packed. */
+typedef struct AnfCounters AnfCounters;
+
+/* Creates numCounters empty counters with 2^p registers each */
+AnfCounters* anf_counters_init(uint64_t numCounters, unsigned short p, uint64_t seed);
+
+/* Creates numCounters empty counters whose two buffers live in a file
+ * mapped into memory rather than in RAM, for graphs whose counters do not
+ * fit. The file is created (or truncated) at path and removed on free. */
+AnfCounters* anf_counters_init_mapped(uint64_t numCounters, unsigned short p, uint64_t seed, const char* path);
+
+/* Creates numCounters empty counters with 2^p registers of width bits,
+ * in a mapped file at path or in RAM if path is NULL. Width 8 stores a
+ * register per byte, so merges are a plain vector max, for compute-bound
+ * runs. Widths 6 and 5 pack 10 or 12 registers into each 64-bit word and
+ * merge with broadword max, cutting counter memory by 20% and 33% for
+ * memory-bound runs. Ranks saturate at 2^width - 1; 5-bit registers only
+ * saturate after ~2^31 elements per register, which graphs under 2^32
+ * nodes never reach. */
+AnfCounters* anf_counters_init_width(uint64_t numCounters, unsigned short p, uint64_t seed, unsigned width,
+                                     const char* path);
+
+/* Copies the current registers of a counter array into a new array in RAM
+ * with registers of another width, whose next buffer matches its current
+ * one. Ranks above what the new width holds saturate. */
+AnfCounters* anf_counters_convert(AnfCounters* counters, unsigned width);
+
+/* Frees the memory used by a counter array */
+void anf_counters_free(AnfCounters* counters);
+
+/* Swaps the current and next buffers */
+void anf_counters_swap(AnfCounters* counters);
+
+/* Gets the anf_counters_bytes bytes holding counter i in the current buffer */
+uint8_t* anf_counters_current(AnfCounters* counters, uint64_t i);
+
+/* Gets the anf_counters_bytes bytes holding counter i in the next buffer */
+uint8_t* anf_counters_next(AnfCounters* counters, uint64_t i);
+
+/* Copies the registers of counter i in the current buffer out, one byte
+ * per register, whatever the width */
+void anf_counters_get_registers(AnfCounters* counters, uint64_t i, uint8_t* out);
+
+/* Adds an element to counter i in the current buffer */
+bool anf_counters_add(AnfCounters* counters, uint64_t i, const uint8_t* data, uint64_t dataLen);
+
+/* Gets the cardinality estimate of counter i in the current buffer */
+uint64_t anf_counters_cardinality(AnfCounters* counters, uint64_t i);
+
+/* Writes the (unrounded) cardinality estimates of counters first ...
+ * first + count - 1 in the current buffer to estimates and returns their sum */
+double anf_counters_cardinalities(AnfCounters* counters, uint64_t first, uint64_t count, double* estimates);
+
+/* How a range of counters is about to be accessed */
+typedef enum AnfAccess {
+    ANF_ACCESS_SEQUENTIAL,        /* Read or written once, in order */
+    ANF_ACCESS_RANDOM,            /* Read in no particular order */
+    ANF_ACCESS_SOON               /* Needed shortly; start reading it in */
+} AnfAccess;
+
+/* Passes an access hint for counters first ... first + count - 1 of the
+ * current (or next) buffer to the OS. Does nothing for counters in RAM. */
+void anf_counters_advise(AnfCounters* counters, bool next, uint64_t first, uint64_t count, AnfAccess access);
+
+/* Gets the number of counters */
+uint64_t anf_counters_count(AnfCounters* counters);
+
+/* Gets the number of registers per counter */
+uint64_t anf_counters_size(AnfCounters* counters);
+
+/* Gets the number of bits per register */
+unsigned anf_counters_width(AnfCounters* counters);
+
+/* Gets the number of bytes per counter */
+uint64_t anf_counters_bytes(AnfCounters* counters);
+
+/* Table of the initial register of every node's counter, i.e. the (index,
+ * rank) pair that adding the node id sets. It only depends on the number
+ * of nodes, p and the seed, so it can be kept across runs. */
+typedef struct AnfSeeds AnfSeeds;
+
+/* Hashes node ids 0 ... numNodes - 1 into a seed table */
+AnfSeeds* anf_seeds_init(uint64_t numNodes, unsigned short p, uint64_t seed);
+
+/* Frees a seed table */
+void anf_seeds_free(AnfSeeds* seeds);
+
+/* How each round picks the counters to recompute. Only nodes with a
+ * successor whose counter changed last round can change this round. Sparse
+ * and push rounds need the transpose graph, which is built on first use;
+ * compressed graphs always sweep. */
+typedef enum AnfStrategy {
+    ANF_STRATEGY_AUTO,            /* Sparse while few counters change, dense otherwise */
+    ANF_STRATEGY_DENSE,           /* Sweep every node, merging only modified successors */
+    ANF_STRATEGY_SPARSE,          /* Visit only predecessors of modified nodes */
+    ANF_STRATEGY_PUSH,            /* Max modified counters into their predecessors */
+    ANF_STRATEGY_FULL             /* Recompute every counter from all successors */
+} AnfStrategy;
+
+/* Parses "auto", "dense", "sparse", "push" or "full". Returns false if the
+ * name is unknown. */
+bool anf_strategy_parse(const char* name, AnfStrategy* strategy);
+
+/* Work done by one HyperANF round. Round 0 seeds every counter with its
+ * own node. */
+typedef struct AnfRoundStats {
+    uint64_t round;               /* Round number t */
+    double seconds;               /* Wall time of the round */
+    bool sparse;                  /* If only the predecessors of modified nodes were visited */
+    bool push;                    /* If modified counters were pushed into their predecessors */
+    uint64_t active;              /* Nodes whose counter was recomputed */
+    uint64_t modified;            /* Nodes whose counter changed */
+    uint64_t merges;              /* Successor counters merged */
+    uint64_t registersChanged;    /* Registers raised over all counters */
+    uint64_t bytesTouched;        /* Counter bytes read or written */
+    uint64_t neighborhood;        /* Neighborhood function N(t) */
+} AnfRoundStats;
+
+/* Called by the thread running HyperANF after each round. Returning false
+ * stops the run, which then fails. */
+typedef bool (*AnfRoundCallback)(const AnfRoundStats* stats, void* arg);
+
+/* Round callback writing each round as one line of JSON to the FILE* arg */
+bool anf_log_round_json(const AnfRoundStats* stats, void* file);
+
+/* Where the counters of a run kept in RAM live on a NUMA machine. All but
+ * DEFAULT allocate the counter pages untouched and then zero the counters
+ * of each chunk from the thread that starts on it, so with pinned threads
+ * (AnfOptions.pinThreads) a thread mostly merges into counters on its own
+ * node. PARTITIONED pins the threads whatever pinThreads says, and falls
+ * back to first touch if they cannot be pinned; so do policies the OS
+ * cannot apply. */
+typedef enum AnfPlacement {
+    ANF_PLACEMENT_DEFAULT,        /* One zeroed allocation, on whatever node malloc picks */
+    ANF_PLACEMENT_FIRST_TOUCH,    /* Each page on the node of the thread zeroing it */
+    ANF_PLACEMENT_INTERLEAVE,     /* Pages spread round-robin over every node */
+    ANF_PLACEMENT_PARTITIONED     /* Each thread's node range bound to its thread's node */
+} AnfPlacement;
+
+/* Parses "default", "first-touch", "interleave" or "partitioned". Returns
+ * false if the name is unknown. */
+bool anf_placement_parse(const char* name, AnfPlacement* placement);
+
+/* HyperANF run parameters */
+typedef struct AnfOptions {
+    unsigned short p;             /* 2^p registers per counter */
+    uint64_t seed;                /* MurmurHash64A seed */
+    unsigned threads;             /* Worker threads (0 = one per CPU) */
+    AnfStrategy strategy;         /* Dense sweep / sparse frontier selection */
+    double sparseFraction;        /* AUTO goes sparse below this fraction of modified nodes */
+    double pushFraction;          /* AUTO pushes when fewer arcs than this fraction lead into modified nodes */
+    const AnfSeeds* seeds;        /* Cached seed table, or NULL to hash the node ids */
+    const char* counterPath;      /* Keep the counters in this file instead of RAM, or NULL */
+    AnfRoundCallback onRound;     /* Called after each round, or NULL */
+    void* onRoundArg;             /* Passed to onRound */
+    const char* checkpointPath;   /* Write a checkpoint here every checkpointRounds rounds, or NULL */
+    unsigned checkpointRounds;    /* Rounds between checkpoints */
+    const char* resumePath;       /* Carry on from this checkpoint instead of seeding, or NULL */
+    unsigned registerWidth;       /* Bits per register: 8 (bytes), or 6 or 5 packed */
+    const uint64_t* nodeIds;      /* Id each node is seeded with, e.g. its id before reordering, or NULL */
+    AnfPlacement placement;       /* NUMA placement of counters kept in RAM */
+    bool pinThreads;              /* Pin the worker threads node by node (see sched_pin) */
+} AnfOptions;
+
+/* Fills in the default options */
+void anf_options_init(AnfOptions* options);
+
+/* Runs HyperANF until no register changes, which can take rounds after the
+ * last change of the estimates. A seed table that does not match
+ * the graph size, p and seed is ignored. Seeding each node of a reordered
+ * graph (see graph_order.h) with its original id gives the same result as
+ * a run over the original graph. Checkpoints are written on a
+ * background thread while the next round runs. A run resumed from a
+ * checkpoint needs the same graph, p and seed, and gives the same result
+ * as an uninterrupted run; its registers are converted if it was written
+ * with another register width. Returns a malloc'd array with the
+ * neighborhood function N(0), ..., N(T) and stores T + 1 in rounds, or
+ * returns NULL if memory runs out, the register width is not 5, 6 or 8,
+ * the round callback stops the run, a checkpoint cannot be written or the
+ * resume checkpoint does not match. */
+uint64_t* anf_run(const Graph* graph, const AnfOptions* options, uint64_t* rounds);
+
+/* Runs HyperANF over a compressed graph, decoding the successor lists as
+ * each round walks them. Rounds always sweep every node (as with
+ * ANF_STRATEGY_DENSE), since that needs no transpose. */
+uint64_t* anf_run_compressed(const CompressedGraph* graph, const AnfOptions* options, uint64_t* rounds);
+
+/* HyperANF kept up to date as arcs are added to a graph. It holds the
+ * counters of every round t = 0 ... T, so it needs T + 1 times the counter
+ * memory of a run. Counters only grow under union, so an arc u -> v can
+ * only raise the round t counters of nodes that reach u in fewer than t
+ * steps: each batch of arcs is propagated round by round from the nodes
+ * that changed, through their predecessors, as in a push round. */
+typedef struct AnfIncremental AnfIncremental;
+
+/* Work done by one batch of added arcs */
+typedef struct AnfUpdateStats {
+    uint64_t rounds;              /* Rounds visited */
+    uint64_t active;              /* Counters recomputed, over all rounds */
+    uint64_t modified;            /* Counters that changed, over all rounds */
+    uint64_t merges;              /* Counters merged into others */
+    uint64_t addedNodes;          /* Nodes added by arcs past the last node */
+    double seconds;               /* Wall time of the update */
+} AnfUpdateStats;
+
+/* Runs HyperANF over a graph, keeping the counters of every round. The
+ * graph is not needed afterwards. Resuming from a checkpoint is not
+ * supported, since the rounds before it are lost. Returns NULL if memory
+ * runs out or the run fails as anf_run does. */
+AnfIncremental* anf_incremental_init(const Graph* graph, const AnfOptions* options);
+
+/* Adds numArcs arcs sources[e] -> targets[e] and updates the neighborhood
+ * function, in time proportional to the counters they change (plus the
+ * arcs themselves each round, and a copy of the counters for each round the
+ * run grows by). Ids past the last node add nodes, which are seeded with
+ * their own id. Afterwards the result is the one anf_run gives for the
+ * whole graph. stats may be NULL. Returns false if memory runs out; if it
+ * ran out while the rounds were being updated, the run is lost and every
+ * later call fails too. */
+bool anf_incremental_add_arcs(AnfIncremental* incremental, uint64_t numArcs, const uint64_t* sources,
+                              const uint64_t* targets, AnfUpdateStats* stats);
+
+/* Gets the neighborhood function N(0), ..., N(T) and stores T + 1 in rounds */
+const uint64_t* anf_incremental_nf(const AnfIncremental* incremental, uint64_t* rounds);
+
+/* Gets the number of nodes */
+uint64_t anf_incremental_nodes(const AnfIncremental* incremental);
+
+/* Frees an incremental run */
+void anf_incremental_free(AnfIncremental* incremental);
+
+#endif /* ANF_H */
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "anf_checkpoint.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* File layout: magic, then numNodes, numEdges, p, seed, register width,
+ * bytes per counter, rounds and the offset of the registers, all
+ * native-endian, then nf, the bitmap, zero padding and the registers */
+#define CHECKPOINT_MAGIC "HANFCK02"
+#define CHECKPOINT_HEADER_SIZE 72
+#define CHECKPOINT_ALIGNMENT 64
+
+/* Checkpoint writer structure definition */
+struct AnfCheckpointWriter {
+    pthread_t thread;             /* Thread writing the file */
+    AnfCheckpoint checkpoint;     /* What to write; nf is owned */
+    char* path;                   /* Final file name */
+    bool ok;                      /* If the file was written */
+};
+
+/* Gets the number of bitmap words for numNodes nodes */
+static inline uint64_t bitmapWords(uint64_t numNodes)
+{
+    return (numNodes + 63) / 64;
+}
+
+/* Gets the file offset of the registers */
+static inline uint64_t registersOffset(uint64_t numNodes, uint64_t rounds)
+{
+    uint64_t end = CHECKPOINT_HEADER_SIZE + (rounds + bitmapWords(numNodes)) * sizeof(uint64_t);
+
+    return (end + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+/* Writes a whole checkpoint to an open file */
+static bool writeCheckpoint(FILE* file, const AnfCheckpoint* checkpoint)
+{
+    uint64_t offset = registersOffset(checkpoint->numNodes, checkpoint->rounds);
+    uint64_t header[8] = {checkpoint->numNodes, checkpoint->numEdges, checkpoint->p, checkpoint->seed,
+                          checkpoint->width, checkpoint->counterBytes, checkpoint->rounds, offset};
+    uint64_t words = bitmapWords(checkpoint->numNodes);
+    uint64_t padding = offset - CHECKPOINT_HEADER_SIZE - (checkpoint->rounds + words) * sizeof(uint64_t);
+    uint64_t size = checkpoint->numNodes * checkpoint->counterBytes;
+    uint8_t zeros[CHECKPOINT_ALIGNMENT] = {0};
+
+    return fwrite(CHECKPOINT_MAGIC, 1, 8, file) == 8 &&
+           fwrite(header, sizeof(uint64_t), 8, file) == 8 &&
+           fwrite(checkpoint->nf, sizeof(uint64_t), checkpoint->rounds, file) == checkpoint->rounds &&
+           fwrite(checkpoint->modified, sizeof(uint64_t), words, file) == words &&
+           fwrite(zeros, 1, padding, file) == padding &&
+           fwrite(checkpoint->registers, 1, size, file) == size;
+}
+
+/* Writes the checkpoint to a temporary file, flushes it to disk and moves
+ * it over the final name */
+static void* writerThread(void* arg)
+{
+    AnfCheckpointWriter* writer = (AnfCheckpointWriter*)arg;
+    uint64_t length = strlen(writer->path);
+    char* tmp = (char*)malloc(length + 5);
+    FILE* file;
+
+    if (!tmp) return NULL;
+
+    memcpy(tmp, writer->path, length);
+    memcpy(tmp + length, ".tmp", 5);
+    file = fopen(tmp, "wb");
+
+    if (file) {
+        bool ok = writeCheckpoint(file, &writer->checkpoint) && fflush(file) == 0;
+
+#ifdef _WIN32
+        ok = ok && _commit(_fileno(file)) == 0;
+#else
+        ok = ok && fsync(fileno(file)) == 0;
+#endif
+        ok = fclose(file) == 0 && ok;
+
+#ifdef _WIN32
+        writer->ok = ok && MoveFileExA(tmp, writer->path, MOVEFILE_REPLACE_EXISTING);
+#else
+        writer->ok = ok && rename(tmp, writer->path) == 0;
+#endif
+
+        if (!writer->ok) {
+            remove(tmp);
+        }
+    }
+
+    free(tmp);
+
+    return NULL;
+}
+
+/* Start writing a checkpoint */
+AnfCheckpointWriter* anf_checkpoint_write_async(const char* path, const AnfCheckpoint* checkpoint)
+{
+    AnfCheckpointWriter* writer = (AnfCheckpointWriter*)calloc(1, sizeof(AnfCheckpointWriter));
+    uint64_t* nf = (uint64_t*)malloc((checkpoint->rounds + 1) * sizeof(uint64_t));
+    char* name = (char*)malloc(strlen(path) + 1);
+
+    if (!writer || !nf || !name) {
+        goto fail;
+    }
+
+    /* The run keeps appending to (and reallocating) its own nf */
+    memcpy(nf, checkpoint->nf, checkpoint->rounds * sizeof(uint64_t));
+    strcpy(name, path);
+
+    writer->checkpoint = *checkpoint;
+    writer->checkpoint.nf = nf;
+    writer->checkpoint.map = NULL;
+    writer->path = name;
+
+    if (pthread_create(&writer->thread, NULL, writerThread, writer) != 0) {
+        goto fail;
+    }
+
+    return writer;
+
+fail:
+    free(writer);
+    free(nf);
+    free(name);
+
+    return NULL;
+}
+
+/* Wait for a checkpoint writer */
+bool anf_checkpoint_wait(AnfCheckpointWriter* writer)
+{
+    bool ok;
+
+    if (!writer) return false;
+
+    pthread_join(writer->thread, NULL);
+    ok = writer->ok;
+
+    free((void*)writer->checkpoint.nf);
+    free(writer->path);
+    free(writer);
+
+    return ok;
+}
+
+/* Load a checkpoint file */
+AnfCheckpoint* anf_checkpoint_load(const char* path)
+{
+    AnfCheckpoint* checkpoint = (AnfCheckpoint*)calloc(1, sizeof(AnfCheckpoint));
+    const uint8_t* map = NULL;
+    uint64_t size = 0;
+
+    if (!checkpoint) return NULL;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER length;
+
+    if (file != INVALID_HANDLE_VALUE) {
+        if (GetFileSizeEx(file, &length) && length.QuadPart >= CHECKPOINT_HEADER_SIZE) {
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+            size = (uint64_t)length.QuadPart;
+            map = mapping ? (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+            if (mapping) CloseHandle(mapping);
+        }
+
+        CloseHandle(file);
+    }
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+
+    if (fd >= 0) {
+        if (fstat(fd, &info) == 0 && (uint64_t)info.st_size >= CHECKPOINT_HEADER_SIZE) {
+            void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+            size = (uint64_t)info.st_size;
+            map = view == MAP_FAILED ? NULL : (const uint8_t*)view;
+
+            /* Resuming copies the registers out front to back */
+            if (map) posix_madvise(view, size, POSIX_MADV_SEQUENTIAL);
+        }
+
+        close(fd);
+    }
+#endif
+
+    if (!map) {
+        free(checkpoint);
+        return NULL;
+    }
+
+    checkpoint->map = (void*)map;
+    checkpoint->mapSize = size;
+
+    uint64_t header[8];
+    memcpy(header, map + 8, sizeof(header));
+
+    checkpoint->numNodes = header[0];
+    checkpoint->numEdges = header[1];
+    checkpoint->p = (unsigned short)header[2];
+    checkpoint->seed = header[3];
+    checkpoint->width = (unsigned)header[4];
+    checkpoint->counterBytes = header[5];
+    checkpoint->rounds = header[6];
+
+    /* Bound the counts before any size arithmetic can overflow */
+    if (memcmp(map, CHECKPOINT_MAGIC, 8) != 0 || header[2] < 4 || header[2] > 16 || header[4] > 8 ||
+        header[5] == 0 || header[5] > size || header[0] > size / header[5] ||
+        header[6] == 0 || header[6] > size / sizeof(uint64_t) ||
+        header[7] != registersOffset(header[0], header[6]) || header[7] + header[0] * header[5] != size) {
+        anf_checkpoint_free(checkpoint);
+        return NULL;
+    }
+
+    checkpoint->nf = (const uint64_t*)(map + CHECKPOINT_HEADER_SIZE);
+    checkpoint->modified = checkpoint->nf + checkpoint->rounds;
+    checkpoint->registers = map + header[7];
+
+    return checkpoint;
+}
+
+/* Free a checkpoint */
+void anf_checkpoint_free(AnfCheckpoint* checkpoint)
+{
+    if (!checkpoint) return;
+
+    if (checkpoint->map) {
+#ifdef _WIN32
+        UnmapViewOfFile(checkpoint->map);
+#else
+        munmap(checkpoint->map, checkpoint->mapSize);
+#endif
+    }
+
+    free(checkpoint);
+}
@@ -0,0 +1,47 @@
+#ifndef ANF_CHECKPOINT_H
+#define ANF_CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* State of a HyperANF run after a round: enough to carry on with the next
+ * round. The file holds a header, the neighborhood function so far, the
+ * bitmap of the nodes whose counter changed in the last round and the
+ * current registers of every counter, 64-byte aligned. */
+typedef struct AnfCheckpoint {
+    uint64_t numNodes;            /* Number of nodes (and counters) */
+    uint64_t numEdges;            /* Number of arcs of the graph */
+    unsigned short p;             /* 2^p registers per counter */
+    uint64_t seed;                /* MurmurHash64A seed */
+    unsigned width;               /* Bits per register (see anf_counters_init_width) */
+    uint64_t counterBytes;        /* Bytes per counter */
+    uint64_t rounds;              /* Rounds completed, i.e. entries of nf */
+    const uint64_t* nf;           /* Neighborhood function N(0) ... N(rounds - 1) */
+    const uint64_t* modified;     /* (numNodes + 63) / 64 words, one bit per node */
+    const uint8_t* registers;     /* numNodes counters of counterBytes bytes */
+    void* map;                    /* File mapping holding the arrays, or NULL */
+    uint64_t mapSize;             /* Size of the file mapping */
+} AnfCheckpoint;
+
+/* Memory-maps a checkpoint file. Returns NULL if it cannot be read or its
+ * sizes do not add up. */
+AnfCheckpoint* anf_checkpoint_load(const char* path);
+
+/* Unmaps a checkpoint */
+void anf_checkpoint_free(AnfCheckpoint* checkpoint);
+
+/* Checkpoint being written by a background thread */
+typedef struct AnfCheckpointWriter AnfCheckpointWriter;
+
+/* Starts writing a checkpoint to path on a background thread. The file is
+ * written next to path and renamed over it once complete, so path always
+ * holds a whole checkpoint. nf is copied; the bitmap and the registers are
+ * read in place and must not change until anf_checkpoint_wait returns.
+ * Returns NULL if the thread cannot be started. */
+AnfCheckpointWriter* anf_checkpoint_write_async(const char* path, const AnfCheckpoint* checkpoint);
+
+/* Waits for a checkpoint writer to finish and frees it. Returns false if
+ * the checkpoint could not be written. */
+bool anf_checkpoint_wait(AnfCheckpointWriter* writer);
+
+#endif /* ANF_CHECKPOINT_H */
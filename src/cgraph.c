@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cgraph.h"
+#include "varint.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* File layout: magic, numNodes, numEdges, data size, then the offsets and
+ * the data, all native-endian. The header keeps the offsets 8-byte aligned. */
+#define CGRAPH_MAGIC "HANFCG01"
+#define CGRAPH_HEADER_SIZE 32
+
+/* Longest varint of a 64-bit value */
+#define CGRAPH_MAX_VARINT 10
+
+static int compareNodes(const void* a, const void* b)
+{
+    uint64_t A = *(const uint64_t*)a;
+    uint64_t B = *(const uint64_t*)b;
+
+    return (A > B) - (A < B);
+}
+
+/* Compress a CSR graph */
+CompressedGraph* cgraph_compress(const Graph* graph)
+{
+    CompressedGraph* compressed = (CompressedGraph*)calloc(1, sizeof(CompressedGraph));
+    uint64_t* offsets = (uint64_t*)malloc((graph->numNodes + 1) * sizeof(uint64_t));
+    uint64_t* sorted = NULL;
+    uint8_t* data = NULL;
+    uint64_t capacity = 0;
+    uint64_t size = 0;
+    uint64_t maxDegree = 0;
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        if (graph_degree(graph, v) > maxDegree) {
+            maxDegree = graph_degree(graph, v);
+        }
+    }
+
+    sorted = (uint64_t*)malloc((maxDegree > 0 ? maxDegree : 1) * sizeof(uint64_t));
+
+    if (!compressed || !offsets || !sorted) {
+        goto fail;
+    }
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        uint64_t degree = graph_degree(graph, v);
+        uint64_t needed = size + (degree + 1) * CGRAPH_MAX_VARINT;
+
+        if (needed > capacity) {
+            uint64_t newCapacity = capacity > 0 ? capacity : 1024;
+            uint8_t* grown;
+
+            while (newCapacity < needed) {
+                newCapacity *= 2;
+            }
+
+            grown = (uint8_t*)realloc(data, newCapacity);
+
+            if (!grown) {
+                goto fail;
+            }
+
+            data = grown;
+            capacity = newCapacity;
+        }
+
+        memcpy(sorted, graph_successors(graph, v), degree * sizeof(uint64_t));
+        qsort(sorted, degree, sizeof(uint64_t), compareNodes);
+
+        offsets[v] = size;
+        size += writeVarint(data + size, degree);
+
+        for (uint64_t k = 0; k < degree; k++) {
+            uint64_t code;
+
+            if (k == 0) {
+                code = sorted[0] >= v ? (sorted[0] - v) << 1 : ((v - sorted[0]) << 1) - 1;
+            } else {
+                code = sorted[k] - sorted[k - 1];
+            }
+
+            size += writeVarint(data + size, code);
+        }
+    }
+
+    offsets[graph->numNodes] = size;
+    free(sorted);
+
+    /* Give back the slack of the doubling */
+    if (size > 0) {
+        uint8_t* shrunk = (uint8_t*)realloc(data, size);
+        data = shrunk ? shrunk : data;
+    }
+
+    compressed->numNodes = graph->numNodes;
+    compressed->numEdges = graph->numEdges;
+    compressed->offsets = offsets;
+    compressed->data = data;
+
+    return compressed;
+
+fail:
+    free(compressed);
+    free(offsets);
+    free(sorted);
+    free(data);
+
+    return NULL;
+}
+
+/* Save a compressed graph */
+bool cgraph_save(const CompressedGraph* graph, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    uint64_t header[3] = {graph->numNodes, graph->numEdges, graph->offsets[graph->numNodes]};
+    bool ok;
+
+    if (!file) return false;
+
+    ok = fwrite(CGRAPH_MAGIC, 1, 8, file) == 8 &&
+         fwrite(header, sizeof(uint64_t), 3, file) == 3 &&
+         fwrite(graph->offsets, sizeof(uint64_t), graph->numNodes + 1, file) == graph->numNodes + 1 &&
+         fwrite(graph->data, 1, header[2], file) == header[2];
+
+    return fclose(file) == 0 && ok;
+}
+
+/* Load a compressed graph file */
+CompressedGraph* cgraph_load(const char* path)
+{
+    CompressedGraph* graph = (CompressedGraph*)calloc(1, sizeof(CompressedGraph));
+    const uint8_t* map = NULL;
+    uint64_t size = 0;
+
+    if (!graph) return NULL;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER length;
+
+    if (file != INVALID_HANDLE_VALUE) {
+        if (GetFileSizeEx(file, &length) && length.QuadPart >= CGRAPH_HEADER_SIZE) {
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+            size = (uint64_t)length.QuadPart;
+            map = mapping ? (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+            if (mapping) CloseHandle(mapping);
+        }
+
+        CloseHandle(file);
+    }
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+
+    if (fd >= 0) {
+        if (fstat(fd, &info) == 0 && (uint64_t)info.st_size >= CGRAPH_HEADER_SIZE) {
+            void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+            size = (uint64_t)info.st_size;
+            map = view == MAP_FAILED ? NULL : (const uint8_t*)view;
+
+            /* Rounds read the successor lists front to back */
+            if (map) posix_madvise(view, size, POSIX_MADV_SEQUENTIAL);
+        }
+
+        close(fd);
+    }
+#endif
+
+    if (!map) {
+        free(graph);
+        return NULL;
+    }
+
+    graph->map = (void*)map;
+    graph->mapSize = size;
+
+    uint64_t header[3];
+    memcpy(header, map + 8, sizeof(header));
+
+    graph->numNodes = header[0];
+    graph->numEdges = header[1];
+    graph->offsets = (const uint64_t*)(map + CGRAPH_HEADER_SIZE);
+
+    uint64_t offsetsSize = (graph->numNodes + 1) * sizeof(uint64_t);
+    graph->data = map + CGRAPH_HEADER_SIZE + offsetsSize;
+
+    /* The sizes in the header must add up to the file size */
+    if (memcmp(map, CGRAPH_MAGIC, 8) != 0 || graph->numNodes >= size / sizeof(uint64_t) || header[2] > size ||
+        CGRAPH_HEADER_SIZE + offsetsSize + header[2] != size ||
+        graph->offsets[0] != 0 || graph->offsets[graph->numNodes] != header[2]) {
+        cgraph_free(graph);
+        return NULL;
+    }
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        if (graph->offsets[v] >= graph->offsets[v + 1]) {
+            cgraph_free(graph);
+            return NULL;
+        }
+    }
+
+    return graph;
+}
+
+/* Check every successor list */
+bool cgraph_validate(const CompressedGraph* graph)
+{
+    uint64_t edges = 0;
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        const uint8_t* pos = graph->data + graph->offsets[v];
+        const uint8_t* end = graph->data + graph->offsets[v + 1];
+        uint64_t degree, code, last = v;
+
+        if (!readVarintBounded(&pos, end, &degree)) {
+            return false;
+        }
+
+        for (uint64_t k = 0; k < degree; k++) {
+            if (!readVarintBounded(&pos, end, &code)) {
+                return false;
+            }
+
+            if (k == 0) {
+                if ((code & 1) && (code >> 1) >= v) {
+                    return false;
+                }
+                last = (code & 1) ? v - (code >> 1) - 1 : v + (code >> 1);
+            } else if (code < graph->numNodes - last) {
+                last += code;
+            } else {
+                return false;
+            }
+
+            if (last >= graph->numNodes) {
+                return false;
+            }
+        }
+
+        if (pos != end) {
+            return false;
+        }
+
+        edges += degree;
+    }
+
+    return edges == graph->numEdges;
+}
+
+/* Free a compressed graph */
+void cgraph_free(CompressedGraph* graph)
+{
+    if (!graph) return;
+
+    if (graph->map) {
+#ifdef _WIN32
+        UnmapViewOfFile(graph->map);
+#else
+        munmap(graph->map, graph->mapSize);
+#endif
+    } else {
+        free((void*)graph->offsets);
+        free((void*)graph->data);
+    }
+
+    free(graph);
+}
@@ -0,0 +1,99 @@
+#ifndef CGRAPH_H
+#define CGRAPH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "graph.h"
+
+/* Directed graph with compressed successor lists. The list of node v is
+ * stored at data[offsets[v]] ... data[offsets[v + 1] - 1] as varints
+ * (7 bits per byte, low groups first): the degree, then the first successor
+ * as a zigzag-coded difference from v, then the gaps between consecutive
+ * successors, which are sorted. */
+typedef struct CompressedGraph {
+    uint64_t numNodes;            /* Number of nodes */
+    uint64_t numEdges;            /* Number of arcs */
+    const uint64_t* offsets;      /* numNodes + 1 byte offsets into data */
+    const uint8_t* data;          /* Encoded successor lists, back to back */
+    void* map;                    /* File mapping holding offsets and data, or NULL if allocated */
+    uint64_t mapSize;             /* Size of the file mapping */
+} CompressedGraph;
+
+/* Compresses a CSR graph; successor lists come out sorted. Returns NULL if
+ * memory runs out. */
+CompressedGraph* cgraph_compress(const Graph* graph);
+
+/* Writes a compressed graph to a file. Returns false on I/O errors. */
+bool cgraph_save(const CompressedGraph* graph, const char* path);
+
+/* Memory-maps a file written by cgraph_save. Only the header and offsets
+ * are checked; use cgraph_validate before trusting the successor lists. */
+CompressedGraph* cgraph_load(const char* path);
+
+/* Decodes every successor list once and checks that it stays within its
+ * bytes and every successor is a valid node */
+bool cgraph_validate(const CompressedGraph* graph);
+
+/* Frees (or unmaps) a compressed graph */
+void cgraph_free(CompressedGraph* graph);
+
+/* Decoding state for the successor list of one node */
+typedef struct CGraphReader {
+    const uint8_t* pos;           /* Next encoded byte */
+    uint64_t remaining;           /* Successors left to read */
+    uint64_t last;                /* Last successor read, or the node before the first */
+    bool first;                   /* If the next successor is the first one */
+} CGraphReader;
+
+/* Reads one varint */
+static inline uint64_t cgraph_read_varint(const uint8_t** pos)
+{
+    const uint8_t* p = *pos;
+    uint64_t value = *p & 0x7F;
+    unsigned shift = 7;
+
+    while (*p++ & 0x80) {
+        value |= (uint64_t)(*p & 0x7F) << shift;
+        shift += 7;
+    }
+
+    *pos = p;
+
+    return value;
+}
+
+/* Starts reading the successors of a node and returns its degree */
+static inline uint64_t cgraph_reader_init(CGraphReader* reader, const CompressedGraph* graph, uint64_t node)
+{
+    reader->pos = graph->data + graph->offsets[node];
+    reader->remaining = cgraph_read_varint(&reader->pos);
+    reader->last = node;
+    reader->first = true;
+
+    return reader->remaining;
+}
+
+/* Reads the next successor, or returns false at the end of the list */
+static inline bool cgraph_reader_next(CGraphReader* reader, uint64_t* successor)
+{
+    if (reader->remaining == 0) {
+        return false;
+    }
+
+    uint64_t code = cgraph_read_varint(&reader->pos);
+
+    if (reader->first) {
+        /* Zigzag: even codes step forward from the node, odd codes back */
+        reader->last = (code & 1) ? reader->last - (code >> 1) - 1 : reader->last + (code >> 1);
+        reader->first = false;
+    } else {
+        reader->last += code;
+    }
+
+    reader->remaining--;
+    *successor = reader->last;
+
+    return true;
+}
+
+#endif /* CGRAPH_H */
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include "graph.h"
+
+/* Create an empty graph */
+Graph* graph_init(uint64_t numNodes, uint64_t numEdges)
+{
+    Graph* graph = (Graph*)malloc(sizeof(Graph));
+
+    if (!graph) return NULL;
+
+    graph->numNodes = numNodes;
+    graph->numEdges = numEdges;
+    graph->ownsData = true;
+    graph->offsets = (uint64_t*)calloc(numNodes + 1, sizeof(uint64_t));
+    graph->targets = (uint64_t*)malloc((numEdges > 0 ? numEdges : 1) * sizeof(uint64_t));
+
+    if (!graph->offsets || !graph->targets) {
+        free(graph->offsets);
+        free(graph->targets);
+        free(graph);
+        return NULL;
+    }
+
+    return graph;
+}
+
+/* Wrap existing CSR arrays */
+Graph* graph_wrap(uint64_t numNodes, uint64_t* offsets, uint64_t* targets)
+{
+    Graph* graph = (Graph*)malloc(sizeof(Graph));
+
+    if (!graph) return NULL;
+
+    graph->numNodes = numNodes;
+    graph->numEdges = offsets[numNodes];
+    graph->offsets = offsets;
+    graph->targets = targets;
+    graph->ownsData = false;
+
+    return graph;
+}
+
+/* Build a graph from an arc list with a stable counting sort by source */
+Graph* graph_from_edges(uint64_t numNodes, uint64_t numEdges, const uint64_t* sources, const uint64_t* targets)
+{
+    Graph* graph = graph_init(numNodes, numEdges);
+
+    if (!graph) return NULL;
+
+    for (uint64_t e = 0; e < numEdges; e++) {
+        graph->offsets[sources[e] + 1]++;
+    }
+
+    for (uint64_t i = 0; i < numNodes; i++) {
+        graph->offsets[i + 1] += graph->offsets[i];
+    }
+
+    /* Fill using offsets[u] as a cursor, then shift the offsets back */
+    for (uint64_t e = 0; e < numEdges; e++) {
+        graph->targets[graph->offsets[sources[e]]++] = targets[e];
+    }
+
+    for (uint64_t i = numNodes; i > 0; i--) {
+        graph->offsets[i] = graph->offsets[i - 1];
+    }
+
+    graph->offsets[0] = 0;
+
+    return graph;
+}
+
+/* Free a graph */
+void graph_free(Graph* graph)
+{
+    if (!graph) return;
+
+    if (graph->ownsData) {
+        free(graph->offsets);
+        free(graph->targets);
+    }
+
+    free(graph);
+}
+
+/* Validate the CSR arrays */
+bool graph_validate(const Graph* graph)
+{
+    if (graph->offsets[0] != 0 || graph->offsets[graph->numNodes] != graph->numEdges) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < graph->numNodes; i++) {
+        if (graph->offsets[i] > graph->offsets[i + 1]) {
+            return false;
+        }
+    }
+
+    for (uint64_t e = 0; e < graph->numEdges; e++) {
+        if (graph->targets[e] >= graph->numNodes) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Build the transpose graph with a counting sort over the targets */
+Graph* graph_transpose(const Graph* graph)
+{
+    Graph* transpose = graph_init(graph->numNodes, graph->numEdges);
+
+    if (!transpose) return NULL;
+
+    for (uint64_t e = 0; e < graph->numEdges; e++) {
+        transpose->offsets[graph->targets[e] + 1]++;
+    }
+
+    for (uint64_t i = 0; i < graph->numNodes; i++) {
+        transpose->offsets[i + 1] += transpose->offsets[i];
+    }
+
+    /* Fill using offsets[v] as a cursor, then shift the offsets back */
+    for (uint64_t u = 0; u < graph->numNodes; u++) {
+        for (uint64_t e = graph->offsets[u]; e < graph->offsets[u + 1]; e++) {
+            transpose->targets[transpose->offsets[graph->targets[e]]++] = u;
+        }
+    }
+
+    for (uint64_t i = graph->numNodes; i > 0; i--) {
+        transpose->offsets[i] = transpose->offsets[i - 1];
+    }
+
+    transpose->offsets[0] = 0;
+
+    return transpose;
+}
@@ -0,0 +1,48 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Directed graph in compressed sparse row (CSR) form. The successors of
+ * node i are targets[offsets[i]] ... targets[offsets[i + 1] - 1]. */
+typedef struct Graph {
+    uint64_t numNodes;            /* Number of nodes */
+    uint64_t numEdges;            /* Number of arcs */
+    uint64_t* offsets;            /* numNodes + 1 row offsets into targets */
+    uint64_t* targets;            /* Successor lists, back to back */
+    bool ownsData;                /* If offsets/targets are freed with the graph */
+} Graph;
+
+/* Creates an empty graph with room for numNodes nodes and numEdges arcs */
+Graph* graph_init(uint64_t numNodes, uint64_t numEdges);
+
+/* Wraps existing CSR arrays without copying them */
+Graph* graph_wrap(uint64_t numNodes, uint64_t* offsets, uint64_t* targets);
+
+/* Builds a graph from numEdges arcs sources[e] -> targets[e], keeping the
+ * successors of each node in arc order. Every id must be < numNodes. */
+Graph* graph_from_edges(uint64_t numNodes, uint64_t numEdges, const uint64_t* sources, const uint64_t* targets);
+
+/* Frees a graph (and its arrays if it owns them) */
+void graph_free(Graph* graph);
+
+/* Checks that offsets are monotone and every target is a valid node */
+bool graph_validate(const Graph* graph);
+
+/* Builds the transpose graph (predecessor lists), or returns NULL if memory runs out */
+Graph* graph_transpose(const Graph* graph);
+
+/* Gets the out-degree of a node */
+static inline uint64_t graph_degree(const Graph* graph, uint64_t node)
+{
+    return graph->offsets[node + 1] - graph->offsets[node];
+}
+
+/* Gets a pointer to the successor list of a node */
+static inline const uint64_t* graph_successors(const Graph* graph, uint64_t node)
+{
+    return graph->targets + graph->offsets[node];
+}
+
+#endif /* GRAPH_H */
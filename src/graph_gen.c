@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include "graph_gen.h"
+
+/* splitmix64 step, good enough for synthetic graphs */
+static inline uint64_t nextRandom(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+/* Builds a graph from an arc list and frees the list */
+static Graph* fromArcs(uint64_t numNodes, uint64_t numEdges, uint64_t* sources, uint64_t* targets)
+{
+    Graph* graph = NULL;
+
+    if (sources && targets) {
+        graph = graph_from_edges(numNodes, numEdges, sources, targets);
+    }
+
+    free(sources);
+    free(targets);
+
+    return graph;
+}
+
+/* Generate an R-MAT graph */
+Graph* graph_rmat(unsigned scale, uint64_t numEdges, uint64_t seed)
+{
+    uint64_t* sources = (uint64_t*)malloc((numEdges > 0 ? numEdges : 1) * sizeof(uint64_t));
+    uint64_t* targets = (uint64_t*)malloc((numEdges > 0 ? numEdges : 1) * sizeof(uint64_t));
+    uint64_t state = seed;
+
+    /* Quadrant thresholds out of 2^16: a = 0.57, a + b = 0.76, a + b + c = 0.95 */
+    const uint64_t ab = 49807, abc = 62259, a = 37356;
+
+    for (uint64_t e = 0; sources && targets && e < numEdges; e++) {
+        uint64_t u = 0, v = 0;
+
+        for (unsigned level = 0; level < scale; level++) {
+            uint64_t r = nextRandom(&state) & 0xFFFF;
+
+            u <<= 1;
+            v <<= 1;
+
+            if (r >= abc) {
+                u |= 1;
+                v |= 1;
+            } else if (r >= ab) {
+                u |= 1;
+            } else if (r >= a) {
+                v |= 1;
+            }
+        }
+
+        sources[e] = u;
+        targets[e] = v;
+    }
+
+    return fromArcs(1ULL << scale, numEdges, sources, targets);
+}
+
+/* Generate an Erdos-Renyi graph */
+Graph* graph_erdos_renyi(uint64_t numNodes, uint64_t numEdges, uint64_t seed)
+{
+    /* Arcs need nodes to join */
+    if (numNodes == 0 && numEdges > 0) return NULL;
+
+    uint64_t* sources = (uint64_t*)malloc((numEdges > 0 ? numEdges : 1) * sizeof(uint64_t));
+    uint64_t* targets = (uint64_t*)malloc((numEdges > 0 ? numEdges : 1) * sizeof(uint64_t));
+    uint64_t state = seed;
+
+    for (uint64_t e = 0; sources && targets && e < numEdges; e++) {
+        sources[e] = nextRandom(&state) % numNodes;
+        targets[e] = nextRandom(&state) % numNodes;
+    }
+
+    return fromArcs(numNodes, numEdges, sources, targets);
+}
+
+/* Generate a grid */
+Graph* graph_grid(uint64_t rows, uint64_t cols)
+{
+    uint64_t numNodes = rows * cols;
+    uint64_t numEdges = 2 * (rows * (cols > 0 ? cols - 1 : 0) + cols * (rows > 0 ? rows - 1 : 0));
+    Graph* graph = graph_init(numNodes, numEdges);
+    uint64_t e = 0;
+
+    if (!graph) return NULL;
+
+    for (uint64_t r = 0; r < rows; r++) {
+        for (uint64_t c = 0; c < cols; c++) {
+            uint64_t v = r * cols + c;
+
+            graph->offsets[v] = e;
+
+            if (r > 0) graph->targets[e++] = v - cols;
+            if (c > 0) graph->targets[e++] = v - 1;
+            if (c + 1 < cols) graph->targets[e++] = v + 1;
+            if (r + 1 < rows) graph->targets[e++] = v + cols;
+        }
+    }
+
+    graph->offsets[numNodes] = e;
+
+    return graph;
+}
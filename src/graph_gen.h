@@ -0,0 +1,17 @@
+#ifndef GRAPH_GEN_H
+#define GRAPH_GEN_H
+
+#include "graph.h"
+
+/* Generates an R-MAT graph on 2^scale nodes with numEdges arcs, using the
+ * Graph500 quadrant probabilities (0.57, 0.19, 0.19, 0.05) */
+Graph* graph_rmat(unsigned scale, uint64_t numEdges, uint64_t seed);
+
+/* Generates an Erdos-Renyi G(n, m) graph with numEdges uniformly random
+ * arcs. Returns NULL if there are arcs but no nodes, or memory runs out. */
+Graph* graph_erdos_renyi(uint64_t numNodes, uint64_t numEdges, uint64_t seed);
+
+/* Generates a rows x cols grid with arcs both ways between 4-neighbors */
+Graph* graph_grid(uint64_t rows, uint64_t cols);
+
+#endif /* GRAPH_GEN_H */
@@ -0,0 +1,526 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "graph_io.h"
+#include "scheduler.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define LOAD_CHUNKS_PER_THREAD 8
+
+/* Largest node count whose row offsets can be allocated */
+#define LOAD_MAX_NODES ((uint64_t)(SIZE_MAX / sizeof(uint64_t)) - 1)
+
+/* Byte range of whole lines of the input, parsed by one task */
+typedef struct ParseChunk {
+    const char* begin;            /* Start of the first line */
+    const char* end;              /* One past the last line's newline (or EOF) */
+    uint64_t lines;               /* Number of node lines (METIS) */
+    uint64_t arcs;                /* Number of arcs */
+    uint64_t numNodes;            /* Largest node id + 1 (edge lists) */
+    uint64_t firstLine;           /* Node of the first line, set between passes */
+    uint64_t firstArc;            /* Arc index of the first arc, set between passes */
+} ParseChunk;
+
+/* State shared by the parsing tasks */
+typedef struct LoadJob {
+    ParseChunk* chunks;           /* Chunks of the input */
+    uint64_t numNodes;            /* Node count from the METIS header */
+    uint64_t* sources;            /* Arc sources (edge lists) */
+    uint64_t* targets;            /* Arc targets */
+    uint64_t* offsets;            /* Row offsets (METIS) */
+    _Atomic bool failed;          /* Set by any task that finds bad input */
+} LoadJob;
+
+/* Maps a file read-only, or returns NULL */
+static const char* mapInput(const char* path, uint64_t* size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    LARGE_INTEGER length;
+
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+
+    if (!GetFileSizeEx(file, &length)) {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    *size = (uint64_t)length.QuadPart;
+
+    if (*size == 0) {
+        CloseHandle(file);
+        return "";
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+
+    return (const char*)view;
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    *size = (uint64_t)info.st_size;
+
+    if (*size == 0) {
+        close(fd);
+        return "";
+    }
+
+    void* view = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (view == MAP_FAILED) return NULL;
+
+    /* Each chunk is read once, front to back */
+    posix_madvise(view, *size, POSIX_MADV_SEQUENTIAL);
+
+    return (const char*)view;
+#endif
+}
+
+/* Unmaps a file mapped by mapInput */
+static void unmapInput(const char* data, uint64_t size)
+{
+    if (size == 0) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/* Gets the end of the line starting at pos */
+static inline const char* lineEnd(const char* pos, const char* end)
+{
+    const char* eol = (const char*)memchr(pos, '\n', (size_t)(end - pos));
+
+    return eol ? eol : end;
+}
+
+/* Skips blanks and parses the next unsigned number of a line. Returns
+ * false at the end of the line; sets *bad if the next token is not a number
+ * or does not fit in 64 bits. */
+static inline bool nextNumber(const char** pos, const char* eol, uint64_t* value, bool* bad)
+{
+    const char* p = *pos;
+    uint64_t v = 0;
+
+    while (p < eol && isBlank(*p)) {
+        p++;
+    }
+
+    if (p == eol) {
+        *pos = p;
+        return false;
+    }
+
+    if (!isDigit(*p)) {
+        *bad = true;
+        return false;
+    }
+
+    while (p < eol && isDigit(*p)) {
+        uint64_t digit = (uint64_t)(*p - '0');
+
+        if (v > (UINT64_MAX - digit) / 10) {
+            *bad = true;
+            return false;
+        }
+
+        v = v * 10 + digit;
+        p++;
+    }
+
+    if (p < eol && !isBlank(*p)) {
+        *bad = true;
+        return false;
+    }
+
+    *pos = p;
+    *value = v;
+
+    return true;
+}
+
+/* Splits bytes [begin, size) into at most maxChunks chunks of whole lines */
+static uint64_t splitLines(const char* data, uint64_t begin, uint64_t size, uint64_t maxChunks, ParseChunk* chunks)
+{
+    uint64_t numChunks = 0;
+    uint64_t pos = begin;
+
+    for (uint64_t c = 1; c <= maxChunks && pos < size; c++) {
+        uint64_t cut = begin + (size - begin) * c / maxChunks;
+        uint64_t stop = size;
+
+        if (cut < pos) {
+            cut = pos;
+        }
+
+        if (c < maxChunks) {
+            stop = (uint64_t)(lineEnd(data + cut, data + size) - data);
+            stop = stop < size ? stop + 1 : size;
+        }
+
+        memset(&chunks[numChunks], 0, sizeof(ParseChunk));
+        chunks[numChunks].begin = data + pos;
+        chunks[numChunks].end = data + stop;
+        numChunks++;
+        pos = stop;
+    }
+
+    return numChunks;
+}
+
+/* Counts the node lines and arcs of METIS chunks [begin, end) */
+static void countMetisTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    LoadJob* job = (LoadJob*)arg;
+    bool bad = false;
+
+    for (uint64_t c = begin; c < end; c++) {
+        ParseChunk* chunk = &job->chunks[c];
+
+        for (const char* pos = chunk->begin; pos < chunk->end; ) {
+            const char* eol = lineEnd(pos, chunk->end);
+            uint64_t value;
+
+            if (*pos != '%') {
+                chunk->lines++;
+
+                while (nextNumber(&pos, eol, &value, &bad)) {
+                    chunk->arcs++;
+                }
+            }
+
+            pos = eol + 1;
+        }
+    }
+
+    if (bad) {
+        atomic_store(&job->failed, true);
+    }
+}
+
+/* Fills the offsets and targets of METIS chunks [begin, end) */
+static void fillMetisTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    LoadJob* job = (LoadJob*)arg;
+    uint64_t n = job->numNodes;
+    bool bad = false;
+
+    for (uint64_t c = begin; c < end && !bad; c++) {
+        ParseChunk* chunk = &job->chunks[c];
+        uint64_t node = chunk->firstLine;
+        uint64_t arc = chunk->firstArc;
+
+        for (const char* pos = chunk->begin; pos < chunk->end && !bad; ) {
+            const char* eol = lineEnd(pos, chunk->end);
+            uint64_t value;
+
+            if (*pos != '%') {
+                if (node < n) {
+                    job->offsets[node] = arc;
+                }
+
+                while (nextNumber(&pos, eol, &value, &bad)) {
+                    /* Ids are 1-based, and lines past the last node must be empty */
+                    if (value == 0 || value > n || node >= n) {
+                        bad = true;
+                        break;
+                    }
+
+                    job->targets[arc++] = value - 1;
+                }
+
+                node++;
+            }
+
+            pos = eol + 1;
+        }
+    }
+
+    if (bad) {
+        atomic_store(&job->failed, true);
+    }
+}
+
+/* Counts the arcs and the largest node id of edge list chunks [begin, end) */
+static void countEdgesTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    LoadJob* job = (LoadJob*)arg;
+    bool bad = false;
+
+    for (uint64_t c = begin; c < end; c++) {
+        ParseChunk* chunk = &job->chunks[c];
+
+        for (const char* pos = chunk->begin; pos < chunk->end; ) {
+            const char* eol = lineEnd(pos, chunk->end);
+            uint64_t source, target;
+
+            while (pos < eol && isBlank(*pos)) {
+                pos++;
+            }
+
+            if (pos < eol && *pos != '#' && *pos != '%') {
+                if (nextNumber(&pos, eol, &source, &bad) && nextNumber(&pos, eol, &target, &bad)) {
+                    uint64_t top = source > target ? source : target;
+
+                    if (top >= LOAD_MAX_NODES) {
+                        bad = true;
+                    } else if (top + 1 > chunk->numNodes) {
+                        chunk->numNodes = top + 1;
+                    }
+
+                    chunk->arcs++;
+                } else {
+                    bad = true;
+                }
+            }
+
+            pos = eol + 1;
+        }
+    }
+
+    if (bad) {
+        atomic_store(&job->failed, true);
+    }
+}
+
+/* Fills the arc sources and targets of edge list chunks [begin, end) */
+static void fillEdgesTask(uint64_t begin, uint64_t end, unsigned thread, void* arg)
+{
+    LoadJob* job = (LoadJob*)arg;
+    bool bad = false;
+
+    for (uint64_t c = begin; c < end; c++) {
+        ParseChunk* chunk = &job->chunks[c];
+        uint64_t arc = chunk->firstArc;
+
+        for (const char* pos = chunk->begin; pos < chunk->end; ) {
+            const char* eol = lineEnd(pos, chunk->end);
+
+            while (pos < eol && isBlank(*pos)) {
+                pos++;
+            }
+
+            if (pos < eol && *pos != '#' && *pos != '%') {
+                nextNumber(&pos, eol, &job->sources[arc], &bad);
+                nextNumber(&pos, eol, &job->targets[arc], &bad);
+                arc++;
+            }
+
+            pos = eol + 1;
+        }
+    }
+}
+
+/* Runs the two passes of a parse over the chunks and turns the per-chunk
+ * counts into starting lines and arcs. Returns false if parsing failed. */
+static bool parseChunks(Scheduler* sched, LoadJob* job, uint64_t numChunks, sched_task_fn count,
+                        sched_task_fn fill, uint64_t* numLines, uint64_t* numArcs, bool (*allocate)(LoadJob*, uint64_t))
+{
+    uint64_t* bounds = (uint64_t*)malloc((numChunks + 1) * sizeof(uint64_t));
+    uint64_t lines = 0;
+    uint64_t arcs = 0;
+
+    if (!bounds) return false;
+
+    /* One chunk per scheduler slot */
+    for (uint64_t c = 0; c <= numChunks; c++) {
+        bounds[c] = c;
+    }
+
+    sched_run(sched, bounds, numChunks, count, job);
+
+    for (uint64_t c = 0; c < numChunks; c++) {
+        job->chunks[c].firstLine = lines;
+        job->chunks[c].firstArc = arcs;
+        lines += job->chunks[c].lines;
+        arcs += job->chunks[c].arcs;
+    }
+
+    *numLines = lines;
+    *numArcs = arcs;
+
+    if (atomic_load(&job->failed) || !allocate(job, arcs)) {
+        free(bounds);
+        return false;
+    }
+
+    sched_run(sched, bounds, numChunks, fill, job);
+    free(bounds);
+
+    return !atomic_load(&job->failed);
+}
+
+/* Allocates the METIS graph arrays */
+static bool allocateMetis(LoadJob* job, uint64_t arcs)
+{
+    job->offsets = (uint64_t*)malloc((job->numNodes + 1) * sizeof(uint64_t));
+    job->targets = (uint64_t*)malloc((arcs > 0 ? arcs : 1) * sizeof(uint64_t));
+
+    return job->offsets && job->targets;
+}
+
+/* Allocates the edge list arc arrays */
+static bool allocateEdges(LoadJob* job, uint64_t arcs)
+{
+    job->sources = (uint64_t*)malloc((arcs > 0 ? arcs : 1) * sizeof(uint64_t));
+    job->targets = (uint64_t*)malloc((arcs > 0 ? arcs : 1) * sizeof(uint64_t));
+
+    return job->sources && job->targets;
+}
+
+/* Parses the METIS header: comment lines, then "n m [fmt [ncon]]".
+ * Returns the offset of the first node line, or 0 on failure. */
+static uint64_t parseMetisHeader(const char* data, uint64_t size, uint64_t* numNodes)
+{
+    const char* end = data + size;
+
+    for (const char* pos = data; pos < end; ) {
+        const char* eol = lineEnd(pos, end);
+        uint64_t edges, format = 0;
+        bool bad = false;
+
+        if (*pos != '%') {
+            if (!nextNumber(&pos, eol, numNodes, &bad) || !nextNumber(&pos, eol, &edges, &bad) ||
+                *numNodes > LOAD_MAX_NODES) {
+                return 0;
+            }
+
+            /* Weighted graphs put weights between the successors */
+            if ((nextNumber(&pos, eol, &format, &bad) && format != 0) || bad) {
+                return 0;
+            }
+
+            return eol < end ? (uint64_t)(eol + 1 - data) : size;
+        }
+
+        pos = eol + 1;
+    }
+
+    return 0;
+}
+
+/* Load a METIS adjacency file */
+Graph* graph_load_metis(const char* path, unsigned threads)
+{
+    uint64_t size;
+    const char* data = mapInput(path, &size);
+    LoadJob job = {NULL, 0, NULL, NULL, NULL, false};
+    Scheduler* sched = NULL;
+    Graph* graph = NULL;
+    uint64_t lines, arcs;
+
+    if (!data) return NULL;
+
+    uint64_t begin = parseMetisHeader(data, size, &job.numNodes);
+
+    if (begin == 0) {
+        unmapInput(data, size);
+        return NULL;
+    }
+
+    sched = sched_init(threads);
+    uint64_t maxChunks = sched ? (uint64_t)sched_threads(sched) * LOAD_CHUNKS_PER_THREAD : 0;
+    job.chunks = (ParseChunk*)malloc((maxChunks > 0 ? maxChunks : 1) * sizeof(ParseChunk));
+
+    if (sched && job.chunks) {
+        uint64_t numChunks = splitLines(data, begin, size, maxChunks, job.chunks);
+
+        if (parseChunks(sched, &job, numChunks, countMetisTask, fillMetisTask, &lines, &arcs, allocateMetis)) {
+            /* Nodes missing at the end of the file have no successors */
+            for (uint64_t node = lines < job.numNodes ? lines : job.numNodes; node <= job.numNodes; node++) {
+                job.offsets[node] = arcs;
+            }
+
+            graph = graph_wrap(job.numNodes, job.offsets, job.targets);
+        }
+    }
+
+    if (graph) {
+        graph->ownsData = true;
+    } else {
+        free(job.offsets);
+        free(job.targets);
+    }
+
+    free(job.chunks);
+    sched_free(sched);
+    unmapInput(data, size);
+
+    return graph;
+}
+
+/* Load an edge list */
+Graph* graph_load_edge_list(const char* path, unsigned threads)
+{
+    uint64_t size;
+    const char* data = mapInput(path, &size);
+    LoadJob job = {NULL, 0, NULL, NULL, NULL, false};
+    Scheduler* sched = NULL;
+    Graph* graph = NULL;
+    uint64_t lines, arcs;
+
+    if (!data) return NULL;
+
+    sched = sched_init(threads);
+    uint64_t maxChunks = sched ? (uint64_t)sched_threads(sched) * LOAD_CHUNKS_PER_THREAD : 0;
+    job.chunks = (ParseChunk*)malloc((maxChunks > 0 ? maxChunks : 1) * sizeof(ParseChunk));
+
+    if (sched && job.chunks) {
+        uint64_t numChunks = splitLines(data, 0, size, maxChunks, job.chunks);
+
+        if (parseChunks(sched, &job, numChunks, countEdgesTask, fillEdgesTask, &lines, &arcs, allocateEdges)) {
+            uint64_t numNodes = 0;
+
+            for (uint64_t c = 0; c < numChunks; c++) {
+                if (job.chunks[c].numNodes > numNodes) {
+                    numNodes = job.chunks[c].numNodes;
+                }
+            }
+
+            graph = graph_from_edges(numNodes, arcs, job.sources, job.targets);
+        }
+    }
+
+    free(job.sources);
+    free(job.targets);
+    free(job.chunks);
+    sched_free(sched);
+    unmapInput(data, size);
+
+    return graph;
+}
@@ -0,0 +1,20 @@
+#ifndef GRAPH_IO_H
+#define GRAPH_IO_H
+
+#include "graph.h"
+
+/* Loads a METIS adjacency file: a header line "n m" followed by one line
+ * per node listing its 1-based successors. Lines starting with % are
+ * comments. The file is memory-mapped and parsed by threads workers (0 =
+ * one per CPU). Returns NULL if the file cannot be read, is malformed or
+ * has vertex or edge weights. */
+Graph* graph_load_metis(const char* path, unsigned threads);
+
+/* Loads a whitespace-separated edge list, one "source target" pair of
+ * 0-based node ids per line; further columns are ignored and lines
+ * starting with # or % are comments. The graph has (largest id + 1) nodes
+ * and keeps the successors of each node in file order. Returns NULL if the
+ * file cannot be read, is malformed or has an id too large to index. */
+Graph* graph_load_edge_list(const char* path, unsigned threads);
+
+#endif /* GRAPH_IO_H */
@@ -0,0 +1,422 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "graph_order.h"
+
+/* Label propagation sweeps of the community order */
+#define ORDER_LABEL_ROUNDS 5
+
+/* Largest community of the community order; left unbounded, label
+ * propagation merges most small-world graphs into one community */
+#define ORDER_COMMUNITY_SIZE 1024
+
+/* Node and the key it is sorted by */
+typedef struct KeyedNode {
+    uint64_t key;                 /* Sort key, e.g. the degree */
+    uint64_t node;                /* Node id, which breaks ties */
+} KeyedNode;
+
+/* Orders keyed nodes by key, then id */
+static int compareKeyed(const void* a, const void* b)
+{
+    const KeyedNode* x = (const KeyedNode*)a;
+    const KeyedNode* y = (const KeyedNode*)b;
+
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+
+    return (x->node > y->node) - (x->node < y->node);
+}
+
+/* Orders node ids */
+static int compareIds(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Parse an order name */
+bool graph_order_parse(const char* name, GraphOrder* order)
+{
+    static const char* names[] = {"none", "bfs", "degree", "community"};
+
+    for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *order = (GraphOrder)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Gets the total (in plus out) degree of every node and the largest one */
+static uint64_t* totalDegrees(const Graph* graph, const Graph* transpose, uint64_t* maxDegree)
+{
+    uint64_t* degrees = (uint64_t*)malloc((graph->numNodes ? graph->numNodes : 1) * sizeof(uint64_t));
+
+    if (!degrees) return NULL;
+
+    *maxDegree = 0;
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        degrees[v] = graph_degree(graph, v) + graph_degree(transpose, v);
+
+        if (degrees[v] > *maxDegree) *maxDegree = degrees[v];
+    }
+
+    return degrees;
+}
+
+/* Lists the nodes by increasing (or decreasing) degree, ties by id, with a
+ * counting sort */
+static uint64_t* sortByDegree(const uint64_t* degrees, uint64_t numNodes, uint64_t maxDegree, bool descending)
+{
+    uint64_t* counts = (uint64_t*)calloc(maxDegree + 2, sizeof(uint64_t));
+    uint64_t* nodes = (uint64_t*)malloc((numNodes ? numNodes : 1) * sizeof(uint64_t));
+
+    if (!counts || !nodes) {
+        free(counts);
+        free(nodes);
+        return NULL;
+    }
+
+    for (uint64_t v = 0; v < numNodes; v++) {
+        counts[(descending ? maxDegree - degrees[v] : degrees[v]) + 1]++;
+    }
+
+    for (uint64_t d = 0; d <= maxDegree; d++) {
+        counts[d + 1] += counts[d];
+    }
+
+    for (uint64_t v = 0; v < numNodes; v++) {
+        nodes[counts[descending ? maxDegree - degrees[v] : degrees[v]]++] = v;
+    }
+
+    free(counts);
+
+    return nodes;
+}
+
+/* Cuthill-McKee: lists the nodes breadth first, starting each component at
+ * its lowest-degree node and queueing the new neighbors of each node by
+ * increasing degree */
+static bool cuthillMcKee(const Graph* graph, const Graph* transpose, const uint64_t* degrees, uint64_t maxDegree,
+                         uint64_t* order)
+{
+    const Graph* sides[2] = {graph, transpose};
+    uint64_t N = graph->numNodes;
+    uint64_t* starts = sortByDegree(degrees, N, maxDegree, false);
+    bool* placed = (bool*)calloc(N ? N : 1, sizeof(bool));
+    KeyedNode* scratch = (KeyedNode*)malloc((maxDegree ? maxDegree : 1) * sizeof(KeyedNode));
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    bool ok = starts && placed && scratch;
+
+    for (uint64_t i = 0; ok && i < N; i++) {
+        if (placed[starts[i]]) continue;
+
+        placed[starts[i]] = true;
+        order[tail++] = starts[i];
+
+        while (head < tail) {
+            uint64_t v = order[head++];
+            uint64_t count = 0;
+
+            for (int s = 0; s < 2; s++) {
+                const uint64_t* neighbors = graph_successors(sides[s], v);
+
+                for (uint64_t k = 0; k < graph_degree(sides[s], v); k++) {
+                    uint64_t w = neighbors[k];
+
+                    if (!placed[w]) {
+                        placed[w] = true;
+                        scratch[count].key = degrees[w];
+                        scratch[count].node = w;
+                        count++;
+                    }
+                }
+            }
+
+            qsort(scratch, count, sizeof(KeyedNode), compareKeyed);
+
+            for (uint64_t k = 0; k < count; k++) {
+                order[tail++] = scratch[k].node;
+            }
+        }
+    }
+
+    free(starts);
+    free(placed);
+    free(scratch);
+
+    return ok;
+}
+
+/* Label propagation: each node in turn takes the label most common among
+ * its neighbors, keeping its own on ties and else the smallest, unless that
+ * community is full. Nodes are visited in BFS order, which settles the
+ * labels in a few sweeps. */
+static bool propagateLabels(const Graph* graph, const Graph* transpose, const uint64_t* bfs, uint64_t maxDegree,
+                            uint64_t* labels)
+{
+    const Graph* sides[2] = {graph, transpose};
+    uint64_t* scratch = (uint64_t*)malloc((maxDegree ? maxDegree : 1) * sizeof(uint64_t));
+    uint64_t* sizes = (uint64_t*)malloc((graph->numNodes ? graph->numNodes : 1) * sizeof(uint64_t));
+
+    if (!scratch || !sizes) {
+        free(scratch);
+        free(sizes);
+        return false;
+    }
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        labels[v] = v;
+        sizes[v] = 1;
+    }
+
+    for (unsigned round = 0; round < ORDER_LABEL_ROUNDS; round++) {
+        uint64_t changed = 0;
+
+        for (uint64_t i = 0; i < graph->numNodes; i++) {
+            uint64_t v = bfs[i];
+            uint64_t count = 0;
+
+            for (int s = 0; s < 2; s++) {
+                const uint64_t* neighbors = graph_successors(sides[s], v);
+
+                for (uint64_t k = 0; k < graph_degree(sides[s], v); k++) {
+                    scratch[count++] = labels[neighbors[k]];
+                }
+            }
+
+            qsort(scratch, count, sizeof(uint64_t), compareIds);
+
+            uint64_t best = labels[v];
+            uint64_t bestRun = 0;
+
+            for (uint64_t k = 0; k < count; k++) {
+                if (scratch[k] == labels[v]) bestRun++;
+            }
+
+            for (uint64_t k = 0; k < count;) {
+                uint64_t run = 1;
+
+                while (k + run < count && scratch[k + run] == scratch[k]) {
+                    run++;
+                }
+
+                if (run > bestRun && sizes[scratch[k]] < ORDER_COMMUNITY_SIZE) {
+                    best = scratch[k];
+                    bestRun = run;
+                }
+
+                k += run;
+            }
+
+            if (best != labels[v]) {
+                sizes[labels[v]]--;
+                sizes[best]++;
+                labels[v] = best;
+                changed++;
+            }
+        }
+
+        if (changed == 0) break;
+    }
+
+    free(scratch);
+    free(sizes);
+
+    return true;
+}
+
+/* Regroups a BFS order by community: communities in the order of their
+ * first node, each keeping the BFS order of its nodes */
+static bool communityOrder(const Graph* graph, const Graph* transpose, uint64_t maxDegree, uint64_t* order)
+{
+    uint64_t N = graph->numNodes;
+    uint64_t* labels = (uint64_t*)malloc((N ? N : 1) * sizeof(uint64_t));
+    uint64_t* first = (uint64_t*)malloc((N ? N : 1) * sizeof(uint64_t));
+    uint64_t* counts = (uint64_t*)calloc(N + 1, sizeof(uint64_t));
+    uint64_t* bfs = (uint64_t*)malloc((N ? N : 1) * sizeof(uint64_t));
+    bool ok = labels && first && counts && bfs && propagateLabels(graph, transpose, order, maxDegree, labels);
+
+    if (ok) {
+        memcpy(bfs, order, N * sizeof(uint64_t));
+
+        for (uint64_t v = 0; v < N; v++) {
+            first[v] = UINT64_MAX;
+        }
+
+        /* Rank each community by the BFS position of its first node */
+        for (uint64_t i = 0; i < N; i++) {
+            uint64_t label = labels[bfs[i]];
+
+            if (first[label] == UINT64_MAX) first[label] = i;
+
+            counts[first[label] + 1]++;
+        }
+
+        for (uint64_t i = 0; i < N; i++) {
+            counts[i + 1] += counts[i];
+        }
+
+        for (uint64_t i = 0; i < N; i++) {
+            order[counts[first[labels[bfs[i]]]]++] = bfs[i];
+        }
+    }
+
+    free(labels);
+    free(first);
+    free(counts);
+    free(bfs);
+
+    return ok;
+}
+
+/* Compute a node order */
+uint64_t* graph_order(const Graph* graph, GraphOrder order)
+{
+    uint64_t N = graph->numNodes;
+    uint64_t* perm = (uint64_t*)malloc((N ? N : 1) * sizeof(uint64_t));
+    uint64_t* sequence = NULL;
+    uint64_t* degrees = NULL;
+    Graph* transpose = NULL;
+    uint64_t maxDegree = 0;
+    bool ok = false;
+
+    if (!perm) return NULL;
+
+    if (order == GRAPH_ORDER_NONE) {
+        for (uint64_t v = 0; v < N; v++) {
+            perm[v] = v;
+        }
+
+        return perm;
+    }
+
+    transpose = graph_transpose(graph);
+    degrees = transpose ? totalDegrees(graph, transpose, &maxDegree) : NULL;
+
+    if (degrees) {
+        if (order == GRAPH_ORDER_DEGREE) {
+            sequence = sortByDegree(degrees, N, maxDegree, true);
+            ok = sequence != NULL;
+        } else {
+            sequence = (uint64_t*)malloc((N ? N : 1) * sizeof(uint64_t));
+            ok = sequence && cuthillMcKee(graph, transpose, degrees, maxDegree, sequence) &&
+                 (order != GRAPH_ORDER_COMMUNITY || communityOrder(graph, transpose, maxDegree, sequence));
+        }
+    }
+
+    if (ok) {
+        for (uint64_t i = 0; i < N; i++) {
+            perm[sequence[i]] = i;
+        }
+    }
+
+    graph_free(transpose);
+    free(degrees);
+    free(sequence);
+
+    if (!ok) {
+        free(perm);
+        return NULL;
+    }
+
+    return perm;
+}
+
+/* Invert a permutation */
+uint64_t* graph_order_invert(const uint64_t* perm, uint64_t numNodes)
+{
+    uint64_t* inverse = (uint64_t*)malloc((numNodes ? numNodes : 1) * sizeof(uint64_t));
+
+    if (!inverse) return NULL;
+
+    for (uint64_t v = 0; v < numNodes; v++) {
+        inverse[perm[v]] = v;
+    }
+
+    return inverse;
+}
+
+/* Relabel the nodes of a graph */
+Graph* graph_permute(const Graph* graph, const uint64_t* perm)
+{
+    Graph* permuted = graph_init(graph->numNodes, graph->numEdges);
+
+    if (!permuted) return NULL;
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        permuted->offsets[perm[v] + 1] = graph_degree(graph, v);
+    }
+
+    for (uint64_t i = 0; i < graph->numNodes; i++) {
+        permuted->offsets[i + 1] += permuted->offsets[i];
+    }
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        const uint64_t* successors = graph_successors(graph, v);
+        uint64_t* targets = permuted->targets + permuted->offsets[perm[v]];
+        uint64_t degree = graph_degree(graph, v);
+
+        for (uint64_t k = 0; k < degree; k++) {
+            targets[k] = perm[successors[k]];
+        }
+
+        qsort(targets, degree, sizeof(uint64_t), compareIds);
+    }
+
+    return permuted;
+}
+
+/* Measure the locality of a graph */
+bool graph_locality(const Graph* graph, GraphLocality* locality)
+{
+    uint64_t maxDegree = 0;
+    double gapBits = 0.0;
+    double distance = 0.0;
+    uint64_t bandwidth = 0;
+    uint64_t near = 0;
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        if (graph_degree(graph, v) > maxDegree) maxDegree = graph_degree(graph, v);
+    }
+
+    uint64_t* sorted = (uint64_t*)malloc((maxDegree ? maxDegree : 1) * sizeof(uint64_t));
+
+    if (!sorted) return false;
+
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        uint64_t degree = graph_degree(graph, v);
+
+        memcpy(sorted, graph_successors(graph, v), degree * sizeof(uint64_t));
+        qsort(sorted, degree, sizeof(uint64_t), compareIds);
+
+        for (uint64_t k = 0; k < degree; k++) {
+            uint64_t w = sorted[k];
+            uint64_t d = w > v ? w - v : v - w;
+            uint64_t gap = k == 0 ? d : w - sorted[k - 1];
+
+            gapBits += log2((double)gap + 1.0);
+            distance += (double)d;
+            near += d <= GRAPH_NEAR_WINDOW;
+
+            if (d > bandwidth) bandwidth = d;
+        }
+    }
+
+    free(sorted);
+
+    double arcs = graph->numEdges ? (double)graph->numEdges : 1.0;
+
+    locality->gapBits = gapBits / arcs;
+    locality->distance = distance / arcs;
+    locality->bandwidth = bandwidth;
+    locality->nearFraction = (double)near / arcs;
+
+    return true;
+}
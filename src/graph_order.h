@@ -0,0 +1,47 @@
+#ifndef GRAPH_ORDER_H
+#define GRAPH_ORDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "graph.h"
+
+/* Node orders that give nodes merged into the same counters nearby ids, so
+ * HyperANF rounds read successor counters from fewer pages and cache lines.
+ * Arcs are followed both ways. */
+typedef enum GraphOrder {
+    GRAPH_ORDER_NONE,             /* Keep the ids */
+    GRAPH_ORDER_BFS,              /* Cuthill-McKee: breadth first, neighbors by increasing degree */
+    GRAPH_ORDER_DEGREE,           /* By decreasing degree, so hub counters share pages */
+    GRAPH_ORDER_COMMUNITY         /* Label propagation communities of up to 1024 nodes, each in BFS order */
+} GraphOrder;
+
+/* Parses "none", "bfs", "degree" or "community". Returns false if the name is unknown. */
+bool graph_order_parse(const char* name, GraphOrder* order);
+
+/* Computes a node order. Returns a malloc'd permutation holding the new id
+ * of each node, or NULL if memory runs out. */
+uint64_t* graph_order(const Graph* graph, GraphOrder order);
+
+/* Inverts a permutation into a malloc'd array holding the old id of each
+ * new id, or returns NULL if memory runs out */
+uint64_t* graph_order_invert(const uint64_t* perm, uint64_t numNodes);
+
+/* Builds the graph with node v renamed perm[v] and every successor list
+ * sorted, or returns NULL if memory runs out */
+Graph* graph_permute(const Graph* graph, const uint64_t* perm);
+
+/* Arcs at most this many ids apart count as near */
+#define GRAPH_NEAR_WINDOW 64
+
+/* How close the ids of adjacent nodes are */
+typedef struct GraphLocality {
+    double gapBits;               /* Mean log2(gap + 1) of sorted successor lists, the first gap from the node */
+    double distance;              /* Mean |u - v| over arcs u -> v */
+    uint64_t bandwidth;           /* Largest |u - v| */
+    double nearFraction;          /* Fraction of arcs with |u - v| <= GRAPH_NEAR_WINDOW */
+} GraphLocality;
+
+/* Measures the locality of a graph. Returns false if memory runs out. */
+bool graph_locality(const Graph* graph, GraphLocality* locality);
+
+#endif /* GRAPH_ORDER_H */
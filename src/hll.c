@@ -1,191 +1,300 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
 #include "hll.h"
+#include "hll_kernels.h"
+#include "varint.h"
 #include "../lib/murmur2.h"
 
-/* Node structure for sparse representation */
-typedef struct Node {
-    struct Node* next;
-    uint64_t index;
-    uint8_t fsb;
-} Node;
+/* Sparse registers are packed as (index << 6) | fsb in 32 bits, so sorting
+ * the packed values orders them by index and then by fsb */
+#define SPARSE_ENTRY(index, fsb) ((uint32_t)(((index) << 6) | (fsb)))
+#define SPARSE_INDEX(entry) ((entry) >> 6)
+#define SPARSE_FSB(entry) ((uint8_t)((entry) & 63))
+
+/* Largest p whose register indexes fit in a packed sparse entry */
+#define SPARSE_MAX_P 26
+
+/* Initial number of entries allocated for the sparse list and buffer */
+#define SPARSE_INITIAL_CAPACITY 16
+
+/* Number of keys hashed per block by the batch add functions */
+#define ADD_BLOCK_SIZE 256
+
+/* Serialized counter layout: magic, version, encoding, p and register
+ * width in bits, then the seed, the number of registers in the payload and
+ * the payload size, all little-endian, then the payload. Dense payloads
+ * pack every register at the given width, low bits first; sparse payloads
+ * hold the sorted packed entries as varint gaps from the previous one. */
+#define SERIAL_MAGIC "HLLC"
+#define SERIAL_VERSION 1
+#define SERIAL_HEADER_SIZE 32
+#define SERIAL_DENSE 0
+#define SERIAL_SPARSE 1
+
+/* Longest varint of a 32-bit value */
+#define SERIAL_MAX_VARINT 5
 
 /* HyperLogLog structure definition */
 struct HyperLogLog {
     uint8_t* registers;           /* Densely encoded registers */
     unsigned short p;             /* 2^p = number of registers */
     uint64_t* histogram;          /* Register histogram */
+    uint64_t rankSum;             /* Sum of 2^(q - r) over registers of rank 1 <= r <= q = 64 - p */
+    double zeroTerm;              /* m * sigma(zeros / m) for zeroTermCount zero registers */
+    double topTerm;               /* m * tau(...) for topTermCount registers of rank p + 1 */
+    uint64_t zeroTermCount;       /* Zero count zeroTerm was computed for */
+    uint64_t topTermCount;        /* Top-rank count topTerm was computed for */
     uint64_t seed;                /* MurmurHash64A seed */
     uint64_t size;                /* Number of registers */
     uint64_t cache;               /* Cached cardinality estimate */
     uint64_t added;               /* Number of elements added */
     bool isCached;                /* If the cache is up to date */
     bool isSparse;                /* If sparse encoding is currently in use */
+    bool isConcurrent;            /* If registers are bytes raised with atomic max */
+    bool isRunning;               /* If hll_cardinality reads rankSum instead of walking the histogram */
 
     /* Fields used for sparse representation */
-    Node* sparseRegisterList;     /* Linked list of registers */
-    Node* sparseRegisterBuffer;   /* Temporary buffer of nodes to be added */
-    Node* nodeCache;              /* The last sparse register accessed using get() */
+    uint32_t* sparseList;         /* Sorted packed entries, one per nonzero register */
+    uint32_t* sparseBuffer;       /* Unsorted packed entries to be merged into the list */
+    uint64_t listCapacity;        /* Number of entries allocated for the list */
+    uint64_t bufferCapacity;      /* Number of entries allocated for the buffer */
     uint64_t bufferSize;          /* Number of elements in the temporary buffer */
-    uint64_t listSize;            /* Number of elements in the linked list */
+    uint64_t listSize;            /* Number of elements in the sorted list */
     uint64_t maxBufferSize;       /* Max number of elements for the temporary buffer */
-    uint64_t maxListSize;         /* Max number of nodes in the sparse list */
+    uint64_t maxListSize;         /* Max number of entries in the sparse list */
 };
 
+/* Dense registers are a big-endian bit stream: register m takes bits
+ * 6m ... 6m + 5, counting from the high bit of byte 0. A register starting
+ * in the top three bits of a byte lies within it; the others straddle it
+ * and the next byte, which the allocation always has room for. */
+
 /* Get register m in dense representation */
 static inline uint64_t getDenseRegister(uint64_t m, uint8_t* regs)
 {
-    uint64_t nBits = 6*m + 6;
-    uint64_t bytePos = nBits/8 - 1;
-    uint8_t leftByte = regs[bytePos];
-    uint8_t rightByte = regs[bytePos + 1];
-    uint8_t nrb = (uint8_t) (nBits % 8);
-    uint8_t reg;
+    uint64_t bit = 6*m;
+    uint64_t bytePos = bit/8;
+    uint8_t shift = (uint8_t)(bit % 8);
 
-    leftByte <<= nrb; /* Move left bits into high order spots */
-    rightByte >>= (8 - nrb); /* Move rights bits into the low order spots */
-    reg = leftByte | rightByte; /* OR the result to get the register */
-    reg &= 63; /* Get rid of the 2 extra bits */
+    if (shift <= 2) {
+        return (uint64_t)((regs[bytePos] >> (2 - shift)) & 63);
+    }
 
-    return (uint64_t) reg;
+    /* High bits from the end of this byte, low bits from the next */
+    return (uint64_t)(((regs[bytePos] << (shift - 2)) | (regs[bytePos + 1] >> (10 - shift))) & 63);
 }
 
 /* Set register m to n in dense representation */
 static inline void setDenseRegister(uint64_t m, uint8_t n, uint8_t* regs)
 {
-    uint64_t nBits = 6*m + 6;
-    uint64_t bytePos = nBits/8 - 1;
-    uint8_t nrb = (uint8_t) (nBits % 8);
-    uint8_t nlb = 6 - nrb;
-    uint8_t leftByte = regs[bytePos];
-    uint8_t rightByte = regs[bytePos + 1];
-
-    leftByte >>= nlb;
-    leftByte <<= nlb;
-    rightByte <<= nrb;
-    rightByte >>= nrb;
-    leftByte |= (n >> nrb); /* Set the new left bits */
-    rightByte |= (n << (8 - nrb)); /* Set the new right bits */
-    regs[bytePos] = leftByte;
-    regs[bytePos + 1] = rightByte;
-}
-
-/* Compares two sparse register nodes */
-int compareNodes(const void* a, const void* b) {
-    int result = -1;
-    Node* A = (Node*) a;
-    Node* B = (Node*) b;
-
-    if (A->index == B->index) {
-        if (A->fsb > B->fsb) {
-            result = 1;
-        } else if (A->fsb < B->fsb) {
-            result = -1;
-        } else {
-            result = 0;
+    uint64_t bit = 6*m;
+    uint64_t bytePos = bit/8;
+    uint8_t shift = (uint8_t)(bit % 8);
+
+    if (shift <= 2) {
+        uint8_t mask = (uint8_t)(63 << (2 - shift));
+
+        regs[bytePos] = (uint8_t)((regs[bytePos] & ~mask) | (n << (2 - shift)));
+        return;
+    }
+
+    uint8_t leftMask = (uint8_t)(63 >> (shift - 2)); /* Low 8 - shift bits */
+    uint8_t rightMask = (uint8_t)(0xFF << (10 - shift)); /* High shift - 2 bits */
+
+    regs[bytePos] = (uint8_t)((regs[bytePos] & ~leftMask) | (n >> (shift - 2)));
+    regs[bytePos + 1] = (uint8_t)((regs[bytePos + 1] & ~rightMask) | (n << (10 - shift)));
+}
+
+/* Raises byte register index of a concurrent counter to rank. Returns true
+ * if the register grew. Threads may race on the same register; the CAS
+ * loop retries until the register holds at least rank. */
+static inline bool raiseConcurrentRegister(HyperLogLog* self, uint64_t index, uint8_t rank)
+{
+    _Atomic uint8_t* reg = (_Atomic uint8_t*)&self->registers[index];
+    uint8_t old = atomic_load_explicit(reg, memory_order_relaxed);
+
+    while (old < rank) {
+        if (atomic_compare_exchange_weak_explicit(reg, &old, rank, memory_order_relaxed, memory_order_relaxed)) {
+            return true;
         }
-    } else if (A->index > B->index) {
-        result = 1;
     }
 
-    return result;
+    return false;
 }
 
-/* Updates the register list using the items in the buffer */
-void flushRegisterBuffer(HyperLogLog* self)
+/* Reads byte register index of a concurrent counter */
+static inline uint8_t getConcurrentRegister(HyperLogLog* self, uint64_t index)
 {
-    uint64_t i;
-    Node* node;
-    Node* current = self->sparseRegisterList;
-    Node* next = NULL;
-    Node* prev = NULL;
+    return atomic_load_explicit((_Atomic uint8_t*)&self->registers[index], memory_order_relaxed);
+}
 
-    qsort(self->sparseRegisterBuffer, self->bufferSize, sizeof(Node), compareNodes);
+/* Compares two packed sparse entries */
+static int compareEntries(const void* a, const void* b)
+{
+    uint32_t A = *(const uint32_t*)a;
+    uint32_t B = *(const uint32_t*)b;
 
-    for (i = 0; i < self->bufferSize; i++) {
-        /* Create the new node from the current item in the buffer */
-        node = (Node*)malloc(sizeof(Node));
-        node->fsb = self->sparseRegisterBuffer[i].fsb;
-        node->index = self->sparseRegisterBuffer[i].index;
-        node->next = NULL;
-
-        /* If head doesn't exist then set it */
-        if (self->sparseRegisterList == NULL) {
-            self->sparseRegisterList = node;
-            self->histogram[0]--;
-            self->histogram[(uint8_t)node->fsb]++;
-            self->listSize += 1;
-            prev = node;
-            continue;
-        }
+    return (A > B) - (A < B);
+}
+
+/* Grows an entry array to hold at least needed entries */
+static bool reserveEntries(uint32_t** entries, uint64_t* capacity, uint64_t needed)
+{
+    uint64_t newCapacity = *capacity > 0 ? *capacity : SPARSE_INITIAL_CAPACITY;
+    uint32_t* grown;
+
+    if (needed <= *capacity) {
+        return true;
+    }
+
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+
+    grown = (uint32_t*)realloc(*entries, newCapacity * sizeof(uint32_t));
+
+    if (!grown) {
+        return false;
+    }
+
+    *entries = grown;
+    *capacity = newCapacity;
 
-        /* Since both lists are sorted try to use the last node */
-        if (prev != NULL) {
-            current = prev;
+    return true;
+}
+
+/* Weight of a register of rank fsb in rankSum. Scaling 2^-r by 2^q keeps
+ * the sum an exact integer, so it never drifts however often registers
+ * change, and it stays below 2^p * 2^(q - 1) = 2^63. Ranks above q fall
+ * outside the sum, as in the histogram walk. */
+static inline uint64_t rankWeight(const HyperLogLog* self, uint64_t fsb)
+{
+    unsigned q = 64 - self->p;
+
+    return fsb >= 1 && fsb <= q ? 1ULL << (q - fsb) : 0;
+}
+
+/* Moves a register from rank oldFsb to rank newFsb in rankSum */
+static inline void updateRankSum(HyperLogLog* self, uint64_t oldFsb, uint64_t newFsb)
+{
+    self->rankSum = self->rankSum - rankWeight(self, oldFsb) + rankWeight(self, newFsb);
+}
+
+/* Recomputes rankSum from the histogram */
+static void syncRankSum(HyperLogLog* self)
+{
+    uint64_t sum = 0;
+    unsigned q = 64 - self->p;
+
+    for (unsigned k = 1; k <= q; k++) {
+        sum += self->histogram[k] * rankWeight(self, k);
+    }
+
+    self->rankSum = sum;
+}
+
+/* Merge-joins n sorted entries (at most one per index) into the sorted
+ * register list, keeping the larger fsb for shared indexes. The merge runs
+ * back to front inside the list array, so no scratch space is needed. If
+ * changed is not NULL it receives the number of registers that changed. */
+static bool mergeSortedEntries(HyperLogLog* self, const uint32_t* entries, uint64_t n, uint64_t* changed)
+{
+    uint64_t updates = 0;
+
+    if (!reserveEntries(&self->sparseList, &self->listCapacity, self->listSize + n)) {
+        return false;
+    }
+
+    uint32_t* list = self->sparseList;
+    int64_t i = (int64_t)self->listSize - 1;
+    int64_t j = (int64_t)n - 1;
+    int64_t k = (int64_t)(self->listSize + n) - 1;
+
+    while (j >= 0) {
+        uint32_t entry = entries[j];
+
+        if (i >= 0 && SPARSE_INDEX(list[i]) > SPARSE_INDEX(entry)) {
+            list[k--] = list[i--];
+        } else if (i >= 0 && SPARSE_INDEX(list[i]) == SPARSE_INDEX(entry)) {
+            /* Are we updating an existing register? */
+            if (SPARSE_FSB(list[i]) < SPARSE_FSB(entry)) {
+                self->histogram[SPARSE_FSB(list[i])]--;
+                self->histogram[SPARSE_FSB(entry)]++;
+                updateRankSum(self, SPARSE_FSB(list[i]), SPARSE_FSB(entry));
+                list[k--] = entry;
+                updates++;
+            } else {
+                list[k--] = list[i];
+            }
+            i--;
+            j--;
         } else {
-            current = self->sparseRegisterList;
+            /* New nonzero register */
+            self->histogram[0]--;
+            self->histogram[SPARSE_FSB(entry)]++;
+            updateRankSum(self, 0, SPARSE_FSB(entry));
+            list[k--] = entry;
+            updates++;
+            j--;
         }
+    }
 
-        while (current != NULL) {
-            // Are we updating an existing node?
-            if (current->index == node->index) {
-                if (current->fsb < node->fsb) {
-                    self->histogram[current->fsb]--;
-                    self->histogram[node->fsb]++;
-                    current->fsb = node->fsb;
-                }
+    /* Shared indexes leave a gap below the merged entries; close it */
+    uint64_t start = (uint64_t)(k - i);
 
-                prev = current;
+    if (start > 0) {
+        memmove(list + start, list, (uint64_t)(i + 1) * sizeof(uint32_t));
+        self->listSize = self->listSize + n - start;
+        memmove(list, list + start, self->listSize * sizeof(uint32_t));
+    } else {
+        self->listSize += n;
+    }
 
-                /* We don't need the new node */
-                free(node);
-                break;
-            }
+    if (changed) {
+        *changed = updates;
+    }
 
-            // Are we creating a new head?
-            if (current->index > node->index) {
-                node->next = current;
-                self->histogram[0]--;
-                self->histogram[(uint8_t)node->fsb]++;
-                self->sparseRegisterList = node;
-                self->listSize += 1;
-                prev = node;
-                break;
-            }
+    return true;
+}
 
-            // Are we creating a new tail?
-            if (current->next == NULL) {
-                current->next = node;
-                self->histogram[0]--;
-                self->histogram[(uint8_t)node->fsb]++;
-                self->listSize += 1;
-                prev = node;
-                break;
-            }
+/* Updates the register list using the items in the buffer */
+void flushRegisterBuffer(HyperLogLog* self)
+{
+    uint64_t i, unique = 0;
+    uint32_t* buffer = self->sparseBuffer;
 
-            // Are inserting between nodes?
-            if (current->next->index > node->index) {
-                node->next = current->next;
-                current->next = node;
-                self->histogram[0]--;
-                self->histogram[(uint8_t)node->fsb]++;
-                self->listSize += 1;
-                prev = node;
-                break;
-            }
+    if (self->bufferSize == 0) {
+        return;
+    }
+
+    qsort(buffer, self->bufferSize, sizeof(uint32_t), compareEntries);
 
-            next = current->next;
-            current = next;
+    /* Keep one entry per index; sorted order puts the largest fsb last */
+    for (i = 0; i < self->bufferSize; i++) {
+        if (i + 1 < self->bufferSize && SPARSE_INDEX(buffer[i]) == SPARSE_INDEX(buffer[i + 1])) {
+            continue;
         }
+        buffer[unique++] = buffer[i];
     }
 
-    self->bufferSize = 0;
+    if (mergeSortedEntries(self, buffer, unique, NULL)) {
+        self->bufferSize = 0;
+    } else {
+        /* Out of memory: keep the deduplicated entries buffered */
+        self->bufferSize = unique;
+    }
 }
 
 /* Transforms a HyperLogLog from sparse to dense representation */
 void transformToDense(HyperLogLog* self) {
     uint64_t bytes = (self->size*6)/8 + 1;
+    uint64_t i;
+
+    flushRegisterBuffer(self);
+
     self->registers = (uint8_t*)calloc(bytes, sizeof(uint8_t));
 
     if (self->registers == NULL) {
@@ -193,64 +302,45 @@ void transformToDense(HyperLogLog* self) {
         return;
     }
 
-    flushRegisterBuffer(self);
-
-    Node* next = NULL;
-    Node* current = self->sparseRegisterList;
-
-    while (current != NULL) {
-        setDenseRegister(current->index, current->fsb, self->registers);
-        next = current->next;
-        current = next;
+    for (i = 0; i < self->listSize; i++) {
+        setDenseRegister(SPARSE_INDEX(self->sparseList[i]), SPARSE_FSB(self->sparseList[i]), self->registers);
     }
 
-    current = self->sparseRegisterList;
+    free(self->sparseList);
+    free(self->sparseBuffer);
 
-    while (current != NULL) {
-        next = current;
-        current = current->next;
-
-        if (next != NULL) {
-            free(next);
-            next = NULL;
-        }
-    }
-
-    if (self->sparseRegisterBuffer != NULL) {
-        free(self->sparseRegisterBuffer);
-        self->sparseRegisterBuffer = NULL;
-    }
-
-    self->sparseRegisterList = NULL;
-    self->nodeCache = NULL;
+    self->sparseList = NULL;
+    self->sparseBuffer = NULL;
+    self->listCapacity = 0;
+    self->bufferCapacity = 0;
     self->isSparse = 0;
 }
 
 /* Gets the register value at the specified index in sparse representation */
 static inline uint64_t getSparseRegister(HyperLogLog* self, uint64_t index)
 {
-    Node* current = NULL;
+    uint32_t key = SPARSE_ENTRY(index, 0);
+    uint64_t lo = 0;
+    uint64_t hi;
 
     if (self->bufferSize > 0) {
         flushRegisterBuffer(self);
     }
 
-    current = self->sparseRegisterList;
+    /* Binary search for the first entry at or after index */
+    hi = self->listSize;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo)/2;
 
-    /* Can we used the cache? */
-    if (self->nodeCache != NULL && self->nodeCache->index <= index) {
-        current = self->nodeCache;
-    }
-
-    while (current != NULL) {
-        if (current->index > index) {
-            return 0;
-        } else if (current->index == index) {
-            self->nodeCache = current;
-            return current->fsb;
+        if (self->sparseList[mid] < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
+    }
 
-        current = current->next;
+    if (lo < self->listSize && SPARSE_INDEX(self->sparseList[lo]) == index) {
+        return SPARSE_FSB(self->sparseList[lo]);
     }
 
     return 0;
@@ -259,23 +349,25 @@ static inline uint64_t getSparseRegister(HyperLogLog* self, uint64_t index)
 /* Sets a sparse register */
 static inline void setSparseRegister(HyperLogLog* self, uint64_t index, uint8_t fsb)
 {
-    /* Add an element to the buffer if there is room */
-    if (self->bufferSize < self->maxBufferSize) {
-        self->sparseRegisterBuffer[self->bufferSize].index = index;
-        self->sparseRegisterBuffer[self->bufferSize].fsb = fsb;
-        self->bufferSize++;
-    }
-    /* Otherwise flush the buffer and then add */
-    else {
+    /* Grow the buffer up to its maximum size, then flush when full */
+    if (self->bufferSize == self->bufferCapacity &&
+        (self->bufferCapacity >= self->maxBufferSize ||
+         !reserveEntries(&self->sparseBuffer, &self->bufferCapacity, self->bufferSize + 1))) {
         flushRegisterBuffer(self);
-        self->bufferSize = 1;
-        self->sparseRegisterBuffer[0].index = index;
-        self->sparseRegisterBuffer[0].fsb = fsb;
+    }
+
+    if (self->bufferSize < self->bufferCapacity) {
+        self->sparseBuffer[self->bufferSize++] = SPARSE_ENTRY(index, fsb);
     }
 }
 
 /* Set a HyperLogLog register */
 static inline bool setRegister(HyperLogLog* self, uint64_t index, uint8_t newFsb) {
+    /* Shared between threads: touch nothing but the register */
+    if (self->isConcurrent) {
+        return raiseConcurrentRegister(self, index, newFsb);
+    }
+
     self->added++; /* Increment method call counter */
 
     if (self->isSparse) {
@@ -294,6 +386,7 @@ static inline bool setRegister(HyperLogLog* self, uint64_t index, uint8_t newFsb
         if (newFsb > fsb) {
             setDenseRegister(index, (uint8_t)newFsb, self->registers);
             self->histogram[newFsb] += 1; /* Increment the new count */
+            updateRankSum(self, fsb, newFsb);
             self->isCached = 0;
 
             if (self->histogram[fsb] == 0) {
@@ -309,6 +402,121 @@ static inline bool setRegister(HyperLogLog* self, uint64_t index, uint8_t newFsb
     return false;
 }
 
+/* Merges the registers of src into dest along the cheapest path for the
+ * two representations. Returns the number of registers of dest that changed. */
+static uint64_t mergeRegisters(HyperLogLog* dest, HyperLogLog* src)
+{
+    uint64_t n = 0;
+
+    if (src->isSparse) {
+        flushRegisterBuffer(src);
+
+        if (dest->isSparse) {
+            flushRegisterBuffer(dest);
+        }
+    }
+
+    /* Concurrent counters on either side: read and raise byte registers one
+     * at a time, so other threads can keep adding to either counter */
+    if (src->isConcurrent || dest->isConcurrent) {
+        if (src->isSparse) {
+            for (uint64_t i = 0; i < src->listSize; i++) {
+                n += setRegister(dest, SPARSE_INDEX(src->sparseList[i]), SPARSE_FSB(src->sparseList[i]));
+            }
+
+            return n;
+        }
+
+        for (uint64_t i = 0; i < dest->size; i++) {
+            uint64_t newVal = hll_get_register(src, i);
+
+            if (newVal > 0 && hll_get_register(dest, i) < newVal) {
+                n += setRegister(dest, i, (uint8_t)newVal);
+            }
+        }
+
+        return n;
+    }
+
+    /* Sparse into sparse: one linear merge-join of the sorted lists */
+    if (src->isSparse && dest->isSparse && src->bufferSize == 0 && dest->bufferSize == 0 &&
+        mergeSortedEntries(dest, src->sparseList, src->listSize, &n)) {
+        dest->added += n;
+
+        if (dest->listSize >= dest->maxListSize) {
+            transformToDense(dest);
+        }
+
+        return n;
+    }
+
+    /* Sparse into dense: scatter only the nonzero source registers */
+    if (src->isSparse && !dest->isSparse && src->bufferSize == 0) {
+        for (uint64_t i = 0; i < src->listSize; i++) {
+            uint64_t index = SPARSE_INDEX(src->sparseList[i]);
+            uint8_t fsb = SPARSE_FSB(src->sparseList[i]);
+
+            if (getDenseRegister(index, dest->registers) < fsb) {
+                setRegister(dest, index, fsb);
+                n++;
+            }
+        }
+
+        return n;
+    }
+
+    /* A dense source fills more registers than the sparse limit allows */
+    if (!src->isSparse && dest->isSparse) {
+        transformToDense(dest);
+    }
+
+    /* Dense into dense: broadword max over whole packed words, unrolled for
+     * the precision where there is a kernel for it */
+    if (!src->isSparse && !dest->isSparse && dest->size % 8 == 0) {
+        const HllFixedKernels* fixed = hll_fixed_kernels(dest->p);
+
+        if (fixed) {
+            n = fixed->maxPacked6(dest->registers, src->registers, dest->histogram);
+        } else {
+            n = hll_max_packed6(dest->registers, src->registers, dest->size, dest->histogram);
+        }
+
+        dest->added += n;
+
+        /* The merge already costs a pass over the registers */
+        if (n > 0) {
+            syncRankSum(dest);
+        }
+
+        return n;
+    }
+
+    /* Small p or out of memory: go register by register */
+    for (uint64_t i = 0; i < dest->size; i++) {
+        uint64_t newVal;
+        uint64_t oldVal;
+
+        if (dest->isSparse) {
+            oldVal = getSparseRegister(dest, i);
+        } else {
+            oldVal = getDenseRegister(i, dest->registers);
+        }
+
+        if (src->isSparse) {
+            newVal = getSparseRegister(src, i);
+        } else {
+            newVal = getDenseRegister(i, src->registers);
+        }
+
+        if (oldVal < newVal) {
+            setRegister(dest, i, (uint8_t)newVal);
+            n++;
+        }
+    }
+
+    return n;
+}
+
 /* Counts leading zeros in an unsigned 64bit integer */
 uint8_t clz(uint64_t x) {
     uint8_t shift;
@@ -416,6 +624,53 @@ bool isValidIndex(uint64_t index, uint64_t size)
     return index < size;
 }
 
+/* Stores a 64-bit value little-endian */
+static inline void storeLe64(uint8_t* out, uint64_t value)
+{
+    for (unsigned i = 0; i < 8; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+/* Loads a little-endian 64-bit value */
+static inline uint64_t loadLe64(const uint8_t* in)
+{
+    uint64_t value = 0;
+
+    for (unsigned i = 0; i < 8; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+
+    return value;
+}
+
+/* Gets the register width a counter serializes with */
+static inline unsigned serialWidth(HyperLogLog* self)
+{
+    return self->isConcurrent ? 8 : 6;
+}
+
+/* Gets the payload size of a counter, flushing a sparse buffer first */
+static uint64_t serialPayloadSize(HyperLogLog* self)
+{
+    if (!self->isSparse) {
+        return (self->size * serialWidth(self) + 7) / 8;
+    }
+
+    uint64_t bytes = 0;
+    uint8_t scratch[SERIAL_MAX_VARINT];
+    uint32_t last = 0;
+
+    flushRegisterBuffer(self);
+
+    for (uint64_t i = 0; i < self->listSize; i++) {
+        bytes += writeVarint(scratch, self->sparseList[i] - last);
+        last = self->sparseList[i];
+    }
+
+    return bytes;
+}
+
 /* Public API Implementation */
 
 /* Create a new HyperLogLog */
@@ -432,6 +687,11 @@ HyperLogLog* hll_init(unsigned short p, uint64_t seed, bool sparse,
     hll->cache = 0;
     hll->isCached = 0;
     hll->listSize = 0;
+    hll->isConcurrent = 0;
+    hll->isRunning = 0;
+    hll->rankSum = 0;
+    hll->zeroTermCount = UINT64_MAX; /* Neither term computed yet */
+    hll->topTermCount = UINT64_MAX;
     hll->size = 1UL << p;
     hll->histogram = (uint64_t*)calloc(65, sizeof(uint64_t));
 
@@ -441,13 +701,15 @@ HyperLogLog* hll_init(unsigned short p, uint64_t seed, bool sparse,
     }
 
     hll->histogram[0] = hll->size; /* Set the zeroes count */
-    hll->nodeCache = NULL;
     hll->registers = NULL;
-    hll->sparseRegisterList = NULL;
-    hll->sparseRegisterBuffer = NULL;
+    hll->sparseList = NULL;
+    hll->sparseBuffer = NULL;
+    hll->listCapacity = 0;
+    hll->bufferCapacity = 0;
     hll->bufferSize = 0;
 
-    if (sparse) {
+    /* Register indexes must fit in a packed sparse entry */
+    if (sparse && p <= SPARSE_MAX_P) {
         hll->isSparse = 1;
 
         if (maxSparseListSize > 0) {
@@ -478,9 +740,8 @@ HyperLogLog* hll_init(unsigned short p, uint64_t seed, bool sparse,
             }
         }
 
-        hll->sparseRegisterBuffer = (Node*)malloc(sizeof(Node) * hll->maxBufferSize);
-
-        if (!hll->sparseRegisterBuffer) {
+        /* The list and buffer start small and grow as registers are set */
+        if (!reserveEntries(&hll->sparseBuffer, &hll->bufferCapacity, 1)) {
             free(hll->histogram);
             free(hll);
             return NULL;
@@ -501,6 +762,28 @@ HyperLogLog* hll_init(unsigned short p, uint64_t seed, bool sparse,
     return hll;
 }
 
+/* Create a HyperLogLog that threads can share */
+HyperLogLog* hll_init_concurrent(unsigned short p, uint64_t seed)
+{
+    HyperLogLog* hll = hll_init(p, seed, false, 0, 0);
+
+    if (!hll) return NULL;
+
+    /* One byte per register so each can be raised with a single CAS */
+    uint8_t* bytes = (uint8_t*)calloc(hll->size, sizeof(uint8_t));
+
+    if (!bytes) {
+        hll_free(hll);
+        return NULL;
+    }
+
+    free(hll->registers);
+    hll->registers = bytes;
+    hll->isConcurrent = 1;
+
+    return hll;
+}
+
 /* Free a HyperLogLog */
 void hll_free(HyperLogLog* hll)
 {
@@ -513,18 +796,8 @@ void hll_free(HyperLogLog* hll)
     }
 
     if (hll->isSparse) {
-        Node* next = NULL;
-        Node* current = hll->sparseRegisterList;
-
-        while (current != NULL) {
-            next = current->next;
-            free(current);
-            current = next;
-        }
-
-        if (hll->sparseRegisterBuffer) {
-            free(hll->sparseRegisterBuffer);
-        }
+        free(hll->sparseList);
+        free(hll->sparseBuffer);
     }
 
     free(hll);
@@ -544,61 +817,262 @@ bool hll_add(HyperLogLog* hll, const uint8_t* data, uint64_t dataLen)
     return setRegister(hll, index, (uint8_t)newFsb);
 }
 
+/* Applies a block of register updates */
+static void setRegisters(HyperLogLog* self, const uint64_t* indexes, const uint8_t* ranks, uint64_t n)
+{
+    uint64_t i = 0;
+    bool changed = false;
+
+    if (self->isConcurrent) {
+        for (; i < n; i++) {
+            raiseConcurrentRegister(self, indexes[i], ranks[i]);
+        }
+        return;
+    }
+
+    /* Sparse counters may turn dense partway through the block */
+    for (; i < n && self->isSparse; i++) {
+        setRegister(self, indexes[i], ranks[i]);
+    }
+
+    self->added += n - i;
+
+    for (; i < n; i++) {
+        uint64_t fsb = getDenseRegister(indexes[i], self->registers);
+
+        if (ranks[i] > fsb) {
+            setDenseRegister(indexes[i], ranks[i], self->registers);
+            self->histogram[ranks[i]]++;
+            self->histogram[fsb]--;
+            updateRankSum(self, fsb, ranks[i]);
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        self->isCached = 0;
+    }
+}
+
+/* Hashes and adds fixed-width keys a block at a time */
+static void addKeys(HyperLogLog* self, const void* keys, uint64_t n, unsigned width)
+{
+    const HllFixedKernels* fixed = hll_fixed_kernels(self->p);
+    uint64_t indexes[ADD_BLOCK_SIZE];
+    uint8_t ranks[ADD_BLOCK_SIZE];
+
+    for (uint64_t i = 0; i < n; i += ADD_BLOCK_SIZE) {
+        uint64_t count = n - i < ADD_BLOCK_SIZE ? n - i : ADD_BLOCK_SIZE;
+        const uint8_t* block = (const uint8_t*)keys + i * width;
+
+        /* Index and rank shifts are constants in the kernel for p */
+        if (fixed) {
+            fixed->hash(block, count, width, self->seed, indexes, ranks);
+        } else {
+            hll_hash_keys(block, count, width, self->seed, self->p, indexes, ranks);
+        }
+
+        setRegisters(self, indexes, ranks, count);
+    }
+}
+
+/* Add an array of 32-bit keys */
+bool hll_add_u32(HyperLogLog* hll, const uint32_t* keys, uint64_t n)
+{
+    if (n > 0 && !keys) {
+        return false;
+    }
+
+    addKeys(hll, keys, n, sizeof(uint32_t));
+
+    return true;
+}
+
+/* Add an array of 64-bit keys */
+bool hll_add_u64(HyperLogLog* hll, const uint64_t* keys, uint64_t n)
+{
+    if (n > 0 && !keys) {
+        return false;
+    }
+
+    addKeys(hll, keys, n, sizeof(uint64_t));
+
+    return true;
+}
+
+/* Add a buffer of length-prefixed items */
+bool hll_add_prefixed(HyperLogLog* hll, const uint8_t* buffer, uint64_t bufferLen)
+{
+    uint64_t indexes[ADD_BLOCK_SIZE];
+    uint8_t ranks[ADD_BLOCK_SIZE];
+    uint64_t pos = 0;
+    uint64_t count = 0;
+    uint32_t len;
+
+    /* Check the whole buffer first so a bad one adds nothing */
+    while (pos < bufferLen) {
+        if (bufferLen - pos < sizeof(len)) {
+            return false;
+        }
+
+        memcpy(&len, buffer + pos, sizeof(len));
+        pos += sizeof(len);
+
+        if (len > bufferLen - pos || len > INT32_MAX) {
+            return false;
+        }
+
+        pos += len;
+    }
+
+    for (pos = 0; pos < bufferLen; pos += len) {
+        uint64_t hash;
+
+        memcpy(&len, buffer + pos, sizeof(len));
+        pos += sizeof(len);
+
+        hash = MurmurHash64A((void*)(buffer + pos), (int)len, hll->seed);
+        indexes[count] = hash >> (64 - hll->p);
+        ranks[count] = clz(hash << hll->p) + 1;
+
+        if (++count == ADD_BLOCK_SIZE) {
+            setRegisters(hll, indexes, ranks, count);
+            count = 0;
+        }
+    }
+
+    setRegisters(hll, indexes, ranks, count);
+
+    return true;
+}
+
+/* Estimates the cardinality from rankSum and the zero and top-rank counts.
+ * This is the histogram walk of hll_histogram_cardinality folded into one
+ * sum, so it only differs from it by rounding. The sigma and tau terms are
+ * kept until their counts change, which past the first few adds per
+ * register is rare, so most calls take a handful of flops. */
+static uint64_t runningCardinality(HyperLogLog* self)
+{
+    double alpha = 0.7213475;
+    double m = (double)self->size;
+    int q = 64 - self->p;
+
+    if (self->zeroTermCount != self->histogram[0]) {
+        self->zeroTermCount = self->histogram[0];
+        self->zeroTerm = m * sigma((double)self->zeroTermCount/m);
+    }
+
+    if (self->topTermCount != self->histogram[self->p + 1]) {
+        self->topTermCount = self->histogram[self->p + 1];
+        self->topTerm = m * tau((m - (double)self->topTermCount)/m);
+    }
+
+    double z = ldexp(self->topTerm + (double)self->rankSum, -q) + self->zeroTerm;
+
+    return (uint64_t)round(alpha * m * (m/z));
+}
+
+/* Estimates the cardinality from the statistics of a register scan, as
+ * hll_histogram_cardinality does from a histogram */
+static uint64_t sumsCardinality(const HyperLogLog* self, const HllRegisterSums* sums)
+{
+    double alpha = 0.7213475;
+    double m = (double)self->size;
+    int q = 64 - self->p;
+
+    double z = ldexp(m * tau((m - (double)sums->matches)/m), -q) + sums->inverseSum;
+    z += m * sigma((double)sums->zeros/m);
+
+    return (uint64_t)round(alpha * m * (m/z));
+}
+
 /* Get cardinality estimate */
 uint64_t hll_cardinality(HyperLogLog* hll)
 {
+    /* Concurrent counters keep no histogram; sum a snapshot of their byte
+     * registers, which other threads may be raising meanwhile */
+    if (hll->isConcurrent) {
+        const HllFixedKernels* fixed = hll_fixed_kernels(hll->p);
+        HllRegisterSums sums;
+
+        if (fixed) {
+            fixed->sums(hll->registers, &sums);
+        } else {
+            hll_register_sums(hll->registers, hll->size, (uint8_t)(64 - hll->p), (uint8_t)(hll->p + 1), &sums);
+        }
+
+        return sumsCardinality(hll, &sums);
+    }
+
     if (hll->isCached) {
         return hll->cache;
     } else if (hll->isSparse && hll->bufferSize > 0) {
         flushRegisterBuffer(hll);
     }
 
+    uint64_t estimate;
+
+    if (hll->isRunning) {
+        estimate = runningCardinality(hll);
+    } else {
+        estimate = hll_histogram_cardinality(hll->histogram, hll->p);
+    }
+
+    hll->cache = estimate;
+    hll->isCached = 1;
+
+    return estimate;
+}
+
+/* Get cardinality estimate from a register histogram */
+uint64_t hll_histogram_cardinality(const uint64_t* histogram, unsigned short p)
+{
     double alpha = 0.7213475;
-    double m = (double)hll->size;
-    double z = m * tau((m - (double)hll->histogram[hll->p + 1])/m);
+    double m = (double)(1UL << p);
+    double z = m * tau((m - (double)histogram[p + 1])/m);
 
     uint64_t k;
-    for (k = 64 - hll->p; k >= 1; --k) {
-        z += hll->histogram[k];
+    for (k = 64 - p; k >= 1; --k) {
+        z += histogram[k];
         z *= 0.5;
     }
 
-    z += m * sigma((double)hll->histogram[0]/m);
-    uint64_t estimate = (uint64_t)round(alpha * m * (m/z));
+    z += m * sigma((double)histogram[0]/m);
 
-    hll->cache = estimate;
-    hll->isCached = 1;
+    return (uint64_t)round(alpha * m * (m/z));
+}
 
-    return estimate;
+/* Choose how hll_cardinality estimates */
+void hll_set_estimator(HyperLogLog* hll, HllEstimator estimator)
+{
+    hll->isRunning = estimator == HLL_ESTIMATOR_RUNNING;
+    hll->isCached = 0;
 }
 
 /* Merge another HyperLogLog into the current one */
 bool hll_merge(HyperLogLog* dest, HyperLogLog* src)
+{
+    return hll_merge_changed(dest, src, NULL);
+}
+
+/* Merge another HyperLogLog into the current one, reporting any change */
+bool hll_merge_changed(HyperLogLog* dest, HyperLogLog* src, bool* changed)
 {
     if (src->size != dest->size) {
         return false;
     }
 
-    dest->isCached = 0;
-
-    for (uint64_t i = 0; i < dest->size; i++) {
-        uint64_t newVal;
-        uint64_t oldVal;
-
-        if (dest->isSparse) {
-            oldVal = getSparseRegister(dest, i);
-        } else {
-            oldVal = getDenseRegister(i, dest->registers);
-        }
+    if (changed) {
+        *changed = false;
+    }
 
-        if (src->isSparse) {
-            newVal = getSparseRegister(src, i);
-        } else {
-            newVal = getDenseRegister(i, src->registers);
+    if (dest != src && mergeRegisters(dest, src) > 0) {
+        if (!dest->isConcurrent) {
+            dest->isCached = 0;
         }
 
-        if (oldVal < newVal) {
-            setRegister(dest, i, (uint8_t)newVal);
+        if (changed) {
+            *changed = true;
         }
     }
 
@@ -616,7 +1090,9 @@ uint64_t hll_get_register(HyperLogLog* hll, uint64_t index)
 {
     if (!isValidIndex(index, hll->size)) return 0;
 
-    if (hll->isSparse) {
+    if (hll->isConcurrent) {
+        return getConcurrentRegister(hll, index);
+    } else if (hll->isSparse) {
         return getSparseRegister(hll, index);
     } else {
         return getDenseRegister(index, hll->registers);
@@ -634,3 +1110,240 @@ uint64_t hll_seed(HyperLogLog* hll)
 {
     return hll->seed;
 }
+
+/* Get the number of bytes a counter serializes to */
+uint64_t hll_serialized_size(HyperLogLog* hll)
+{
+    return SERIAL_HEADER_SIZE + serialPayloadSize(hll);
+}
+
+/* Serialize a counter */
+uint64_t hll_serialize(HyperLogLog* hll, uint8_t* buffer, uint64_t capacity)
+{
+    uint64_t payload = serialPayloadSize(hll);
+    unsigned width = serialWidth(hll);
+    uint8_t* out = buffer + SERIAL_HEADER_SIZE;
+
+    /* A sparse buffer that could not be flushed cannot be written out */
+    if (capacity < SERIAL_HEADER_SIZE + payload || (hll->isSparse && hll->bufferSize > 0)) {
+        return 0;
+    }
+
+    memcpy(buffer, SERIAL_MAGIC, 4);
+    buffer[4] = SERIAL_VERSION;
+    buffer[5] = hll->isSparse ? SERIAL_SPARSE : SERIAL_DENSE;
+    buffer[6] = (uint8_t)hll->p;
+    buffer[7] = (uint8_t)width;
+    storeLe64(buffer + 8, hll->seed);
+    storeLe64(buffer + 16, hll->isSparse ? hll->listSize : hll->size);
+    storeLe64(buffer + 24, payload);
+
+    if (hll->isSparse) {
+        uint32_t last = 0;
+
+        for (uint64_t i = 0; i < hll->listSize; i++) {
+            out += writeVarint(out, hll->sparseList[i] - last);
+            last = hll->sparseList[i];
+        }
+    } else if (width == 8) {
+        for (uint64_t i = 0; i < hll->size; i++) {
+            out[i] = getConcurrentRegister(hll, i);
+        }
+    } else {
+        uint64_t bits = 0;
+        unsigned used = 0;
+
+        /* Pack registers low bits first, flushing whole bytes */
+        for (uint64_t i = 0; i < hll->size; i++) {
+            bits |= getDenseRegister(i, hll->registers) << used;
+            used += 6;
+
+            while (used >= 8) {
+                *out++ = (uint8_t)bits;
+                bits >>= 8;
+                used -= 8;
+            }
+        }
+
+        if (used > 0) {
+            *out = (uint8_t)bits;
+        }
+    }
+
+    return SERIAL_HEADER_SIZE + payload;
+}
+
+/* Deserialize a counter */
+HyperLogLog* hll_deserialize(const uint8_t* buffer, uint64_t length)
+{
+    if (length < SERIAL_HEADER_SIZE || memcmp(buffer, SERIAL_MAGIC, 4) != 0 || buffer[4] != SERIAL_VERSION) {
+        return NULL;
+    }
+
+    unsigned encoding = buffer[5];
+    unsigned short p = buffer[6];
+    unsigned width = buffer[7];
+    uint64_t seed = loadLe64(buffer + 8);
+    uint64_t count = loadLe64(buffer + 16);
+    uint64_t payload = loadLe64(buffer + 24);
+    const uint8_t* in = buffer + SERIAL_HEADER_SIZE;
+    const uint8_t* end = in + payload;
+    uint8_t maxRank = (uint8_t)(65 - p);
+    HyperLogLog* hll;
+
+    /* Check the header before sizing anything from it */
+    if (p < 4 || p > SPARSE_MAX_P || payload > length - SERIAL_HEADER_SIZE) {
+        return NULL;
+    }
+
+    if (encoding == SERIAL_SPARSE) {
+        uint32_t* entries;
+        uint64_t last = 0;
+
+        /* Every entry takes at least one byte */
+        if (width != 6 || count > payload || count > (1UL << p)) {
+            return NULL;
+        }
+
+        hll = hll_init(p, seed, true, 0, 0);
+        entries = (uint32_t*)malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+
+        if (!hll || !entries) {
+            free(entries);
+            hll_free(hll);
+            return NULL;
+        }
+
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t gap;
+
+            /* Entries must move to a later index, stay in range and hold a valid rank */
+            if (!readVarintBounded(&in, end, &gap) || gap > UINT32_MAX || last + gap > UINT32_MAX ||
+                (i > 0 && SPARSE_INDEX(last + gap) <= SPARSE_INDEX(last)) ||
+                SPARSE_INDEX(last + gap) >= hll->size || SPARSE_FSB(last + gap) == 0 ||
+                SPARSE_FSB(last + gap) > maxRank) {
+                free(entries);
+                hll_free(hll);
+                return NULL;
+            }
+
+            last += gap;
+            entries[i] = (uint32_t)last;
+        }
+
+        bool ok = in == end && mergeSortedEntries(hll, entries, count, NULL);
+
+        free(entries);
+
+        if (!ok) {
+            hll_free(hll);
+            return NULL;
+        }
+
+        hll->added = count;
+
+        if (hll->listSize >= hll->maxListSize) {
+            transformToDense(hll);
+        }
+
+        return hll;
+    }
+
+    if (encoding != SERIAL_DENSE || (width != 6 && width != 8) || count != (1UL << p) ||
+        payload != (count * width + 7) / 8) {
+        return NULL;
+    }
+
+    hll = hll_init(p, seed, false, 0, 0);
+
+    if (!hll) return NULL;
+
+    uint64_t bits = 0;
+    unsigned used = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint8_t fsb;
+
+        while (used < width) {
+            bits |= (uint64_t)*in++ << used;
+            used += 8;
+        }
+
+        fsb = (uint8_t)(bits & ((1U << width) - 1));
+        bits >>= width;
+        used -= width;
+
+        if (fsb > maxRank) {
+            hll_free(hll);
+            return NULL;
+        }
+
+        if (fsb > 0) {
+            setRegister(hll, i, fsb);
+        }
+    }
+
+    return hll;
+}
+
+/* Copy every register out as a byte */
+void hll_get_registers(HyperLogLog* hll, uint8_t* out)
+{
+    if (hll->isConcurrent) {
+        for (uint64_t i = 0; i < hll->size; i++) {
+            out[i] = getConcurrentRegister(hll, i);
+        }
+    } else if (hll->isSparse) {
+        flushRegisterBuffer(hll);
+        memset(out, 0, hll->size);
+
+        for (uint64_t i = 0; i < hll->listSize; i++) {
+            out[SPARSE_INDEX(hll->sparseList[i])] = SPARSE_FSB(hll->sparseList[i]);
+        }
+
+        /* Entries left buffered if the flush ran out of memory */
+        for (uint64_t i = 0; i < hll->bufferSize; i++) {
+            uint32_t entry = hll->sparseBuffer[i];
+
+            if (out[SPARSE_INDEX(entry)] < SPARSE_FSB(entry)) {
+                out[SPARSE_INDEX(entry)] = SPARSE_FSB(entry);
+            }
+        }
+    } else {
+        for (uint64_t i = 0; i < hll->size; i++) {
+            out[i] = (uint8_t)getDenseRegister(i, hll->registers);
+        }
+    }
+}
+
+/* Merge byte registers into a counter */
+bool hll_merge_registers(HyperLogLog* dest, const uint8_t* registers, uint64_t n)
+{
+    uint8_t top = 0;
+
+    if (n != dest->size) {
+        return false;
+    }
+
+    /* Check the ranks first so a bad array merges nothing */
+    for (uint64_t i = 0; i < n; i++) {
+        top = registers[i] > top ? registers[i] : top;
+    }
+
+    if (top > 65 - dest->p) {
+        return false;
+    }
+
+    if (dest->isConcurrent) {
+        hll_atomic_max_u8(dest->registers, registers, n);
+        return true;
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        if (registers[i] > 0) {
+            setRegister(dest, i, registers[i]);
+        }
+    }
+
+    return true;
+}
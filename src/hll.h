@@ -13,18 +13,57 @@ typedef struct HyperLogLog HyperLogLog;
 HyperLogLog* hll_init(unsigned short p, uint64_t seed, bool sparse,
                     uint64_t maxSparseListSize, uint64_t maxSparseBufferSize);
 
+/* Creates a dense HyperLogLog with 2^p byte registers that any number of
+ * threads may add to (and merge into) at once without locks. Registers are
+ * raised with atomic compare-and-swap and the estimate is computed from
+ * the registers on each hll_cardinality call. */
+HyperLogLog* hll_init_concurrent(unsigned short p, uint64_t seed);
+
 /* Frees the memory used by a HyperLogLog */
 void hll_free(HyperLogLog* hll);
 
 /* Adds an element to the HyperLogLog */
 bool hll_add(HyperLogLog* hll, const uint8_t* data, uint64_t dataLen);
 
+/* Adds n 32-bit keys, each hashed like hll_add over its 4 bytes in memory */
+bool hll_add_u32(HyperLogLog* hll, const uint32_t* keys, uint64_t n);
+
+/* Adds n 64-bit keys, each hashed like hll_add over its 8 bytes in memory */
+bool hll_add_u64(HyperLogLog* hll, const uint64_t* keys, uint64_t n);
+
+/* Adds every item of a buffer of items, each a native-endian uint32_t
+ * length followed by that many bytes. Returns false (adding nothing) if
+ * the buffer is truncated. */
+bool hll_add_prefixed(HyperLogLog* hll, const uint8_t* buffer, uint64_t bufferLen);
+
 /* Gets the cardinality estimate */
 uint64_t hll_cardinality(HyperLogLog* hll);
 
+/* How hll_cardinality estimates. Counters keep a running sum of 2^-r over
+ * their registers, updated in O(1) for every register that changes, so the
+ * running estimate takes a few flops to read however often the counter
+ * changes between reads. The histogram estimator walks the register
+ * histogram instead, and caches the result until a register changes; the
+ * two only differ by floating point rounding. Concurrent counters always
+ * estimate from a snapshot of their registers. */
+typedef enum HllEstimator {
+    HLL_ESTIMATOR_HISTOGRAM,      /* Walk the register histogram (the default) */
+    HLL_ESTIMATOR_RUNNING         /* Read the running sum */
+} HllEstimator;
+
+/* Chooses how hll_cardinality estimates */
+void hll_set_estimator(HyperLogLog* hll, HllEstimator estimator);
+
+/* Gets the cardinality estimate for a 65-entry register histogram of 2^p registers */
+uint64_t hll_histogram_cardinality(const uint64_t* histogram, unsigned short p);
+
 /* Merges another HyperLogLog into the current one */
 bool hll_merge(HyperLogLog* dest, HyperLogLog* src);
 
+/* Merges another HyperLogLog into the current one and sets *changed to
+ * whether any register of dest grew (changed may be NULL) */
+bool hll_merge_changed(HyperLogLog* dest, HyperLogLog* src, bool* changed);
+
 /* Gets a Murmur64A hash of data */
 uint64_t hll_hash(HyperLogLog* hll, const uint8_t* data, uint64_t dataLen);
 
@@ -37,6 +76,27 @@ uint64_t hll_size(HyperLogLog* hll);
 /* Gets the seed value */
 uint64_t hll_seed(HyperLogLog* hll);
 
+/* Gets the number of bytes hll_serialize writes for a counter */
+uint64_t hll_serialized_size(HyperLogLog* hll);
+
+/* Writes a counter to buffer: a versioned header with p, the seed and the
+ * register width, then the registers, sparse counters as their nonzero
+ * registers only. Returns the number of bytes written, or 0 if capacity
+ * is too small. */
+uint64_t hll_serialize(HyperLogLog* hll, uint8_t* buffer, uint64_t capacity);
+
+/* Reads a counter written by hll_serialize. Returns NULL if the buffer is
+ * truncated or does not hold a valid counter. */
+HyperLogLog* hll_deserialize(const uint8_t* buffer, uint64_t length);
+
+/* Copies every register into hll_size(hll) bytes, one per register */
+void hll_get_registers(HyperLogLog* hll, uint8_t* out);
+
+/* Merges n byte registers, such as the output of hll_get_registers, into
+ * a counter. Returns false, merging nothing, if n is not the number of
+ * registers or a register is above the largest rank for p. */
+bool hll_merge_registers(HyperLogLog* dest, const uint8_t* registers, uint64_t n);
+
 /* Helper functions */
 uint8_t clz(uint64_t x);
 double sigma(double x);
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hll_array.h"
+#include "hll_kernels.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* File layout: magic, numCounters, p and seed, all native-endian, zero
+ * padding up to 64 bytes, then the registers */
+#define HLL_ARRAY_MAGIC "HLLARR01"
+#define HLL_ARRAY_HEADER_SIZE 64
+
+/* Save counters as an array file */
+bool hll_array_save(HyperLogLog** counters, uint64_t n, const char* path)
+{
+    uint8_t header[HLL_ARRAY_HEADER_SIZE] = {0};
+    uint64_t fields[3] = {n, 0, 0};
+    uint64_t size;
+    uint8_t* registers = NULL;
+    FILE* file;
+    bool ok;
+
+    /* Without a counter there is no p to write */
+    if (n == 0) {
+        return false;
+    }
+
+    /* hll_size is 2^p */
+    size = hll_size(counters[0]);
+    while ((1ULL << fields[1]) < size) {
+        fields[1]++;
+    }
+    fields[2] = hll_seed(counters[0]);
+
+    for (uint64_t i = 1; i < n; i++) {
+        if (hll_size(counters[i]) != size || hll_seed(counters[i]) != fields[2]) {
+            return false;
+        }
+    }
+
+    registers = (uint8_t*)malloc(size);
+    file = registers ? fopen(path, "wb") : NULL;
+
+    if (!file) {
+        free(registers);
+        return false;
+    }
+
+    memcpy(header, HLL_ARRAY_MAGIC, 8);
+    memcpy(header + 8, fields, sizeof(fields));
+    ok = fwrite(header, 1, HLL_ARRAY_HEADER_SIZE, file) == HLL_ARRAY_HEADER_SIZE;
+
+    for (uint64_t i = 0; ok && i < n; i++) {
+        hll_get_registers(counters[i], registers);
+        ok = fwrite(registers, 1, size, file) == size;
+    }
+
+    free(registers);
+
+    return fclose(file) == 0 && ok;
+}
+
+/* Load an array file */
+HllArray* hll_array_load(const char* path)
+{
+    HllArray* array = (HllArray*)calloc(1, sizeof(HllArray));
+    const uint8_t* map = NULL;
+    uint64_t size = 0;
+
+    if (!array) return NULL;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER length;
+
+    if (file != INVALID_HANDLE_VALUE) {
+        if (GetFileSizeEx(file, &length) && length.QuadPart >= HLL_ARRAY_HEADER_SIZE) {
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+            size = (uint64_t)length.QuadPart;
+            map = mapping ? (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+            if (mapping) CloseHandle(mapping);
+        }
+
+        CloseHandle(file);
+    }
+#else
+    struct stat info;
+    int fd = open(path, O_RDONLY);
+
+    if (fd >= 0) {
+        if (fstat(fd, &info) == 0 && (uint64_t)info.st_size >= HLL_ARRAY_HEADER_SIZE) {
+            void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+            size = (uint64_t)info.st_size;
+            map = view == MAP_FAILED ? NULL : (const uint8_t*)view;
+
+            /* Queries pick a few counters anywhere in the file */
+            if (map) posix_madvise(view, size, POSIX_MADV_RANDOM);
+        }
+
+        close(fd);
+    }
+#endif
+
+    if (!map) {
+        free(array);
+        return NULL;
+    }
+
+    array->map = (void*)map;
+    array->mapSize = size;
+
+    uint64_t header[3];
+    memcpy(header, map + 8, sizeof(header));
+
+    array->numCounters = header[0];
+    array->p = (unsigned short)header[1];
+    array->seed = header[2];
+    array->registers = map + HLL_ARRAY_HEADER_SIZE;
+
+    /* The counters must fill the rest of the file exactly */
+    if (memcmp(map, HLL_ARRAY_MAGIC, 8) != 0 || header[1] < 4 || header[1] > 26 ||
+        header[0] > (size >> header[1]) || HLL_ARRAY_HEADER_SIZE + (header[0] << header[1]) != size) {
+        hll_array_free(array);
+        return NULL;
+    }
+
+    return array;
+}
+
+/* Free an array */
+void hll_array_free(HllArray* array)
+{
+    if (!array) return;
+
+    if (array->map) {
+#ifdef _WIN32
+        UnmapViewOfFile(array->map);
+#else
+        munmap(array->map, array->mapSize);
+#endif
+    }
+
+    free(array);
+}
+
+/* Merge a mapped counter into a counter */
+bool hll_array_merge(const HllArray* array, uint64_t index, HyperLogLog* dest)
+{
+    if (index >= array->numCounters || hll_seed(dest) != array->seed) {
+        return false;
+    }
+
+    return hll_merge_registers(dest, hll_array_registers(array, index), 1ULL << array->p);
+}
+
+/* Union of mapped counters */
+bool hll_array_union(const HllArray* array, const uint64_t* indexes, uint64_t n, uint8_t* out)
+{
+    const HllFixedKernels* fixed = hll_fixed_kernels(array->p);
+    uint64_t size = 1ULL << array->p;
+    uint8_t top = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        if (indexes[i] >= array->numCounters) {
+            return false;
+        }
+    }
+
+    for (uint64_t i = 0; i < n; i++) {
+        const uint8_t* src = hll_array_registers(array, indexes[i]);
+
+        if (fixed) {
+            fixed->max(out, src);
+        } else {
+            hll_max_u8(out, src, size);
+        }
+    }
+
+    /* Any rank no hash can give ends up in the union */
+    for (uint64_t j = 0; j < size; j++) {
+        top = out[j] > top ? out[j] : top;
+    }
+
+    return top <= 65 - array->p;
+}
@@ -0,0 +1,48 @@
+#ifndef HLL_ARRAY_H
+#define HLL_ARRAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hll.h"
+
+/* Array of HyperLogLog counters with the same p and seed, one byte per
+ * register, stored back to back so a file can be memory-mapped and its
+ * counters merged straight from the mapped bytes. Counter i holds the
+ * 2^p registers at registers + (i << p); the first is 64-byte aligned. */
+typedef struct HllArray {
+    uint64_t numCounters;         /* Number of counters */
+    unsigned short p;             /* 2^p registers per counter */
+    uint64_t seed;                /* MurmurHash64A seed */
+    const uint8_t* registers;     /* numCounters x 2^p byte registers */
+    void* map;                    /* File mapping holding the registers */
+    uint64_t mapSize;             /* Size of the file mapping */
+} HllArray;
+
+/* Writes n > 0 counters, which must share p and seed, to an array file.
+ * Returns false if there are none, they do not or on I/O errors. */
+bool hll_array_save(HyperLogLog** counters, uint64_t n, const char* path);
+
+/* Memory-maps an array file. Only the header is read; registers are
+ * checked as they are merged. */
+HllArray* hll_array_load(const char* path);
+
+/* Unmaps an array */
+void hll_array_free(HllArray* array);
+
+/* Gets the registers of counter index in place */
+static inline const uint8_t* hll_array_registers(const HllArray* array, uint64_t index)
+{
+    return array->registers + (index << array->p);
+}
+
+/* Merges counter index into dest, which must have the same p and seed.
+ * Returns false if it does not, index is out of range or the counter has
+ * a rank no hash can give. */
+bool hll_array_merge(const HllArray* array, uint64_t index, HyperLogLog* dest);
+
+/* Raises the 2^p byte registers of out to the union of n counters.
+ * Returns false if an index is out of range, or if a register of the
+ * union holds a rank no hash can give; out is then left raised. */
+bool hll_array_union(const HllArray* array, const uint64_t* indexes, uint64_t n, uint8_t* out);
+
+#endif /* HLL_ARRAY_H */
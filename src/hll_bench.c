@@ -0,0 +1,546 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "hll.h"
+#include "hll_kernels.h"
+#include "graph.h"
+#include "graph_gen.h"
+#include "graph_order.h"
+#include "anf.h"
+#include "topology.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+/* Benchmarks the HLL and HyperANF kernels. Every measurement is printed as
+ * one JSON object per line, so results can be diffed and tracked.
+ *
+ *   hll_bench [--max-edges N] [--threads T] [--p P] [--width W] [--order O] [--placement P|all] [--pin]
+ *             [--strategy S] [--incremental B] [--skip-hll] [--skip-anf] [--log-rounds]
+ *
+ * --order reorders each graph (bfs, degree or community) before HyperANF
+ * and reports the time it took and the locality before and after.
+ * --placement places the counter pages on the NUMA nodes (first-touch,
+ * interleave or partitioned); "all" runs every placement on the same graph
+ * so their throughputs can be compared. --pin pins the worker threads;
+ * partitioned placement always pins them.
+ * --strategy sets how HyperANF rounds pick the counters to recompute
+ * (auto, dense, sparse, push or full).
+ * --incremental B also holds B arcs of each graph back from an incremental
+ * run and times adding them against a full run over the whole graph.
+ * --log-rounds also writes the statistics of every HyperANF round to stderr.
+ */
+
+/* Largest graph (in nodes) checked against exact BFS */
+#define BENCH_MAX_EXACT_NODES 4096
+
+/* Gets a monotonic time in seconds */
+static double now(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* Gets the peak resident set size of the process in bytes */
+static uint64_t peakRss(void)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return (uint64_t)counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+/* Times hll_add over n distinct 8-byte keys */
+static void benchAdd(unsigned short p, bool sparse, uint64_t n)
+{
+    HyperLogLog* hll = hll_init(p, 12345, sparse, 0, 0);
+    double start = now();
+
+    for (uint64_t i = 0; i < n; i++) {
+        hll_add(hll, (const uint8_t*)&i, sizeof(i));
+    }
+
+    double elapsed = now() - start;
+    HyperLogLog* batch = hll_init(p, 12345, sparse, 0, 0);
+    uint64_t* keys = (uint64_t*)malloc(n * sizeof(uint64_t));
+
+    for (uint64_t i = 0; i < n; i++) {
+        keys[i] = i;
+    }
+
+    double batchStart = now();
+    hll_add_u64(batch, keys, n);
+    double batchElapsed = now() - batchStart;
+
+    printf("{\"bench\": \"hll_add\", \"p\": %u, \"sparse\": %s, \"ops\": %llu, \"ns_per_op\": %.2f}\n",
+           p, sparse ? "true" : "false", (unsigned long long)n, elapsed * 1e9 / (double)n);
+    printf("{\"bench\": \"hll_add_u64\", \"p\": %u, \"sparse\": %s, \"ops\": %llu, \"ns_per_op\": %.2f}\n",
+           p, sparse ? "true" : "false", (unsigned long long)n, batchElapsed * 1e9 / (double)n);
+
+    free(keys);
+    hll_free(hll);
+    hll_free(batch);
+}
+
+/* Creates a counter holding count keys starting at first */
+static HyperLogLog* filledCounter(unsigned short p, bool sparse, uint64_t first, uint64_t count)
+{
+    HyperLogLog* hll = hll_init(p, 12345, sparse, 0, 0);
+
+    for (uint64_t i = first; i < first + count; i++) {
+        hll_add(hll, (const uint8_t*)&i, sizeof(i));
+    }
+
+    return hll;
+}
+
+/* Times hll_merge of a source with srcKeys keys into fresh destinations
+ * holding dstKeys keys */
+static void benchMerge(unsigned short p, bool dstSparse, bool srcSparse, uint64_t dstKeys, uint64_t srcKeys,
+                       uint64_t reps)
+{
+    HyperLogLog* src = filledCounter(p, srcSparse, 1ULL << 40, srcKeys);
+    HyperLogLog** dsts = (HyperLogLog**)malloc(reps * sizeof(HyperLogLog*));
+
+    for (uint64_t r = 0; r < reps; r++) {
+        dsts[r] = filledCounter(p, dstSparse, r * dstKeys, dstKeys);
+    }
+
+    double start = now();
+
+    for (uint64_t r = 0; r < reps; r++) {
+        hll_merge(dsts[r], src);
+    }
+
+    double elapsed = now() - start;
+
+    printf("{\"bench\": \"hll_merge\", \"p\": %u, \"dst\": \"%s\", \"src\": \"%s\", \"ops\": %llu, "
+           "\"ns_per_op\": %.2f}\n",
+           p, dstSparse ? "sparse" : "dense", srcSparse ? "sparse" : "dense", (unsigned long long)reps,
+           elapsed * 1e9 / (double)reps);
+
+    for (uint64_t r = 0; r < reps; r++) {
+        hll_free(dsts[r]);
+    }
+
+    free(dsts);
+    hll_free(src);
+}
+
+/* Times the first (uncached) hll_cardinality call on reps counters */
+static void benchCardinality(unsigned short p, uint64_t reps)
+{
+    HyperLogLog** hlls = (HyperLogLog**)malloc(reps * sizeof(HyperLogLog*));
+    uint64_t sink = 0;
+
+    for (uint64_t r = 0; r < reps; r++) {
+        hlls[r] = filledCounter(p, false, r << 20, 4ULL << p);
+    }
+
+    double start = now();
+
+    for (uint64_t r = 0; r < reps; r++) {
+        sink += hll_cardinality(hlls[r]);
+    }
+
+    double elapsed = now() - start;
+
+    printf("{\"bench\": \"hll_cardinality\", \"p\": %u, \"ops\": %llu, \"ns_per_op\": %.2f, \"checksum\": %llu}\n",
+           p, (unsigned long long)reps, elapsed * 1e9 / (double)reps, (unsigned long long)sink);
+
+    for (uint64_t r = 0; r < reps; r++) {
+        hll_free(hlls[r]);
+    }
+
+    free(hlls);
+}
+
+/* Computes the exact neighborhood function with one BFS per node. Returns
+ * a malloc'd array of N(0) ... N(T) and stores T + 1 in rounds. */
+static uint64_t* exactNeighborhoodFunction(const Graph* graph, uint64_t* rounds)
+{
+    uint64_t n = graph->numNodes;
+    uint64_t* dist = (uint64_t*)malloc(n * sizeof(uint64_t));
+    uint64_t* queue = (uint64_t*)malloc(n * sizeof(uint64_t));
+    uint64_t* counts = (uint64_t*)calloc(n + 1, sizeof(uint64_t));
+    uint64_t maxDist = 0;
+
+    for (uint64_t s = 0; s < n; s++) {
+        uint64_t head = 0, tail = 0;
+
+        memset(dist, 0xFF, n * sizeof(uint64_t));
+        dist[s] = 0;
+        queue[tail++] = s;
+
+        while (head < tail) {
+            uint64_t v = queue[head++];
+
+            counts[dist[v]]++;
+            if (dist[v] > maxDist) maxDist = dist[v];
+
+            for (uint64_t k = 0; k < graph_degree(graph, v); k++) {
+                uint64_t w = graph_successors(graph, v)[k];
+
+                if (dist[w] == UINT64_MAX) {
+                    dist[w] = dist[v] + 1;
+                    queue[tail++] = w;
+                }
+            }
+        }
+    }
+
+    /* Pairs within distance t; the last value repeats, like HyperANF's */
+    for (uint64_t t = 1; t <= maxDist + 1 && t <= n; t++) {
+        counts[t] += counts[t - 1];
+    }
+
+    *rounds = maxDist + 2 <= n + 1 ? maxDist + 2 : n + 1;
+    free(dist);
+    free(queue);
+
+    return counts;
+}
+
+/* Average distance over reachable pairs from N(0) ... N(T - 1) */
+static double averageDistance(const uint64_t* nf, uint64_t rounds)
+{
+    double total = 0.0, pairs = 0.0;
+
+    for (uint64_t t = 1; t + 1 < rounds; t++) {
+        double count = (double)nf[t] - (double)nf[t - 1];
+        total += (double)t * count;
+        pairs += count;
+    }
+
+    return pairs > 0 ? total / pairs : 0.0;
+}
+
+/* Reorders a graph in place for benchAnf and reports the locality it gained.
+ * Returns the original id of each node, or NULL if memory runs out. */
+static uint64_t* reorderGraph(const char* name, Graph** graph, GraphOrder order)
+{
+    GraphLocality before;
+    GraphLocality after;
+    double start = now();
+    uint64_t* perm = graph_order(*graph, order);
+    uint64_t* ids = perm ? graph_order_invert(perm, (*graph)->numNodes) : NULL;
+    Graph* permuted = perm ? graph_permute(*graph, perm) : NULL;
+    double elapsed = now() - start;
+
+    free(perm);
+
+    if (!ids || !permuted || !graph_locality(*graph, &before) || !graph_locality(permuted, &after)) {
+        free(ids);
+        graph_free(permuted);
+        return NULL;
+    }
+
+    printf("{\"bench\": \"order\", \"graph\": \"%s\", \"nodes\": %llu, \"seconds\": %.4f, "
+           "\"gap_bits\": [%.3f, %.3f], \"distance\": [%.1f, %.1f], \"bandwidth\": [%llu, %llu], "
+           "\"near_fraction\": [%.4f, %.4f]}\n",
+           name, (unsigned long long)(*graph)->numNodes, elapsed, before.gapBits, after.gapBits, before.distance,
+           after.distance, (unsigned long long)before.bandwidth, (unsigned long long)after.bandwidth,
+           before.nearFraction, after.nearFraction);
+
+    graph_free(*graph);
+    *graph = permuted;
+
+    return ids;
+}
+
+/* HyperANF benchmark settings */
+typedef struct AnfBench {
+    unsigned short p;             /* Precision */
+    unsigned width;               /* Register width in bits */
+    GraphOrder order;             /* Node order applied first */
+    unsigned threads;             /* Worker threads, 0 for the CPU count */
+    bool allPlacements;           /* Run every placement instead of placement */
+    AnfPlacement placement;       /* Counter placement */
+    bool pin;                     /* Pin the worker threads */
+    AnfStrategy strategy;         /* Round strategy */
+    bool logRounds;               /* Log every round to stderr */
+    uint64_t incremental;         /* Arcs added to an incremental run, or 0 */
+} AnfBench;
+
+/* Runs HyperANF on a graph with one counter placement and reports
+ * throughput (and accuracy if small) */
+static void benchAnfPlacement(const char* name, const Graph* graph, const uint64_t* ids, const AnfBench* bench,
+                              AnfPlacement placement)
+{
+    static const char* const placementNames[] = {"default", "first-touch", "interleave", "partitioned"};
+    static const char* const strategyNames[] = {"auto", "dense", "sparse", "push", "full"};
+    AnfOptions options;
+    uint64_t rounds;
+
+    anf_options_init(&options);
+    options.p = bench->p;
+    options.registerWidth = bench->width;
+    options.threads = bench->threads;
+    options.nodeIds = ids;
+    options.placement = placement;
+    options.pinThreads = bench->pin;
+    options.strategy = bench->strategy;
+
+    if (bench->logRounds) {
+        options.onRound = anf_log_round_json;
+        options.onRoundArg = stderr;
+    }
+
+    double start = now();
+    uint64_t* nf = anf_run(graph, &options, &rounds);
+    double elapsed = now() - start;
+
+    if (!nf) {
+        fprintf(stderr, "HyperANF failed on %s graph\n", name);
+        return;
+    }
+
+    /* Partitioned placement pins the threads itself */
+    bool pinned = bench->pin || placement == ANF_PLACEMENT_PARTITIONED;
+
+    printf("{\"bench\": \"anf\", \"graph\": \"%s\", \"nodes\": %llu, \"edges\": %llu, \"p\": %u, \"width\": %u, "
+           "\"threads\": %u, \"placement\": \"%s\", \"pinned\": %s, \"strategy\": \"%s\", \"rounds\": %llu, "
+           "\"seconds\": %.4f, \"edges_per_s_per_round\": %.0f, \"peak_rss\": %llu",
+           name, (unsigned long long)graph->numNodes, (unsigned long long)graph->numEdges, bench->p, bench->width,
+           bench->threads, placementNames[placement], pinned ? "true" : "false",
+           strategyNames[bench->strategy], (unsigned long long)rounds,
+           elapsed, (double)graph->numEdges * (double)rounds / elapsed, (unsigned long long)peakRss());
+
+    if (graph->numNodes <= BENCH_MAX_EXACT_NODES) {
+        uint64_t exactRounds;
+        uint64_t* exact = exactNeighborhoodFunction(graph, &exactRounds);
+        double maxError = 0.0;
+
+        for (uint64_t t = 0; t < rounds || t < exactRounds; t++) {
+            double approx = (double)nf[t < rounds ? t : rounds - 1];
+            double truth = (double)exact[t < exactRounds ? t : exactRounds - 1];
+            double error = fabs(approx - truth) / truth;
+
+            if (error > maxError) maxError = error;
+        }
+
+        printf(", \"max_nf_rel_error\": %.4f, \"avg_distance\": %.4f, \"exact_avg_distance\": %.4f",
+               maxError, averageDistance(nf, rounds), averageDistance(exact, exactRounds));
+        free(exact);
+    }
+
+    printf("}\n");
+    fflush(stdout);
+    free(nf);
+}
+
+/* Runs HyperANF incrementally on a graph with every stride-th arc held
+ * back, adds those arcs in one batch and reports the time against a full
+ * run over the graph */
+static void benchIncremental(const char* name, const Graph* graph, const AnfBench* bench)
+{
+    uint64_t stride = graph->numEdges / bench->incremental > 0 ? graph->numEdges / bench->incremental : 1;
+    uint64_t* sources = (uint64_t*)malloc((graph->numEdges + 1) * sizeof(uint64_t));
+    uint64_t* targets = (uint64_t*)malloc((graph->numEdges + 1) * sizeof(uint64_t));
+    uint64_t kept = 0;
+    uint64_t held = graph->numEdges;
+
+    if (!sources || !targets) {
+        free(sources);
+        free(targets);
+        return;
+    }
+
+    /* Kept arcs fill the front of the arrays, held back ones the back */
+    for (uint64_t v = 0; v < graph->numNodes; v++) {
+        for (uint64_t e = graph->offsets[v]; e < graph->offsets[v + 1]; e++) {
+            uint64_t slot = e % stride == stride - 1 ? --held : kept++;
+
+            sources[slot] = v;
+            targets[slot] = graph->targets[e];
+        }
+    }
+
+    AnfOptions options;
+    AnfUpdateStats stats;
+    uint64_t fullRounds;
+    uint64_t rounds;
+
+    anf_options_init(&options);
+    options.p = bench->p;
+    options.registerWidth = bench->width;
+    options.threads = bench->threads;
+    options.strategy = bench->strategy;
+
+    Graph* base = graph_from_edges(graph->numNodes, kept, sources, targets);
+    double start = now();
+    AnfIncremental* incremental = base ? anf_incremental_init(base, &options) : NULL;
+    double initSeconds = now() - start;
+    bool added = incremental &&
+                 anf_incremental_add_arcs(incremental, graph->numEdges - kept, sources + kept, targets + kept, &stats);
+
+    start = now();
+    uint64_t* nf = anf_run(graph, &options, &fullRounds);
+    double fullSeconds = now() - start;
+
+    if (added && nf) {
+        const uint64_t* updated = anf_incremental_nf(incremental, &rounds);
+        bool same = rounds == fullRounds && memcmp(updated, nf, rounds * sizeof(uint64_t)) == 0;
+
+        printf("{\"bench\": \"incremental\", \"graph\": \"%s\", \"nodes\": %llu, \"edges\": %llu, \"added\": %llu, "
+               "\"init_seconds\": %.4f, \"update_seconds\": %.6f, \"full_seconds\": %.4f, \"active\": %llu, "
+               "\"modified\": %llu, \"rounds\": %llu, \"matches_full_run\": %s, \"peak_rss\": %llu}\n",
+               name, (unsigned long long)graph->numNodes, (unsigned long long)graph->numEdges,
+               (unsigned long long)(graph->numEdges - kept), initSeconds, stats.seconds, fullSeconds,
+               (unsigned long long)stats.active, (unsigned long long)stats.modified, (unsigned long long)stats.rounds,
+               same ? "true" : "false", (unsigned long long)peakRss());
+        fflush(stdout);
+    } else {
+        fprintf(stderr, "Incremental HyperANF failed on %s graph\n", name);
+    }
+
+    free(nf);
+    anf_incremental_free(incremental);
+    graph_free(base);
+    free(sources);
+    free(targets);
+}
+
+/* Runs HyperANF on a graph, reordered first unless the order is
+ * GRAPH_ORDER_NONE, with each placement asked for. Frees the graph. */
+static void benchAnf(const char* name, Graph* graph, const AnfBench* bench)
+{
+    uint64_t* ids = NULL;
+
+    if (!graph) {
+        fprintf(stderr, "Failed to generate %s graph\n", name);
+        return;
+    }
+
+    if (bench->order != GRAPH_ORDER_NONE && !(ids = reorderGraph(name, &graph, bench->order))) {
+        fprintf(stderr, "Failed to reorder %s graph\n", name);
+        graph_free(graph);
+        return;
+    }
+
+    if (bench->allPlacements) {
+        for (int placement = ANF_PLACEMENT_DEFAULT; placement <= ANF_PLACEMENT_PARTITIONED; placement++) {
+            benchAnfPlacement(name, graph, ids, bench, (AnfPlacement)placement);
+        }
+    } else {
+        benchAnfPlacement(name, graph, ids, bench, bench->placement);
+    }
+
+    if (bench->incremental > 0) {
+        benchIncremental(name, graph, bench);
+    }
+
+    free(ids);
+    graph_free(graph);
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t maxEdges = 1000000;
+    AnfBench bench = {10, 8, GRAPH_ORDER_NONE, 0, false, ANF_PLACEMENT_DEFAULT, false, ANF_STRATEGY_AUTO, false, 0};
+    bool runHll = true;
+    bool runAnf = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-edges") == 0 && i + 1 < argc) {
+            maxEdges = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            bench.threads = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--p") == 0 && i + 1 < argc) {
+            bench.p = (unsigned short)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+            bench.width = (unsigned)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc && graph_order_parse(argv[i + 1], &bench.order)) {
+            i++;
+        } else if (strcmp(argv[i], "--placement") == 0 && i + 1 < argc && strcmp(argv[i + 1], "all") == 0) {
+            bench.allPlacements = true;
+            i++;
+        } else if (strcmp(argv[i], "--placement") == 0 && i + 1 < argc &&
+                   anf_placement_parse(argv[i + 1], &bench.placement)) {
+            i++;
+        } else if (strcmp(argv[i], "--pin") == 0) {
+            bench.pin = true;
+        } else if (strcmp(argv[i], "--strategy") == 0 && i + 1 < argc &&
+                   anf_strategy_parse(argv[i + 1], &bench.strategy)) {
+            i++;
+        } else if (strcmp(argv[i], "--incremental") == 0 && i + 1 < argc) {
+            bench.incremental = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--skip-hll") == 0) {
+            runHll = false;
+        } else if (strcmp(argv[i], "--skip-anf") == 0) {
+            runAnf = false;
+        } else if (strcmp(argv[i], "--log-rounds") == 0) {
+            bench.logRounds = true;
+        } else {
+            fprintf(stderr, "usage: %s [--max-edges N] [--threads T] [--p P] [--width 5|6|8] "
+                    "[--order none|bfs|degree|community] [--placement first-touch|interleave|partitioned|all] "
+                    "[--pin] [--strategy auto|dense|sparse|push|full] [--incremental B] [--skip-hll] [--skip-anf] "
+                    "[--log-rounds]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("{\"bench\": \"info\", \"version\": \"%s\", \"kernel\": \"%s\", \"numa_nodes\": %u}\n", HLL_VERSION,
+           hll_kernel_name(), topo_node_count());
+
+    if (runHll) {
+        static const unsigned short precisions[] = {4, 8, 10, 12, 14, 16};
+
+        for (size_t k = 0; k < sizeof(precisions) / sizeof(precisions[0]); k++) {
+            unsigned short p = precisions[k];
+            uint64_t m = 1ULL << p;
+
+            benchAdd(p, false, 1000000);
+            benchAdd(p, true, 1000000);
+
+            /* Small sparse counters against each other and against dense ones */
+            benchMerge(p, false, false, 4 * m, 4 * m, 1000);
+            benchMerge(p, false, true, 4 * m, m / 64 + 1, 1000);
+            benchMerge(p, true, true, m / 64 + 1, m / 64 + 1, 1000);
+            benchCardinality(p, 1000);
+        }
+    }
+
+    if (runAnf) {
+        for (uint64_t edges = 10000; edges <= maxEdges; edges *= 10) {
+            unsigned scale = 0;
+            uint64_t side = (uint64_t)sqrt((double)edges / 4.0);
+
+            /* Average degree 16 for R-MAT, 8 for Erdos-Renyi, about 4 for grids */
+            while ((2ULL << scale) * 16 <= edges) {
+                scale++;
+            }
+
+            benchAnf("rmat", graph_rmat(scale, edges, 1), &bench);
+            benchAnf("erdos_renyi", graph_erdos_renyi(edges / 8, edges, 2), &bench);
+            benchAnf("grid", graph_grid(side, side), &bench);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,796 @@
+#include <string.h>
+#include <stdatomic.h>
+#include "hll_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HLL_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Mask of the high bit of each 6-bit field in a 48-bit word */
+#define FIELDS6_HIGH 0x820820820820ULL
+
+/* MurmurHash64A multiplier and shift */
+#define MURMUR_M 0xc6a4a7935bd1e995ULL
+#define MURMUR_R 47
+
+/* Portable byte max */
+static inline bool maxScalar(uint8_t* dst, const uint8_t* src, uint64_t n)
+{
+    bool changed = false;
+
+    for (uint64_t i = 0; i < n; i++) {
+        if (src[i] > dst[i]) {
+            dst[i] = src[i];
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+/* Builds 2^-r as a double by writing 1023 - r into the exponent field */
+static inline double inversePow2(uint8_t r)
+{
+    uint64_t bits = (uint64_t)(1023 - r) << 52;
+    double d;
+
+    memcpy(&d, &bits, sizeof(d));
+
+    return d;
+}
+
+/* Portable estimator statistics. Zeros are summed as 2^0 and subtracted
+ * at the end, which keeps the loop free of branches in the common case. */
+static inline void sumsScalar(const uint8_t* regs, uint64_t n, uint8_t maxRank, uint8_t matchRank,
+                              HllRegisterSums* sums)
+{
+    double acc[4] = {0.0, 0.0, 0.0, 0.0};
+    uint64_t zeros = 0;
+    uint64_t matches = 0;
+
+    for (uint64_t i = 0; i < n; i++) {
+        uint8_t r = regs[i];
+
+        zeros += r == 0;
+        matches += r == matchRank;
+
+        if (r <= maxRank) {
+            acc[i & 3] += inversePow2(r);
+        }
+    }
+
+    sums->inverseSum = (acc[0] + acc[1]) + (acc[2] + acc[3]) - (double)zeros;
+    sums->zeros = zeros;
+    sums->matches = matches;
+}
+
+/* Leading zero count that is 64 for 0, like lzcnt */
+static inline unsigned leadingZeros(uint64_t x)
+{
+#ifdef __GNUC__
+    return x ? (unsigned)__builtin_clzll(x) : 64;
+#else
+    unsigned n = 0;
+
+    while (n < 64 && !(x & (0x8000000000000000ULL >> n))) {
+        n++;
+    }
+
+    return n;
+#endif
+}
+
+/* MurmurHash64A of a single 4 or 8 byte key, unrolled for its length */
+static inline uint64_t murmurKey(uint64_t key, unsigned width, uint64_t seed)
+{
+    uint64_t h = seed ^ (width * MURMUR_M);
+
+    if (width == 8) {
+        key *= MURMUR_M;
+        key ^= key >> MURMUR_R;
+        key *= MURMUR_M;
+        h ^= key;
+    } else {
+        h ^= key;
+    }
+
+    h *= MURMUR_M;
+    h ^= h >> MURMUR_R;
+    h *= MURMUR_M;
+    h ^= h >> MURMUR_R;
+
+    return h;
+}
+
+/* Loads key i of a 4 or 8 byte key array */
+static inline uint64_t loadKey(const void* keys, uint64_t i, unsigned width)
+{
+    if (width == 8) {
+        return ((const uint64_t*)keys)[i];
+    }
+
+    return ((const uint32_t*)keys)[i];
+}
+
+/* Portable key hashing */
+static inline void hashScalar(const void* keys, uint64_t n, unsigned width, uint64_t seed, unsigned short p,
+                       uint64_t* indexes, uint8_t* ranks)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t h = murmurKey(loadKey(keys, i, width), width, seed);
+
+        indexes[i] = h >> (64 - p);
+        ranks[i] = (uint8_t)(leadingZeros(h << p) + 1);
+    }
+}
+
+/* Mask of the low bit of each width-bit field of a packed word */
+static inline uint64_t fieldsLow(unsigned width)
+{
+    switch (width) {
+    case 5: return 0x0084210842108421ULL;
+    case 6: return 0x0041041041041041ULL;
+    default: return 0x0101010101010101ULL;
+    }
+}
+
+/* Fieldwise max of two packed words, as in hll_max_packed6: the high bit
+ * of each field of lt is set where x < y. high has the high bit of each
+ * field set. Sets *grew if any field of x grew. */
+static inline uint64_t maxFields(uint64_t x, uint64_t y, uint64_t high, unsigned width, bool* grew)
+{
+    uint64_t lt = ((((x | high) - (y & ~high)) | (x ^ y)) ^ (x | ~y)) & high;
+    uint64_t mask = lt | (lt - (lt >> (width - 1)));
+
+    *grew = lt != 0;
+
+    return (x & ~mask) | (y & mask);
+}
+
+/* Portable packed max for one width; inlined with a constant width the
+ * masks fold */
+static inline bool maxPackedWidth(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width)
+{
+    uint64_t high = fieldsLow(width) << (width - 1);
+    uint64_t changed = 0;
+
+    for (uint64_t i = 0; i < words; i++) {
+        bool grew;
+
+        dst[i] = maxFields(dst[i], src[i], high, width, &grew);
+        changed |= grew;
+    }
+
+    return changed != 0;
+}
+
+/* Portable packed max */
+static bool maxPackedScalar(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width)
+{
+    switch (width) {
+    case 5: return maxPackedWidth(dst, src, words, 5);
+    case 6: return maxPackedWidth(dst, src, words, 6);
+    default: return maxPackedWidth(dst, src, words, 8);
+    }
+}
+
+#ifdef HLL_KERNELS_X86
+
+/* Low 64 bits of a * b for a constant b split into 32-bit halves; AVX2
+ * has no 64-bit multiply, so it takes three 32 x 32 -> 64 products */
+__attribute__((target("avx2")))
+static inline __m256i mul64Avx2(__m256i a, __m256i bLo, __m256i bHi)
+{
+    __m256i lo = _mm256_mul_epu32(a, bLo);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), bLo),
+                                     _mm256_mul_epu32(a, bHi));
+
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+/* AVX2 key hashing, four keys per vector, with lzcnt for the ranks
+ * (every CPU with AVX2 also has lzcnt) */
+__attribute__((target("avx2,lzcnt")))
+static inline void hashAvx2(const void* keys, uint64_t n, unsigned width, uint64_t seed, unsigned short p,
+                     uint64_t* indexes, uint8_t* ranks)
+{
+    const __m256i mLo = _mm256_set1_epi64x((long long)(MURMUR_M & 0xFFFFFFFFULL));
+    const __m256i mHi = _mm256_set1_epi64x((long long)(MURMUR_M >> 32));
+    const __m256i h0 = _mm256_set1_epi64x((long long)(seed ^ (width * MURMUR_M)));
+    uint64_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i k;
+        __m256i h;
+
+        if (width == 8) {
+            k = _mm256_loadu_si256((const __m256i*)((const uint64_t*)keys + i));
+            k = mul64Avx2(k, mLo, mHi);
+            k = _mm256_xor_si256(k, _mm256_srli_epi64(k, MURMUR_R));
+            k = mul64Avx2(k, mLo, mHi);
+        } else {
+            k = _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)((const uint32_t*)keys + i)));
+        }
+
+        h = mul64Avx2(_mm256_xor_si256(h0, k), mLo, mHi);
+        h = _mm256_xor_si256(h, _mm256_srli_epi64(h, MURMUR_R));
+        h = mul64Avx2(h, mLo, mHi);
+        h = _mm256_xor_si256(h, _mm256_srli_epi64(h, MURMUR_R));
+
+        /* Indexes go straight out; the ranks take one lzcnt per key */
+        _mm256_storeu_si256((__m256i*)(indexes + i), _mm256_srli_epi64(h, 64 - p));
+
+        uint64_t hashes[4];
+        _mm256_storeu_si256((__m256i*)hashes, _mm256_slli_epi64(h, p));
+
+        for (int j = 0; j < 4; j++) {
+            ranks[i + j] = (uint8_t)(_lzcnt_u64(hashes[j]) + 1);
+        }
+    }
+
+    hashScalar((const uint8_t*)keys + i * width, n - i, width, seed, p, indexes + i, ranks + i);
+}
+
+/* SSE2 byte max, 16 registers per step */
+__attribute__((target("sse2")))
+static inline bool maxSse2(uint8_t* dst, const uint8_t* src, uint64_t n)
+{
+    __m128i diff = _mm_setzero_si128();
+    uint64_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i mx = _mm_max_epu8(a, b);
+        __m128i d = _mm_xor_si128(mx, a);
+
+        /* Only write back blocks that changed so clean lines stay clean */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(d, _mm_setzero_si128())) != 0xFFFF) {
+            _mm_storeu_si128((__m128i*)(dst + i), mx);
+            diff = _mm_or_si128(diff, d);
+        }
+    }
+
+    bool changed = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF;
+
+    return maxScalar(dst + i, src + i, n - i) || changed;
+}
+
+/* AVX2 byte max, 32 registers per step */
+__attribute__((target("avx2")))
+static inline bool maxAvx2(uint8_t* dst, const uint8_t* src, uint64_t n)
+{
+    bool changed = false;
+    uint64_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i mx = _mm256_max_epu8(a, b);
+
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(mx, a)) != 0xFFFFFFFFU) {
+            _mm256_storeu_si256((__m256i*)(dst + i), mx);
+            changed = true;
+        }
+    }
+
+    return maxScalar(dst + i, src + i, n - i) || changed;
+}
+
+/* AVX-512BW byte max, 64 registers per step */
+__attribute__((target("avx512bw")))
+static inline bool maxAvx512(uint8_t* dst, const uint8_t* src, uint64_t n)
+{
+    bool changed = false;
+    uint64_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m512i a = _mm512_loadu_si512((const void*)(dst + i));
+        __m512i b = _mm512_loadu_si512((const void*)(src + i));
+        __mmask64 up = _mm512_cmpgt_epu8_mask(b, a);
+
+        if (up) {
+            _mm512_mask_storeu_epi8((void*)(dst + i), up, b);
+            changed = true;
+        }
+    }
+
+    return maxScalar(dst + i, src + i, n - i) || changed;
+}
+
+/* AVX2 estimator statistics. 2^-r is built directly as a double by
+ * writing 1023 - r into the exponent field, four registers per vector.
+ * Zeros are summed as 2^0 and subtracted at the end. */
+__attribute__((target("avx2,popcnt")))
+static inline void sumsAvx2(const uint8_t* regs, uint64_t n, uint8_t maxRank, uint8_t matchRank,
+                            HllRegisterSums* sums)
+{
+    const __m256i bias = _mm256_set1_epi64x(1023);
+    const __m256i match = _mm256_set1_epi8((char)matchRank);
+    const __m256i limit = _mm256_set1_epi8((char)maxRank);
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    uint64_t zeros = 0;
+    uint64_t matches = 0;
+    uint64_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(regs + i));
+
+        /* Registers above maxRank carry no weight; they are vanishingly
+         * rare, so hand such counters to the scalar kernel */
+        if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, limit)) != 0) {
+            sumsScalar(regs, n, maxRank, matchRank, sums);
+            return;
+        }
+
+        zeros += (uint64_t)__builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+        matches += (uint64_t)__builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, match)));
+
+        for (int k = 0; k < 32; k += 8) {
+            __m128i bytes = _mm_loadl_epi64((const __m128i*)(regs + i + k));
+            __m256i lo = _mm256_cvtepu8_epi64(bytes);
+            __m256i hi = _mm256_cvtepu8_epi64(_mm_srli_si128(bytes, 4));
+
+            acc0 = _mm256_add_pd(acc0, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, lo), 52)));
+            acc1 = _mm256_add_pd(acc1, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, hi), 52)));
+        }
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+
+    HllRegisterSums tail = {0.0, 0, 0};
+    if (i < n) {
+        sumsScalar(regs + i, n - i, maxRank, matchRank, &tail);
+    }
+
+    sums->inverseSum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) - (double)zeros + tail.inverseSum;
+    sums->zeros = zeros + tail.zeros;
+    sums->matches = matches + tail.matches;
+}
+
+/* AVX2 byte max for a constant n; counters narrower than a vector use SSE2 */
+__attribute__((target("avx2")))
+static inline bool maxAvx2Fixed(uint8_t* dst, const uint8_t* src, uint64_t n)
+{
+    return n < 32 ? maxSse2(dst, src, n) : maxAvx2(dst, src, n);
+}
+
+/* AVX-512BW byte max for a constant n, likewise */
+__attribute__((target("avx512bw")))
+static inline bool maxAvx512Fixed(uint8_t* dst, const uint8_t* src, uint64_t n)
+{
+    return n < 64 ? maxAvx2Fixed(dst, src, n) : maxAvx512(dst, src, n);
+}
+
+/* AVX2 packed max, four words at a time with the same broadword max as
+ * maxFields. x | ~y is folded into the andnot that masks lt. */
+__attribute__((target("avx2")))
+static bool maxPackedAvx2(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width)
+{
+    const __m256i high = _mm256_set1_epi64x((long long)(fieldsLow(width) << (width - 1)));
+    const __m128i shift = _mm_cvtsi32_si128((int)width - 1);
+    __m256i changed = _mm256_setzero_si256();
+    uint64_t i = 0;
+
+    for (; i + 4 <= words; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(dst + i));
+        __m256i y = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i diff = _mm256_sub_epi64(_mm256_or_si256(x, high), _mm256_andnot_si256(high, y));
+        __m256i lt = _mm256_andnot_si256(_mm256_xor_si256(_mm256_or_si256(diff, _mm256_xor_si256(x, y)),
+                                                          _mm256_andnot_si256(x, y)), high);
+        __m256i mask = _mm256_or_si256(lt, _mm256_sub_epi64(lt, _mm256_srl_epi64(lt, shift)));
+
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(_mm256_andnot_si256(mask, x),
+                                                                  _mm256_and_si256(mask, y)));
+        changed = _mm256_or_si256(changed, lt);
+    }
+
+    bool tail = i < words && maxPackedScalar(dst + i, src + i, words - i, width);
+
+    return !_mm256_testz_si256(changed, changed) || tail;
+}
+
+#endif /* HLL_KERNELS_X86 */
+
+/* Loads 6 bytes as a big-endian 48-bit word */
+static inline uint64_t load48(const uint8_t* p)
+{
+    return ((uint64_t)p[0] << 40) | ((uint64_t)p[1] << 32) | ((uint64_t)p[2] << 24) |
+           ((uint64_t)p[3] << 16) | ((uint64_t)p[4] << 8) | (uint64_t)p[5];
+}
+
+/* Stores a 48-bit word as 6 big-endian bytes */
+static inline void store48(uint8_t* p, uint64_t w)
+{
+    p[0] = (uint8_t)(w >> 40);
+    p[1] = (uint8_t)(w >> 32);
+    p[2] = (uint8_t)(w >> 24);
+    p[3] = (uint8_t)(w >> 16);
+    p[4] = (uint8_t)(w >> 8);
+    p[5] = (uint8_t)w;
+}
+
+/* Broadword max over eight 6-bit fields at a time, as in HyperBall. The
+ * high bit of each field of lt is set where x < y; spreading it over the
+ * field gives a mask selecting y. */
+static inline uint64_t maxPacked6(uint8_t* dst, const uint8_t* src, uint64_t numRegisters, uint64_t* histogram)
+{
+    uint64_t changed = 0;
+
+    for (uint64_t g = 0; g < numRegisters / 8; g++) {
+        uint64_t x = load48(dst + 6*g);
+        uint64_t y = load48(src + 6*g);
+        uint64_t lt = ((((x | FIELDS6_HIGH) - (y & ~FIELDS6_HIGH)) | (x ^ y)) ^ (x | ~y)) & FIELDS6_HIGH;
+
+        if (lt == 0) {
+            continue;
+        }
+
+        uint64_t mask = (lt >> 5) * 63;
+        store48(dst + 6*g, (x & ~mask) | (y & mask));
+
+        /* Walk the changed fields to keep the histogram in sync */
+        for (uint64_t bits = lt; bits != 0; bits &= bits - 1) {
+            unsigned shift = (unsigned)__builtin_ctzll(bits) - 5;
+
+            if (histogram) {
+                histogram[(x >> shift) & 63]--;
+                histogram[(y >> shift) & 63]++;
+            }
+
+            changed++;
+        }
+    }
+
+    return changed;
+}
+
+/* Defines the fixed-size kernels of one instruction set for 2^P registers */
+#define DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, P) \
+    TARGET static bool NAME##Max##P(uint8_t* dst, const uint8_t* src) \
+    { \
+        return MAX(dst, src, 1ULL << (P)); \
+    } \
+    TARGET static void NAME##Sums##P(const uint8_t* regs, HllRegisterSums* sums) \
+    { \
+        SUMS(regs, 1ULL << (P), 64 - (P), (P) + 1, sums); \
+    } \
+    TARGET static uint64_t NAME##MaxPacked6##P(uint8_t* dst, const uint8_t* src, uint64_t* histogram) \
+    { \
+        return maxPacked6(dst, src, 1ULL << (P), histogram); \
+    } \
+    TARGET static void NAME##Hash##P(const void* keys, uint64_t n, unsigned width, uint64_t seed, \
+                                     uint64_t* indexes, uint8_t* ranks) \
+    { \
+        HASH(keys, n, width, seed, (P), indexes, ranks); \
+    }
+
+/* Table entry of the fixed-size kernels of one instruction set for 2^P registers */
+#define FIXED_ENTRY(NAME, P) {P, NAME##Max##P, NAME##Sums##P, NAME##MaxPacked6##P, NAME##Hash##P}
+
+/* Defines the fixed-size kernels of one instruction set for every
+ * precision, and their table indexed by p - HLL_FIXED_MIN_P */
+#define DEFINE_FIXED_TABLE(NAME, TARGET, MAX, SUMS, HASH) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 4) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 5) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 6) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 7) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 8) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 9) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 10) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 11) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 12) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 13) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 14) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 15) \
+    DEFINE_FIXED(NAME, TARGET, MAX, SUMS, HASH, 16) \
+    static const HllFixedKernels NAME##Fixed[HLL_FIXED_MAX_P - HLL_FIXED_MIN_P + 1] = { \
+        FIXED_ENTRY(NAME, 4), FIXED_ENTRY(NAME, 5), FIXED_ENTRY(NAME, 6), FIXED_ENTRY(NAME, 7), \
+        FIXED_ENTRY(NAME, 8), FIXED_ENTRY(NAME, 9), FIXED_ENTRY(NAME, 10), FIXED_ENTRY(NAME, 11), \
+        FIXED_ENTRY(NAME, 12), FIXED_ENTRY(NAME, 13), FIXED_ENTRY(NAME, 14), FIXED_ENTRY(NAME, 15), \
+        FIXED_ENTRY(NAME, 16), \
+    };
+
+DEFINE_FIXED_TABLE(scalar, , maxScalar, sumsScalar, hashScalar)
+#ifdef HLL_KERNELS_X86
+DEFINE_FIXED_TABLE(sse2, __attribute__((target("sse2"))), maxSse2, sumsScalar, hashScalar)
+DEFINE_FIXED_TABLE(avx2, __attribute__((target("avx2,popcnt,lzcnt"))), maxAvx2Fixed, sumsAvx2, hashAvx2)
+DEFINE_FIXED_TABLE(avx512, __attribute__((target("avx512bw,popcnt,lzcnt"))), maxAvx512Fixed, sumsAvx2, hashAvx2)
+#endif
+
+/* Estimator statistics kernel signature */
+typedef void (*hll_sums_fn)(const uint8_t* regs, uint64_t n, uint8_t maxRank, uint8_t matchRank,
+                            HllRegisterSums* sums);
+
+/* Key hashing kernel signature */
+typedef void (*hll_hash_fn)(const void* keys, uint64_t n, unsigned width, uint64_t seed, unsigned short p,
+                            uint64_t* indexes, uint8_t* ranks);
+
+/* Packed register max kernel signature */
+typedef bool (*hll_max_packed_fn)(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width);
+
+/* Byte kernels, fastest last */
+typedef struct Kernel {
+    const char* name;
+    hll_max_u8_fn max;
+    hll_sums_fn sums;
+    hll_hash_fn hash;
+    hll_max_packed_fn maxPacked;
+    const HllFixedKernels* fixed;
+} Kernel;
+
+static const Kernel kernels[] = {
+    {"scalar", maxScalar, sumsScalar, hashScalar, maxPackedScalar, scalarFixed},
+#ifdef HLL_KERNELS_X86
+    {"sse2", maxSse2, sumsScalar, hashScalar, maxPackedScalar, sse2Fixed},
+    {"avx2", maxAvx2, sumsAvx2, hashAvx2, maxPackedAvx2, avx2Fixed},
+    {"avx512bw", maxAvx512, sumsAvx2, hashAvx2, maxPackedAvx2, avx512Fixed},
+#endif
+};
+
+#define NUM_KERNELS (sizeof(kernels)/sizeof(kernels[0]))
+
+/* Kernel in use, resolved on first call. Atomic because worker threads
+ * may race to resolve it; they all pick the same kernel. */
+static const Kernel* _Atomic activeKernel = NULL;
+
+/* Checks whether the CPU can run a kernel */
+static bool isSupported(const Kernel* kernel)
+{
+#ifdef HLL_KERNELS_X86
+    __builtin_cpu_init();
+
+    if (strcmp(kernel->name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if (strcmp(kernel->name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(kernel->name, "avx512bw") == 0) return __builtin_cpu_supports("avx512bw");
+#endif
+
+    return strcmp(kernel->name, "scalar") == 0;
+}
+
+/* Picks the fastest supported kernel */
+static const Kernel* resolveKernel(void)
+{
+    const Kernel* kernel = atomic_load_explicit(&activeKernel, memory_order_relaxed);
+
+    if (kernel == NULL) {
+        uint64_t k;
+
+        for (k = NUM_KERNELS; k > 0; k--) {
+            if (isSupported(&kernels[k - 1])) {
+                break;
+            }
+        }
+
+        kernel = &kernels[k > 0 ? k - 1 : 0];
+        atomic_store_explicit(&activeKernel, kernel, memory_order_relaxed);
+    }
+
+    return kernel;
+}
+
+bool hll_max_u8(uint8_t* dst, const uint8_t* src, uint64_t n)
+{
+    return resolveKernel()->max(dst, src, n);
+}
+
+void hll_register_sums(const uint8_t* regs, uint64_t n, uint8_t maxRank, uint8_t matchRank,
+                       HllRegisterSums* sums)
+{
+    resolveKernel()->sums(regs, n, maxRank, matchRank, sums);
+}
+
+void hll_hash_keys(const void* keys, uint64_t n, unsigned width, uint64_t seed, unsigned short p,
+                   uint64_t* indexes, uint8_t* ranks)
+{
+    resolveKernel()->hash(keys, n, width, seed, p, indexes, ranks);
+}
+
+bool hll_max_packed(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width)
+{
+    return resolveKernel()->maxPacked(dst, src, words, width);
+}
+
+/* Raises one byte register to at least value with a CAS loop */
+static inline bool atomicMaxByte(uint8_t* dst, uint8_t value)
+{
+    _Atomic uint8_t* reg = (_Atomic uint8_t*)dst;
+    uint8_t old = atomic_load_explicit(reg, memory_order_relaxed);
+
+    while (old < value) {
+        if (atomic_compare_exchange_weak_explicit(reg, &old, value, memory_order_relaxed, memory_order_relaxed)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Bytewise unsigned max of two words. The high bit of each byte of ge
+ * tells whether a >= b in that byte: the low 7 bits are compared by a
+ * subtraction that cannot borrow across bytes, the high bits directly. */
+static inline uint64_t maxBytes(uint64_t a, uint64_t b)
+{
+    const uint64_t high = 0x8080808080808080ULL;
+    uint64_t low = (a | high) - (b & ~high);
+    uint64_t ge = ((a & ~b) | (~(a ^ b) & low)) & high;
+    uint64_t mask = (ge >> 7) * 0xFF;
+
+    return (a & mask) | (b & ~mask);
+}
+
+bool hll_atomic_max_u8(uint8_t* dst, const uint8_t* src, uint64_t n)
+{
+    bool changed = false;
+    uint64_t i = 0;
+
+    /* Bytes up to the first aligned word, then whole words with one CAS
+     * each, then the tail */
+    for (; i < n && ((uintptr_t)(dst + i) & 7) != 0; i++) {
+        changed |= atomicMaxByte(dst + i, src[i]);
+    }
+
+    for (; i + 8 <= n; i += 8) {
+        _Atomic uint64_t* word = (_Atomic uint64_t*)(dst + i);
+        uint64_t old = atomic_load_explicit(word, memory_order_relaxed);
+        uint64_t value;
+
+        memcpy(&value, src + i, sizeof(value));
+
+        for (uint64_t max = maxBytes(old, value); max != old; max = maxBytes(old, value)) {
+            if (atomic_compare_exchange_weak_explicit(word, &old, max, memory_order_relaxed, memory_order_relaxed)) {
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    for (; i < n; i++) {
+        changed |= atomicMaxByte(dst + i, src[i]);
+    }
+
+    return changed;
+}
+
+/* Atomic packed max for one width */
+static inline bool atomicMaxPacked(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width)
+{
+    uint64_t high = fieldsLow(width) << (width - 1);
+    bool changed = false;
+
+    for (uint64_t i = 0; i < words; i++) {
+        _Atomic uint64_t* word = (_Atomic uint64_t*)(dst + i);
+        uint64_t old = atomic_load_explicit(word, memory_order_relaxed);
+        bool grew;
+
+        for (uint64_t max = maxFields(old, src[i], high, width, &grew); grew;
+             max = maxFields(old, src[i], high, width, &grew)) {
+            if (atomic_compare_exchange_weak_explicit(word, &old, max, memory_order_relaxed, memory_order_relaxed)) {
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    return changed;
+}
+
+bool hll_atomic_max_packed(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width)
+{
+    switch (width) {
+    case 5: return atomicMaxPacked(dst, src, words, 5);
+    case 6: return atomicMaxPacked(dst, src, words, 6);
+    default: return atomicMaxPacked(dst, src, words, 8);
+    }
+}
+
+/* Packed register difference count for one width: adding the field mask
+ * minus its high bit to the low bits of x ^ y carries into the high bit of
+ * each nonzero field */
+static inline uint64_t countDiffPacked(const uint64_t* a, const uint64_t* b, uint64_t words, unsigned width)
+{
+    uint64_t high = fieldsLow(width) << (width - 1);
+    uint64_t low = fieldsLow(width) * ((1ULL << (width - 1)) - 1);
+    uint64_t n = 0;
+
+    for (uint64_t i = 0; i < words; i++) {
+        uint64_t x = a[i] ^ b[i];
+
+        n += (uint64_t)__builtin_popcountll((x | ((x & low) + low)) & high);
+    }
+
+    return n;
+}
+
+uint64_t hll_count_diff_packed(const uint64_t* a, const uint64_t* b, uint64_t words, unsigned width)
+{
+    switch (width) {
+    case 5: return countDiffPacked(a, b, words, 5);
+    case 6: return countDiffPacked(a, b, words, 6);
+    default: return countDiffPacked(a, b, words, 8);
+    }
+}
+
+/* Number of registers unpacked per block by hll_register_sums_packed; a
+ * whole number of words at every width */
+#define UNPACK_BLOCK 960
+
+/* Unpacks the registers of words into bytes */
+static inline void unpackWords(const uint64_t* words, uint64_t numWords, unsigned width, uint8_t* out)
+{
+    uint64_t perWord = 64 / width;
+    uint64_t mask = (1ULL << width) - 1;
+
+    for (uint64_t i = 0; i < numWords; i++) {
+        uint64_t word = words[i];
+
+        for (uint64_t j = 0; j < perWord; j++, word >>= width) {
+            out[i * perWord + j] = (uint8_t)(word & mask);
+        }
+    }
+}
+
+void hll_register_sums_packed(const uint64_t* words, uint64_t n, unsigned width, uint8_t maxRank,
+                              uint8_t matchRank, HllRegisterSums* sums)
+{
+    uint8_t block[UNPACK_BLOCK + 64];
+    uint64_t perWord = 64 / width;
+    const Kernel* kernel = resolveKernel();
+
+    sums->inverseSum = 0.0;
+    sums->zeros = 0;
+    sums->matches = 0;
+
+    /* The statistics add up, so unpack a block at a time into bytes and
+     * run the byte kernel over each */
+    for (uint64_t i = 0; i < n; i += UNPACK_BLOCK) {
+        uint64_t count = n - i < UNPACK_BLOCK ? n - i : UNPACK_BLOCK;
+        uint64_t numWords = (count + perWord - 1) / perWord;
+        HllRegisterSums part;
+
+        switch (width) {
+        case 5: unpackWords(words + i / perWord, numWords, 5, block); break;
+        case 6: unpackWords(words + i / perWord, numWords, 6, block); break;
+        default: unpackWords(words + i / perWord, numWords, 8, block); break;
+        }
+
+        kernel->sums(block, count, maxRank, matchRank, &part);
+        sums->inverseSum += part.inverseSum;
+        sums->zeros += part.zeros;
+        sums->matches += part.matches;
+    }
+}
+
+const HllFixedKernels* hll_fixed_kernels(unsigned short p)
+{
+    if (p < HLL_FIXED_MIN_P || p > HLL_FIXED_MAX_P) {
+        return NULL;
+    }
+
+    return &resolveKernel()->fixed[p - HLL_FIXED_MIN_P];
+}
+
+const char* hll_kernel_name(void)
+{
+    return resolveKernel()->name;
+}
+
+bool hll_kernel_select(const char* name)
+{
+    for (uint64_t k = 0; k < NUM_KERNELS; k++) {
+        if (strcmp(kernels[k].name, name) == 0 && isSupported(&kernels[k])) {
+            atomic_store(&activeKernel, &kernels[k]);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint64_t hll_max_packed6(uint8_t* dst, const uint8_t* src, uint64_t numRegisters, uint64_t* histogram)
+{
+    return maxPacked6(dst, src, numRegisters, histogram);
+}
@@ -0,0 +1,94 @@
+#ifndef HLL_KERNELS_H
+#define HLL_KERNELS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Register-wise max of byte registers: dst[i] = max(dst[i], src[i]).
+ * Returns true if any register of dst changed. */
+typedef bool (*hll_max_u8_fn)(uint8_t* dst, const uint8_t* src, uint64_t n);
+
+/* Max of n byte registers using the fastest kernel the CPU supports */
+bool hll_max_u8(uint8_t* dst, const uint8_t* src, uint64_t n);
+
+/* Max of n byte registers that other threads may be raising at the same
+ * time with this function: each aligned word of dst holding a register
+ * below src is raised with one atomic compare-and-swap. Returns true if
+ * any register of dst changed. */
+bool hll_atomic_max_u8(uint8_t* dst, const uint8_t* src, uint64_t n);
+
+/* Register statistics used by the cardinality estimator */
+typedef struct HllRegisterSums {
+    double inverseSum;            /* Sum of 2^-r over registers with 1 <= r <= maxRank */
+    uint64_t zeros;               /* Number of registers equal to 0 */
+    uint64_t matches;             /* Number of registers equal to matchRank */
+} HllRegisterSums;
+
+/* Computes the estimator statistics of n byte registers in one pass */
+void hll_register_sums(const uint8_t* regs, uint64_t n, uint8_t maxRank, uint8_t matchRank,
+                       HllRegisterSums* sums);
+
+/* Max of numRegisters 6-bit registers packed the way hll.c packs dense
+ * counters, eight registers per 48-bit word. numRegisters must be a
+ * multiple of 8. If histogram is not NULL it is updated for every changed
+ * register. Returns the number of registers of dst that changed. */
+uint64_t hll_max_packed6(uint8_t* dst, const uint8_t* src, uint64_t numRegisters, uint64_t* histogram);
+
+/* Packed register words: 64 / width registers of width bits (5, 6 or 8)
+ * in each 64-bit word, register i of a word in bits i * width and up. The
+ * bits left over at the top of a word are zero. */
+
+/* Register-wise max of words of packed registers. Returns true if any
+ * register of dst changed. */
+bool hll_max_packed(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width);
+
+/* Max of words of packed registers that other threads may be raising at
+ * the same time with this function, one atomic compare-and-swap per word.
+ * Returns true if any register of dst changed. */
+bool hll_atomic_max_packed(uint64_t* dst, const uint64_t* src, uint64_t words, unsigned width);
+
+/* Counts the registers that differ between two runs of words of packed
+ * registers */
+uint64_t hll_count_diff_packed(const uint64_t* a, const uint64_t* b, uint64_t words, unsigned width);
+
+/* Computes the estimator statistics of the first n packed registers */
+void hll_register_sums_packed(const uint64_t* words, uint64_t n, unsigned width, uint8_t maxRank,
+                              uint8_t matchRank, HllRegisterSums* sums);
+
+/* Hashes n keys of width 4 or 8 bytes with MurmurHash64A, exactly as
+ * hll_add hashes their in-memory bytes, and splits each hash into a
+ * register index (the first p bits) and a rank (the position of the first
+ * set bit in the remaining bits) */
+void hll_hash_keys(const void* keys, uint64_t n, unsigned width, uint64_t seed, unsigned short p,
+                   uint64_t* indexes, uint8_t* ranks);
+
+/* Kernels specialized for one precision p: the number of registers (2^p),
+ * the estimator ranks and the index and rank shifts are compile-time
+ * constants, so the loops unroll and have no tails. They match
+ * hll_max_u8(dst, src, 2^p), hll_register_sums(regs, 2^p, 64 - p, p + 1,
+ * sums), hll_max_packed6(dst, src, 2^p, histogram) and
+ * hll_hash_keys(keys, n, width, seed, p, indexes, ranks). */
+typedef struct HllFixedKernels {
+    unsigned short p;             /* 2^p = number of registers */
+    bool (*max)(uint8_t* dst, const uint8_t* src);
+    void (*sums)(const uint8_t* regs, HllRegisterSums* sums);
+    uint64_t (*maxPacked6)(uint8_t* dst, const uint8_t* src, uint64_t* histogram);
+    void (*hash)(const void* keys, uint64_t n, unsigned width, uint64_t seed, uint64_t* indexes, uint8_t* ranks);
+} HllFixedKernels;
+
+/* Smallest and largest precisions with fixed-size kernels */
+#define HLL_FIXED_MIN_P 4
+#define HLL_FIXED_MAX_P 16
+
+/* Gets the fixed-size kernels for precision p in the instruction set in
+ * use, or NULL if p is out of range */
+const HllFixedKernels* hll_fixed_kernels(unsigned short p);
+
+/* Gets the name of the byte kernels in use ("scalar", "sse2", "avx2", "avx512bw") */
+const char* hll_kernel_name(void);
+
+/* Forces a set of byte kernels by name, e.g. for benchmarking. Returns false if
+ * the kernel is unknown or not supported by this CPU. */
+bool hll_kernel_select(const char* name);
+
+#endif /* HLL_KERNELS_H */
@@ -7,211 +7,1454 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "hll.h"
+#include "hll_kernels.h"
+#include "graph.h"
+#include "graph_io.h"
+#include "cgraph.h"
+#include "anf.h"
+#include "hll_array.h"
+#include "graph_order.h"
 #include <string.h>
 
-static PyObject* py_hyperanf(PyObject* self, PyObject* args) {
-    unsigned short p;
-    PyArrayObject* adjacency_matrix;
-    if (!PyArg_ParseTuple(args, "HO", &p, &adjacency_matrix)) {
+// Builds a CSR graph from a dense square adjacency matrix (nonzero = arc)
+static Graph* graph_from_dense(PyObject* obj) {
+    if (!PyArray_Check(obj) || PyArray_NDIM((PyArrayObject*)obj) != 2) {
+        PyErr_SetString(PyExc_ValueError, "Expected a 2D numpy array");
         return NULL;
     }
 
-    if (!PyArray_Check(adjacency_matrix) || PyArray_NDIM(adjacency_matrix) != 2) {
-        PyErr_SetString(PyExc_ValueError, "Expected a 2D numpy array");
+    PyArrayObject* adjacency_matrix = (PyArrayObject*)PyArray_FROMANY(obj, NPY_UINT8, 2, 2,
+                                                                     NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (!adjacency_matrix) {
         return NULL;
     }
 
     npy_intp* dims = PyArray_DIMS(adjacency_matrix);
     npy_intp N = dims[0];
     if (N != dims[1]) {
+        Py_DECREF(adjacency_matrix);
         PyErr_SetString(PyExc_ValueError, "Expected a square adjacency matrix");
         return NULL;
     }
 
-    // Initialize an array of N HyperLogLog counters
-    HyperLogLog** hll_array = (HyperLogLog**)malloc(N * sizeof(HyperLogLog*));
-    if (!hll_array) {
+    // One pass to count arcs, one to fill the successor lists
+    const uint8_t* data = (const uint8_t*)PyArray_DATA(adjacency_matrix);
+    uint64_t edges = 0;
+    for (npy_intp k = 0; k < N * N; k++) {
+        edges += data[k] != 0;
+    }
+
+    Graph* graph = graph_init((uint64_t)N, edges);
+    if (!graph) {
+        Py_DECREF(adjacency_matrix);
         PyErr_SetString(PyExc_RuntimeError, "Memory allocation failed");
         return NULL;
     }
+
+    uint64_t e = 0;
     for (npy_intp i = 0; i < N; i++) {
-        hll_array[i] = hll_init(p, 12345, false, 0, 0);
-        if (!hll_array[i]) {
-            PyErr_SetString(PyExc_RuntimeError, "Failed to initialize HyperLogLog counter");
-            return NULL;
+        graph->offsets[i] = e;
+        for (npy_intp j = 0; j < N; j++) {
+            if (data[i * N + j]) {
+                graph->targets[e++] = (uint64_t)j;
+            }
         }
-        // Each node adds itself
-        hll_add(hll_array[i], (const uint8_t*)&i, sizeof(i));
     }
+    graph->offsets[N] = e;
 
-    PyObject* neighborhood_sizes = PyList_New(0);
-    bool changed;
-    do {
-        changed = false;
-        uint64_t total_cardinality = 0;
-        HyperLogLog** new_hll_array = (HyperLogLog**)malloc(N * sizeof(HyperLogLog*));
-        for (npy_intp i = 0; i < N; i++) {
-            new_hll_array[i] = hll_init(p, 12345, false, 0, 0);
-            if (!new_hll_array[i]) {
-                PyErr_SetString(PyExc_RuntimeError, "Failed to initialize HyperLogLog counter");
+    Py_DECREF(adjacency_matrix);
+    return graph;
+}
+
+// Builds a CSR graph from (offsets, targets) arrays or from a scipy.sparse
+// csr_matrix. The graph points into *offsets_out / *targets_out, which the
+// caller must release after the graph is freed.
+static Graph* graph_from_csr(PyObject* first, PyObject* second,
+                             PyArrayObject** offsets_out, PyArrayObject** targets_out) {
+    PyObject* indptr;
+    PyObject* indices;
+
+    if (second == NULL || second == Py_None) {
+        // Anything exposing indptr/indices, i.e. a scipy.sparse csr_matrix
+        indptr = PyObject_GetAttrString(first, "indptr");
+        indices = indptr ? PyObject_GetAttrString(first, "indices") : NULL;
+        if (!indptr || !indices) {
+            Py_XDECREF(indptr);
+            PyErr_SetString(PyExc_TypeError, "Expected (offsets, targets) arrays or a scipy.sparse csr_matrix");
+            return NULL;
+        }
+
+        PyObject* shape = PyObject_GetAttrString(first, "shape");
+        if (shape) {
+            Py_ssize_t rows = PyLong_AsSsize_t(PyTuple_GetItem(shape, 0));
+            Py_ssize_t cols = PyLong_AsSsize_t(PyTuple_GetItem(shape, 1));
+            Py_DECREF(shape);
+            if (rows != cols) {
+                Py_DECREF(indptr);
+                Py_DECREF(indices);
+                PyErr_SetString(PyExc_ValueError, "Expected a square adjacency matrix");
                 return NULL;
             }
-            hll_merge(new_hll_array[i], hll_array[i]);
-            for (npy_intp j = 0; j < N; j++) {
-                uint8_t value = *(uint8_t*)PyArray_GETPTR2(adjacency_matrix, i, j);
-                if (value) {
-                    hll_merge(new_hll_array[i], hll_array[j]);
-                }
-            }
-            uint64_t prev_cardinality = hll_cardinality(hll_array[i]);
-            uint64_t new_cardinality = hll_cardinality(new_hll_array[i]);
-            if (prev_cardinality != new_cardinality) {
-                changed = true;
-            }
-            total_cardinality += new_cardinality;
         }
+        PyErr_Clear();
+    } else {
+        Py_INCREF(first);
+        Py_INCREF(second);
+        indptr = first;
+        indices = second;
+    }
+
+    *offsets_out = (PyArrayObject*)PyArray_FROMANY(indptr, NPY_UINT64, 1, 1,
+                                                   NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    *targets_out = (PyArrayObject*)PyArray_FROMANY(indices, NPY_UINT64, 1, 1,
+                                                   NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    Py_DECREF(indptr);
+    Py_DECREF(indices);
+
+    if (!*offsets_out || !*targets_out) {
+        Py_XDECREF(*offsets_out);
+        Py_XDECREF(*targets_out);
+        return NULL;
+    }
+
+    npy_intp num_offsets = PyArray_DIM(*offsets_out, 0);
+    uint64_t* offsets = (uint64_t*)PyArray_DATA(*offsets_out);
+    if (num_offsets < 1 || offsets[num_offsets - 1] != (uint64_t)PyArray_DIM(*targets_out, 0)) {
+        Py_DECREF(*offsets_out);
+        Py_DECREF(*targets_out);
+        PyErr_SetString(PyExc_ValueError, "offsets[-1] must equal the number of targets");
+        return NULL;
+    }
+
+    Graph* graph = graph_wrap((uint64_t)(num_offsets - 1), offsets, (uint64_t*)PyArray_DATA(*targets_out));
+    if (!graph || !graph_validate(graph)) {
+        graph_free(graph);
+        Py_DECREF(*offsets_out);
+        Py_DECREF(*targets_out);
+        PyErr_SetString(PyExc_ValueError, "Invalid CSR graph: offsets must be nondecreasing and targets < N");
+        return NULL;
+    }
+
+    return graph;
+}
 
-        PyList_Append(neighborhood_sizes, PyLong_FromUnsignedLongLong(total_cardinality));
+// Round callback forwarding the stats of each round to a Python callable as
+// a dict. Returning false (on an exception) stops the run.
+static bool call_round_callback(const AnfRoundStats* stats, void* arg) {
+    PyGILState_STATE gil = PyGILState_Ensure();
+    PyObject* result = NULL;
+    PyObject* dict = Py_BuildValue("{s:K,s:d,s:O,s:O,s:K,s:K,s:K,s:K,s:K,s:K}",
+                                   "round", (unsigned long long)stats->round,
+                                   "seconds", stats->seconds,
+                                   "sparse", stats->sparse ? Py_True : Py_False,
+                                   "push", stats->push ? Py_True : Py_False,
+                                   "active", (unsigned long long)stats->active,
+                                   "modified", (unsigned long long)stats->modified,
+                                   "merges", (unsigned long long)stats->merges,
+                                   "registers_changed", (unsigned long long)stats->registersChanged,
+                                   "bytes_touched", (unsigned long long)stats->bytesTouched,
+                                   "neighborhood", (unsigned long long)stats->neighborhood);
+    if (dict) {
+        result = PyObject_CallOneArg((PyObject*)arg, dict);
+        Py_DECREF(dict);
+    }
+    Py_XDECREF(result);
+    PyGILState_Release(gil);
+    return result != NULL;
+}
+
+// Options of a HyperANF run besides p and the seed. Unused paths are NULL.
+typedef struct {
+    unsigned int threads;         // Worker threads (0 = one per CPU)
+    const char* counter_path;     // Keep the counters in this memory-mapped file
+    PyObject* callback;           // Called with a dict of statistics after each round, or NULL/None
+    const char* checkpoint_path;  // Write a checkpoint here every checkpoint_rounds rounds
+    unsigned int checkpoint_rounds;
+    const char* resume_path;      // Carry on from this checkpoint
+    unsigned int register_width;  // Bits per register: 8, or 6 or 5 packed
+    const char* order;            // Reorder the nodes first ("bfs", "degree" or "community")
+    const char* placement;        // NUMA placement of the counters ("first-touch", "interleave", "partitioned")
+    int pin_threads;              // Pin the worker threads node by node
+    const char* strategy;         // How rounds pick the counters to recompute ("auto", "dense", ...)
+} RunArgs;
+
+// Runs HyperANF over a CSR graph (or, if graph is NULL, a compressed graph)
+// without holding the GIL. A CSR graph may be reordered first; its nodes are
+// seeded with their original ids, so the result does not depend on the order.
+// Returns a malloc'd array holding the neighborhood
+// function N(0), N(1), ..., N(T), where round T is the first round in which
+// no counter changed, and stores T + 1 in *rounds.
+static uint64_t* neighborhood_function(const Graph* graph, const CompressedGraph* compressed,
+                                       unsigned short p, uint64_t seed, const RunArgs* args,
+                                       Py_ssize_t* rounds) {
+    PyObject* callback = args->callback == Py_None ? NULL : args->callback;
+    if (p < 4 || p > 16) {
+        PyErr_SetString(PyExc_ValueError, "p must be between 4 and 16");
+        return NULL;
+    }
+    if (args->register_width != 5 && args->register_width != 6 && args->register_width != 8) {
+        PyErr_SetString(PyExc_ValueError, "register_width must be 5, 6 or 8");
+        return NULL;
+    }
+    if (callback && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return NULL;
+    }
+    GraphOrder order = GRAPH_ORDER_NONE;
+    if (args->order && !graph_order_parse(args->order, &order)) {
+        PyErr_SetString(PyExc_ValueError, "order must be 'none', 'bfs', 'degree' or 'community'");
+        return NULL;
+    }
+    AnfPlacement placement = ANF_PLACEMENT_DEFAULT;
+    if (args->placement && !anf_placement_parse(args->placement, &placement)) {
+        PyErr_SetString(PyExc_ValueError, "placement must be 'default', 'first-touch', 'interleave' or 'partitioned'");
+        return NULL;
+    }
+    AnfStrategy strategy = ANF_STRATEGY_AUTO;
+    if (args->strategy && !anf_strategy_parse(args->strategy, &strategy)) {
+        PyErr_SetString(PyExc_ValueError, "strategy must be 'auto', 'dense', 'sparse', 'push' or 'full'");
+        return NULL;
+    }
+
+    AnfOptions options;
+    anf_options_init(&options);
+    options.p = p;
+    options.seed = seed;
+    options.threads = args->threads;
+    options.counterPath = args->counter_path;
+    options.checkpointPath = args->checkpoint_path;
+    options.checkpointRounds = args->checkpoint_rounds;
+    options.resumePath = args->resume_path;
+    options.registerWidth = args->register_width;
+    options.placement = placement;
+    options.pinThreads = args->pin_threads != 0;
+    options.strategy = strategy;
+    if (callback) {
+        options.onRound = call_round_callback;
+        options.onRoundArg = callback;
+    }
 
-        for (npy_intp i = 0; i < N; i++) {
-            hll_free(hll_array[i]);
+    uint64_t num_rounds;
+    uint64_t* nf = NULL;
+    bool reordered = true;
+    Py_BEGIN_ALLOW_THREADS
+    if (graph && order != GRAPH_ORDER_NONE) {
+        uint64_t* perm = graph_order(graph, order);
+        uint64_t* ids = perm ? graph_order_invert(perm, graph->numNodes) : NULL;
+        Graph* permuted = perm ? graph_permute(graph, perm) : NULL;
+        reordered = ids && permuted;
+        if (reordered) {
+            options.nodeIds = ids;
+            nf = anf_run(permuted, &options, &num_rounds);
         }
-        free(hll_array);
-        hll_array = new_hll_array;
-    } while (changed);
+        graph_free(permuted);
+        free(ids);
+        free(perm);
+    } else {
+        nf = graph ? anf_run(graph, &options, &num_rounds) : anf_run_compressed(compressed, &options, &num_rounds);
+    }
+    Py_END_ALLOW_THREADS
+    if (!reordered) {
+        PyErr_SetString(PyExc_RuntimeError, "Memory allocation failed");
+        return NULL;
+    }
+    if (!nf) {
+        // An exception raised by the callback takes precedence
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        if (args->resume_path || args->checkpoint_path) {
+            PyErr_SetString(PyExc_RuntimeError, "HyperANF failed: out of memory, a checkpoint could not be written "
+                                                "or the resume checkpoint does not match the graph, p and seed");
+        } else {
+            PyErr_SetString(PyExc_RuntimeError, "Failed to allocate HyperANF counters");
+        }
+        return NULL;
+    }
 
-    for (npy_intp i = 0; i < N; i++) {
-        hll_free(hll_array[i]);
+    *rounds = (Py_ssize_t)num_rounds;
+    return nf;
+}
+
+// Returns nf[first:end] as a Python list
+static PyObject* nf_to_list(const uint64_t* nf, Py_ssize_t first, Py_ssize_t end) {
+    PyObject* list = PyList_New(end - first);
+    if (!list) {
+        return NULL;
+    }
+    for (Py_ssize_t t = first; t < end; t++) {
+        PyList_SET_ITEM(list, t - first, PyLong_FromUnsignedLongLong(nf[t]));
+    }
+    return list;
+}
+
+// Average distance over reachable pairs from N(0), ..., N(T - 1)
+static double average_distance(const uint64_t* nf, Py_ssize_t rounds) {
+    double avg_distance = 0.0;
+    double total_pairs = 0.0;
+
+    for (Py_ssize_t i = 0; i < rounds - 1; i++) {
+        double pair_count = (double)(nf[i] - (i > 0 ? nf[i - 1] : 0));
+        total_pairs += pair_count;
+        avg_distance += (i + 1) * pair_count;
+    }
+
+    return avg_distance / total_pairs;
+}
+
+static PyObject* py_hyperanf(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"p", "adjacency_matrix", "threads", NULL};
+    unsigned short p;
+    PyObject* adjacency_matrix;
+    unsigned int threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "HO|I", kwlist, &p, &adjacency_matrix, &threads)) {
+        return NULL;
+    }
+
+    Graph* graph = graph_from_dense(adjacency_matrix);
+    if (!graph) {
+        return NULL;
     }
-    free(hll_array);
 
+    RunArgs run_args = {threads, NULL, NULL, NULL, 1, NULL, 8, NULL, NULL, 0, NULL};
+    Py_ssize_t rounds;
+    uint64_t* nf = neighborhood_function(graph, NULL, p, 12345, &run_args, &rounds);
+    graph_free(graph);
+    if (!nf) {
+        return NULL;
+    }
+
+    PyObject* neighborhood_sizes = nf_to_list(nf, 1, rounds);
+    free(nf);
     return neighborhood_sizes;
 }
 
-static PyObject* py_hyperanf_distance(PyObject* self, PyObject* args) {
+static PyObject* py_hyperanf_distance(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"p", "adjacency_matrix", "threads", NULL};
     unsigned short p;
-    PyArrayObject* adjacency_matrix;
-    if (!PyArg_ParseTuple(args, "HO", &p, &adjacency_matrix)) {
+    PyObject* adjacency_matrix;
+    unsigned int threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "HO|I", kwlist, &p, &adjacency_matrix, &threads)) {
         return NULL;
     }
 
-    if (!PyArray_Check(adjacency_matrix) || PyArray_NDIM(adjacency_matrix) != 2) {
-        PyErr_SetString(PyExc_ValueError, "Expected a 2D numpy array");
+    Graph* graph = graph_from_dense(adjacency_matrix);
+    if (!graph) {
         return NULL;
     }
 
-    npy_intp* dims = PyArray_DIMS(adjacency_matrix);
-    npy_intp N = dims[0];
-    if (N != dims[1]) {
-        PyErr_SetString(PyExc_ValueError, "Expected a square adjacency matrix");
+    RunArgs run_args = {threads, NULL, NULL, NULL, 1, NULL, 8, NULL, NULL, 0, NULL};
+    Py_ssize_t rounds;
+    uint64_t* nf = neighborhood_function(graph, NULL, p, 42, &run_args, &rounds);
+    graph_free(graph);
+    if (!nf) {
+        return NULL;
+    }
+
+    double avg_distance = average_distance(nf, rounds);
+    free(nf);
+    return PyFloat_FromDouble(avg_distance);
+}
+
+static PyObject* py_hyperanf_csr(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"p", "graph", "targets", "threads", "counter_path", "callback",
+                             "checkpoint_path", "checkpoint_rounds", "resume_path", "register_width", "order",
+                             "placement", "pin_threads", "strategy", NULL};
+    unsigned short p;
+    PyObject* first;
+    PyObject* second = NULL;
+    RunArgs run_args = {0, NULL, NULL, NULL, 1, NULL, 8, NULL, NULL, 0, NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "HO|OIzOzIzIzzpz", kwlist, &p, &first, &second,
+                                     &run_args.threads, &run_args.counter_path, &run_args.callback,
+                                     &run_args.checkpoint_path, &run_args.checkpoint_rounds, &run_args.resume_path,
+                                     &run_args.register_width, &run_args.order, &run_args.placement,
+                                     &run_args.pin_threads, &run_args.strategy)) {
+        return NULL;
+    }
+
+    PyArrayObject* offsets;
+    PyArrayObject* targets;
+    Graph* graph = graph_from_csr(first, second, &offsets, &targets);
+    if (!graph) {
+        return NULL;
+    }
+
+    Py_ssize_t rounds;
+    uint64_t* nf = neighborhood_function(graph, NULL, p, 12345, &run_args, &rounds);
+    graph_free(graph);
+    Py_DECREF(offsets);
+    Py_DECREF(targets);
+    if (!nf) {
+        return NULL;
+    }
+
+    PyObject* neighborhood_sizes = nf_to_list(nf, 1, rounds);
+    free(nf);
+    return neighborhood_sizes;
+}
+
+static PyObject* py_hyperanf_distance_csr(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"p", "graph", "targets", "threads", "counter_path", "callback",
+                             "checkpoint_path", "checkpoint_rounds", "resume_path", "register_width", "order",
+                             "placement", "pin_threads", "strategy", NULL};
+    unsigned short p;
+    PyObject* first;
+    PyObject* second = NULL;
+    RunArgs run_args = {0, NULL, NULL, NULL, 1, NULL, 8, NULL, NULL, 0, NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "HO|OIzOzIzIzzpz", kwlist, &p, &first, &second,
+                                     &run_args.threads, &run_args.counter_path, &run_args.callback,
+                                     &run_args.checkpoint_path, &run_args.checkpoint_rounds, &run_args.resume_path,
+                                     &run_args.register_width, &run_args.order, &run_args.placement,
+                                     &run_args.pin_threads, &run_args.strategy)) {
+        return NULL;
+    }
+
+    PyArrayObject* offsets;
+    PyArrayObject* targets;
+    Graph* graph = graph_from_csr(first, second, &offsets, &targets);
+    if (!graph) {
+        return NULL;
+    }
+
+    Py_ssize_t rounds;
+    uint64_t* nf = neighborhood_function(graph, NULL, p, 42, &run_args, &rounds);
+    graph_free(graph);
+    Py_DECREF(offsets);
+    Py_DECREF(targets);
+    if (!nf) {
+        return NULL;
+    }
+
+    double avg_distance = average_distance(nf, rounds);
+    free(nf);
+    return PyFloat_FromDouble(avg_distance);
+}
+
+static PyObject* py_compress_graph(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"path", "graph", "targets", NULL};
+    const char* path;
+    PyObject* first;
+    PyObject* second = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO|O", kwlist, &path, &first, &second)) {
         return NULL;
     }
 
-    // Initialize HyperLogLog counters
-    HyperLogLog** hll_array = (HyperLogLog**)malloc(N * sizeof(HyperLogLog*));
-    if (!hll_array) {
+    PyArrayObject* offsets;
+    PyArrayObject* targets;
+    Graph* graph = graph_from_csr(first, second, &offsets, &targets);
+    if (!graph) {
+        return NULL;
+    }
+
+    CompressedGraph* compressed;
+    bool saved = false;
+    Py_BEGIN_ALLOW_THREADS
+    compressed = cgraph_compress(graph);
+    if (compressed) {
+        saved = cgraph_save(compressed, path);
+    }
+    Py_END_ALLOW_THREADS
+    graph_free(graph);
+    Py_DECREF(offsets);
+    Py_DECREF(targets);
+
+    if (!compressed) {
         PyErr_SetString(PyExc_RuntimeError, "Memory allocation failed");
         return NULL;
     }
 
-    // Initialize counters and add each node to its own counter
-    for (npy_intp i = 0; i < N; i++) {
-        hll_array[i] = hll_init(p, 42, false, 0, 0);
-        if (!hll_array[i]) {
-            PyErr_SetString(PyExc_RuntimeError, "Failed to initialize HyperLogLog counter");
+    uint64_t bytes = compressed->offsets[compressed->numNodes];
+    cgraph_free(compressed);
+    if (!saved) {
+        PyErr_Format(PyExc_OSError, "Cannot write '%s'", path);
+        return NULL;
+    }
+
+    return PyLong_FromUnsignedLongLong(bytes);
+}
+
+static PyObject* py_hyperanf_compressed(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"p", "path", "threads", "counter_path", "callback", "checkpoint_path",
+                             "checkpoint_rounds", "resume_path", "register_width", "placement", "pin_threads",
+                             NULL};
+    unsigned short p;
+    const char* path;
+    RunArgs run_args = {0, NULL, NULL, NULL, 1, NULL, 8, NULL, NULL, 0, NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "Hs|IzOzIzIzp", kwlist, &p, &path, &run_args.threads,
+                                     &run_args.counter_path, &run_args.callback, &run_args.checkpoint_path,
+                                     &run_args.checkpoint_rounds, &run_args.resume_path,
+                                     &run_args.register_width, &run_args.placement, &run_args.pin_threads)) {
+        return NULL;
+    }
+
+    CompressedGraph* graph;
+    bool valid = false;
+    Py_BEGIN_ALLOW_THREADS
+    graph = cgraph_load(path);
+    if (graph) {
+        valid = cgraph_validate(graph);
+    }
+    Py_END_ALLOW_THREADS
+    if (!valid) {
+        cgraph_free(graph);
+        PyErr_Format(PyExc_ValueError, "Cannot load a compressed graph from '%s'", path);
+        return NULL;
+    }
+
+    Py_ssize_t rounds;
+    uint64_t* nf = neighborhood_function(NULL, graph, p, 12345, &run_args, &rounds);
+    cgraph_free(graph);
+    if (!nf) {
+        return NULL;
+    }
+
+    PyObject* neighborhood_sizes = nf_to_list(nf, 1, rounds);
+    free(nf);
+    return neighborhood_sizes;
+}
+
+// Frees an array handed over to NumPy
+static void free_capsule(PyObject* capsule) {
+    free(PyCapsule_GetPointer(capsule, NULL));
+}
+
+// Wraps a malloc'd uint64 array as a 1D NumPy array that frees it
+static PyObject* owned_uint64_array(uint64_t* data, npy_intp length) {
+    PyObject* capsule = PyCapsule_New(data, NULL, free_capsule);
+    if (!capsule) {
+        free(data);
+        return NULL;
+    }
+
+    PyObject* array = PyArray_SimpleNewFromData(1, &length, NPY_UINT64, data);
+    if (!array) {
+        Py_DECREF(capsule);
+        return NULL;
+    }
+
+    if (PyArray_SetBaseObject((PyArrayObject*)array, capsule) < 0) {
+        Py_DECREF(array);
+        return NULL;
+    }
+
+    return array;
+}
+
+// Loads a graph file with a native loader and returns its (offsets, targets)
+// CSR arrays without copying them
+static PyObject* load_graph(PyObject* args, PyObject* kwargs, Graph* (*loader)(const char*, unsigned)) {
+    static char* kwlist[] = {"path", "threads", NULL};
+    const char* path;
+    unsigned int threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|I", kwlist, &path, &threads)) {
+        return NULL;
+    }
+
+    Graph* graph;
+    Py_BEGIN_ALLOW_THREADS
+    graph = loader(path, threads);
+    Py_END_ALLOW_THREADS
+    if (!graph) {
+        PyErr_Format(PyExc_ValueError, "Cannot load a graph from '%s'", path);
+        return NULL;
+    }
+
+    // The arrays now belong to NumPy
+    uint64_t* offsets = graph->offsets;
+    uint64_t* targets = graph->targets;
+    npy_intp num_nodes = (npy_intp)graph->numNodes;
+    npy_intp num_edges = (npy_intp)graph->numEdges;
+    graph->ownsData = false;
+    graph_free(graph);
+
+    PyObject* offsets_array = owned_uint64_array(offsets, num_nodes + 1);
+    if (!offsets_array) {
+        free(targets);
+        return NULL;
+    }
+
+    PyObject* targets_array = owned_uint64_array(targets, num_edges);
+    if (!targets_array) {
+        Py_DECREF(offsets_array);
+        return NULL;
+    }
+
+    return Py_BuildValue("(NN)", offsets_array, targets_array);
+}
+
+static PyObject* py_load_metis(PyObject* self, PyObject* args, PyObject* kwargs) {
+    return load_graph(args, kwargs, graph_load_metis);
+}
+
+static PyObject* py_load_edge_list(PyObject* self, PyObject* args, PyObject* kwargs) {
+    return load_graph(args, kwargs, graph_load_edge_list);
+}
+
+// Returns the locality metrics of a graph as a dict
+static PyObject* locality_dict(const GraphLocality* locality) {
+    return Py_BuildValue("{s:d,s:d,s:K,s:d}",
+                         "gap_bits", locality->gapBits,
+                         "distance", locality->distance,
+                         "bandwidth", (unsigned long long)locality->bandwidth,
+                         "near_fraction", locality->nearFraction);
+}
+
+static PyObject* py_reorder_graph(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"graph", "targets", "order", NULL};
+    PyObject* first;
+    PyObject* second = NULL;
+    const char* name = "bfs";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Os", kwlist, &first, &second, &name)) {
+        return NULL;
+    }
+
+    GraphOrder order;
+    if (!graph_order_parse(name, &order)) {
+        PyErr_SetString(PyExc_ValueError, "order must be 'none', 'bfs', 'degree' or 'community'");
+        return NULL;
+    }
+
+    PyArrayObject* offsets;
+    PyArrayObject* targets;
+    Graph* graph = graph_from_csr(first, second, &offsets, &targets);
+    if (!graph) {
+        return NULL;
+    }
+
+    GraphLocality before;
+    GraphLocality after;
+    uint64_t* perm;
+    Graph* permuted = NULL;
+    bool measured = false;
+    Py_BEGIN_ALLOW_THREADS
+    perm = graph_order(graph, order);
+    if (perm) {
+        permuted = graph_permute(graph, perm);
+    }
+    if (permuted) {
+        measured = graph_locality(graph, &before) && graph_locality(permuted, &after);
+    }
+    Py_END_ALLOW_THREADS
+    graph_free(graph);
+    Py_DECREF(offsets);
+    Py_DECREF(targets);
+
+    if (!measured) {
+        free(perm);
+        graph_free(permuted);
+        PyErr_SetString(PyExc_RuntimeError, "Memory allocation failed");
+        return NULL;
+    }
+
+    // The arrays now belong to NumPy
+    npy_intp num_nodes = (npy_intp)permuted->numNodes;
+    npy_intp num_edges = (npy_intp)permuted->numEdges;
+    PyObject* permutation = owned_uint64_array(perm, num_nodes);
+    PyObject* offsets_array = owned_uint64_array(permuted->offsets, num_nodes + 1);
+    PyObject* targets_array = owned_uint64_array(permuted->targets, num_edges);
+    permuted->ownsData = false;
+    graph_free(permuted);
+
+    if (!permutation || !offsets_array || !targets_array) {
+        Py_XDECREF(permutation);
+        Py_XDECREF(offsets_array);
+        Py_XDECREF(targets_array);
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:N,s:N,s:N,s:N,s:N}",
+                         "offsets", offsets_array,
+                         "targets", targets_array,
+                         "permutation", permutation,
+                         "before", locality_dict(&before),
+                         "after", locality_dict(&after));
+}
+
+// Python wrapper around a single HyperLogLog counter
+typedef struct {
+    PyObject_HEAD
+    HyperLogLog* hll;
+    bool concurrent;  // Adds run without the GIL so threads can share the counter
+    unsigned adding;  // Adds currently running without the GIL
+} PyHyperLogLog;
+
+static void PyHyperLogLog_dealloc(PyHyperLogLog* self) {
+    hll_free(self->hll);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int PyHyperLogLog_init(PyHyperLogLog* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"p", "seed", "sparse", "concurrent", "running", NULL};
+    unsigned short p = 14;
+    unsigned long long seed = 12345;
+    int sparse = 0;
+    int concurrent = 0;
+    int running = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|HKppp", kwlist, &p, &seed, &sparse, &concurrent,
+                                     &running)) {
+        return -1;
+    }
+
+    if (p < 4 || p > 26) {
+        PyErr_SetString(PyExc_ValueError, "p must be between 4 and 26");
+        return -1;
+    }
+    if (sparse && concurrent) {
+        PyErr_SetString(PyExc_ValueError, "A concurrent counter cannot be sparse");
+        return -1;
+    }
+    if (self->adding > 0) {
+        PyErr_SetString(PyExc_RuntimeError, "HyperLogLog is being added to by another thread");
+        return -1;
+    }
+
+    hll_free(self->hll);
+    self->hll = concurrent ? hll_init_concurrent(p, seed) : hll_init(p, seed, sparse != 0, 0, 0);
+    self->concurrent = concurrent != 0;
+    if (!self->hll) {
+        PyErr_SetString(PyExc_RuntimeError, "Memory allocation failed");
+        return -1;
+    }
+
+    hll_set_estimator(self->hll, running ? HLL_ESTIMATOR_RUNNING : HLL_ESTIMATOR_HISTOGRAM);
+
+    return 0;
+}
+
+static PyObject* PyHyperLogLog_add(PyHyperLogLog* self, PyObject* args) {
+    Py_buffer data;
+    if (!PyArg_ParseTuple(args, "y*", &data)) {
+        return NULL;
+    }
+
+    bool changed = hll_add(self->hll, (const uint8_t*)data.buf, (uint64_t)data.len);
+    PyBuffer_Release(&data);
+    return PyBool_FromLong(changed);
+}
+
+// Adds every element of an integer array. C-contiguous 4 and 8 byte arrays
+// are hashed in place; other integer arrays are converted to uint64 first.
+static PyObject* PyHyperLogLog_add_many(PyHyperLogLog* self, PyObject* args) {
+    PyObject* obj;
+    if (!PyArg_ParseTuple(args, "O", &obj)) {
+        return NULL;
+    }
+
+    PyArrayObject* keys = (PyArrayObject*)PyArray_FROM_OF(obj, NPY_ARRAY_IN_ARRAY);
+    if (!keys) {
+        return NULL;
+    }
+
+    if (!PyArray_ISINTEGER(keys) && !PyArray_ISBOOL(keys)) {
+        Py_DECREF(keys);
+        PyErr_SetString(PyExc_TypeError, "Expected an integer array");
+        return NULL;
+    }
+
+    if (PyArray_ITEMSIZE(keys) != 4 && PyArray_ITEMSIZE(keys) != 8) {
+        PyArrayObject* wide = (PyArrayObject*)PyArray_FROMANY((PyObject*)keys, NPY_UINT64, 0, 0,
+                                                             NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+        Py_DECREF(keys);
+        if (!wide) {
             return NULL;
         }
-        hll_add(hll_array[i], (const uint8_t*)&i, sizeof(i));
+        keys = wide;
+    }
+
+    uint64_t n = (uint64_t)PyArray_SIZE(keys);
+    self->adding++;
+    PyThreadState* state = self->concurrent ? PyEval_SaveThread() : NULL;
+    if (PyArray_ITEMSIZE(keys) == 4) {
+        hll_add_u32(self->hll, (const uint32_t*)PyArray_DATA(keys), n);
+    } else {
+        hll_add_u64(self->hll, (const uint64_t*)PyArray_DATA(keys), n);
+    }
+    if (state) {
+        PyEval_RestoreThread(state);
+    }
+    self->adding--;
+
+    Py_DECREF(keys);
+    Py_RETURN_NONE;
+}
+
+static PyObject* PyHyperLogLog_add_prefixed(PyHyperLogLog* self, PyObject* args) {
+    Py_buffer buffer;
+    if (!PyArg_ParseTuple(args, "y*", &buffer)) {
+        return NULL;
+    }
+
+    self->adding++;
+    PyThreadState* state = self->concurrent ? PyEval_SaveThread() : NULL;
+    bool ok = hll_add_prefixed(self->hll, (const uint8_t*)buffer.buf, (uint64_t)buffer.len);
+    if (state) {
+        PyEval_RestoreThread(state);
+    }
+    self->adding--;
+    PyBuffer_Release(&buffer);
+    if (!ok) {
+        PyErr_SetString(PyExc_ValueError, "Truncated length-prefixed buffer");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* PyHyperLogLog_cardinality(PyHyperLogLog* self, PyObject* Py_UNUSED(args)) {
+    return PyLong_FromUnsignedLongLong(hll_cardinality(self->hll));
+}
+
+static PyTypeObject PyHyperLogLogType;
+
+static PyObject* PyHyperLogLog_merge(PyHyperLogLog* self, PyObject* args) {
+    PyHyperLogLog* other;
+    if (!PyArg_ParseTuple(args, "O!", &PyHyperLogLogType, &other)) {
+        return NULL;
     }
 
-    // Create lists for NFs and node_pairs
-    PyObject* NFs = PyList_New(0);
-    PyObject* node_pairs = PyList_New(0);
     bool changed;
-    int t = 0;
+    if (!hll_merge_changed(self->hll, other->hll, &changed)) {
+        PyErr_SetString(PyExc_ValueError, "Counters have different sizes");
+        return NULL;
+    }
+
+    return PyBool_FromLong(changed);
+}
 
-    do {
-        changed = false;
-        uint64_t total_cardinality = 0;
-        HyperLogLog** new_hll_array = (HyperLogLog**)malloc(N * sizeof(HyperLogLog*));
+// Wraps a counter in a new HyperLogLog object, freeing it on failure
+static PyObject* wrap_counter(HyperLogLog* hll) {
+    if (!hll) {
+        return NULL;
+    }
 
-        // Calculate total cardinality and store in NFs
-        for (npy_intp i = 0; i < N; i++) {
-            total_cardinality += hll_cardinality(hll_array[i]);
-        }
-        PyList_Append(NFs, PyLong_FromUnsignedLongLong(total_cardinality));
+    PyHyperLogLog* obj = (PyHyperLogLog*)PyHyperLogLogType.tp_alloc(&PyHyperLogLogType, 0);
+    if (!obj) {
+        hll_free(hll);
+        return NULL;
+    }
 
-        // Calculate node_pairs
-        uint64_t prev_total = 0;
-        if (t > 0) {
-            PyObject* prev = PyList_GetItem(NFs, t-1);
-            prev_total = PyLong_AsUnsignedLongLong(prev);
-        }
-        PyList_Append(node_pairs, PyLong_FromUnsignedLongLong(total_cardinality - prev_total));
+    obj->hll = hll;
+    obj->concurrent = false;
+    obj->adding = 0;
+    return (PyObject*)obj;
+}
 
-        // Update counters
-        for (npy_intp i = 0; i < N; i++) {
-            new_hll_array[i] = hll_init(p, 42, false, 0, 0);
-            if (!new_hll_array[i]) {
-                PyErr_SetString(PyExc_RuntimeError, "Failed to initialize new HyperLogLog counter");
-                return NULL;
-            }
-            
-            // Copy current counter
-            hll_merge(new_hll_array[i], hll_array[i]);
-
-            // Merge with neighbors
-            for (npy_intp j = 0; j < N; j++) {
-                uint8_t value = *(uint8_t*)PyArray_GETPTR2(adjacency_matrix, i, j);
-                if (value) {
-                    hll_merge(new_hll_array[i], hll_array[j]);
-                }
-            }
+static PyObject* PyHyperLogLog_serialize(PyHyperLogLog* self, PyObject* Py_UNUSED(args)) {
+    uint64_t size = hll_serialized_size(self->hll);
+    PyObject* bytes = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)size);
+    if (!bytes) {
+        return NULL;
+    }
 
-            // Check if counter changed
-            if (hll_cardinality(new_hll_array[i]) != hll_cardinality(hll_array[i])) {
-                changed = true;
-            }
+    if (hll_serialize(self->hll, (uint8_t*)PyBytes_AS_STRING(bytes), size) != size) {
+        Py_DECREF(bytes);
+        PyErr_SetString(PyExc_MemoryError, "Cannot flush the sparse buffer");
+        return NULL;
+    }
+
+    return bytes;
+}
+
+static PyObject* PyHyperLogLog_deserialize(PyObject* cls, PyObject* args) {
+    Py_buffer data;
+    if (!PyArg_ParseTuple(args, "y*", &data)) {
+        return NULL;
+    }
+
+    HyperLogLog* hll = hll_deserialize((const uint8_t*)data.buf, (uint64_t)data.len);
+    PyBuffer_Release(&data);
+    if (!hll) {
+        PyErr_SetString(PyExc_ValueError, "Not a serialized HyperLogLog counter");
+        return NULL;
+    }
+
+    return wrap_counter(hll);
+}
+
+// Copies the registers out as a uint8 array, one byte per register
+static PyObject* PyHyperLogLog_registers(PyHyperLogLog* self, PyObject* Py_UNUSED(args)) {
+    npy_intp size = (npy_intp)hll_size(self->hll);
+    PyObject* array = PyArray_SimpleNew(1, &size, NPY_UINT8);
+    if (!array) {
+        return NULL;
+    }
+
+    hll_get_registers(self->hll, (uint8_t*)PyArray_DATA((PyArrayObject*)array));
+    return array;
+}
+
+static PyMethodDef PyHyperLogLog_methods[] = {
+    {"add", (PyCFunction)PyHyperLogLog_add, METH_VARARGS,
+     "add(data): adds a bytes-like element, returns True if a register changed."},
+    {"add_many", (PyCFunction)PyHyperLogLog_add_many, METH_VARARGS,
+     "add_many(keys): adds every element of an integer numpy array; concurrent counters release the GIL."},
+    {"add_prefixed", (PyCFunction)PyHyperLogLog_add_prefixed, METH_VARARGS,
+     "add_prefixed(buffer): adds items stored as native uint32 lengths followed by their bytes."},
+    {"cardinality", (PyCFunction)PyHyperLogLog_cardinality, METH_NOARGS,
+     "cardinality(): estimated number of distinct elements."},
+    {"merge", (PyCFunction)PyHyperLogLog_merge, METH_VARARGS,
+     "merge(other): merges another counter into this one, returns True if a register changed."},
+    {"serialize", (PyCFunction)PyHyperLogLog_serialize, METH_NOARGS,
+     "serialize(): the counter as bytes, with a versioned header; sparse counters keep only nonzero registers."},
+    {"deserialize", (PyCFunction)PyHyperLogLog_deserialize, METH_VARARGS | METH_CLASS,
+     "deserialize(data): a counter from the bytes written by serialize()."},
+    {"registers", (PyCFunction)PyHyperLogLog_registers, METH_NOARGS,
+     "registers(): a copy of the registers as a uint8 array of length 2^p."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject PyHyperLogLogType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "hll_module.HyperLogLog",
+    .tp_doc = "HyperLogLog(p=14, seed=12345, sparse=False, concurrent=False, running=False): HyperLogLog "
+              "counter with 2^p registers. Concurrent counters can be added to from several threads at once. "
+              "Running counters read cardinality() from a sum kept up to date on every add, for workloads "
+              "that read between adds; otherwise it is recomputed from the register histogram.",
+    .tp_basicsize = sizeof(PyHyperLogLog),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)PyHyperLogLog_init,
+    .tp_dealloc = (destructor)PyHyperLogLog_dealloc,
+    .tp_methods = PyHyperLogLog_methods,
+};
+
+// Python wrapper around a memory-mapped array of counters
+typedef struct {
+    PyObject_HEAD
+    HllArray* array;
+} PyHllArray;
+
+static void PyHllArray_dealloc(PyHllArray* self) {
+    hll_array_free(self->array);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int PyHllArray_init(PyHllArray* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"path", NULL};
+    const char* path;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &path)) {
+        return -1;
+    }
+
+    hll_array_free(self->array);
+    self->array = hll_array_load(path);
+    if (!self->array) {
+        PyErr_Format(PyExc_ValueError, "Cannot load a counter array from '%s'", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static Py_ssize_t PyHllArray_length(PyHllArray* self) {
+    return self->array ? (Py_ssize_t)self->array->numCounters : 0;
+}
+
+// Gets the array, raising if __init__ did not run
+static HllArray* loaded_array(PyHllArray* self) {
+    if (!self->array) {
+        PyErr_SetString(PyExc_ValueError, "Counter array not loaded");
+    }
+    return self->array;
+}
+
+// Exposes the mapped registers as a read-only (counters, 2^p) uint8 array
+// that keeps the mapping alive
+static PyObject* PyHllArray_registers(PyHllArray* self, PyObject* Py_UNUSED(args)) {
+    HllArray* array = loaded_array(self);
+    if (!array) {
+        return NULL;
+    }
+
+    npy_intp dims[2] = {(npy_intp)array->numCounters, (npy_intp)1 << array->p};
+    PyObject* registers = PyArray_New(&PyArray_Type, 2, dims, NPY_UINT8, NULL, (void*)array->registers, 0,
+                                      NPY_ARRAY_CARRAY_RO, NULL);
+    if (!registers) {
+        return NULL;
+    }
+
+    Py_INCREF(self);
+    if (PyArray_SetBaseObject((PyArrayObject*)registers, (PyObject*)self) < 0) {
+        Py_DECREF(registers);
+        return NULL;
+    }
+
+    return registers;
+}
+
+static PyObject* PyHllArray_merge(PyHllArray* self, PyObject* args) {
+    Py_ssize_t index;
+    PyHyperLogLog* counter;
+    if (!PyArg_ParseTuple(args, "nO!", &index, &PyHyperLogLogType, &counter)) {
+        return NULL;
+    }
+
+    HllArray* array = loaded_array(self);
+    if (!array) {
+        return NULL;
+    }
+
+    if (index < 0 || !hll_array_merge(array, (uint64_t)index, counter->hll)) {
+        PyErr_SetString(PyExc_ValueError, "Index out of range, counters of different sizes or seeds or corrupt registers");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// Unions the given counters straight from the mapping into a new counter
+static PyObject* PyHllArray_union(PyHllArray* self, PyObject* args) {
+    PyObject* obj;
+    if (!PyArg_ParseTuple(args, "O", &obj)) {
+        return NULL;
+    }
+
+    HllArray* array = loaded_array(self);
+    if (!array) {
+        return NULL;
+    }
+
+    PyArrayObject* indexes = (PyArrayObject*)PyArray_FROMANY(obj, NPY_UINT64, 1, 1,
+                                                             NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (!indexes) {
+        return NULL;
+    }
+
+    uint64_t size = (uint64_t)1 << array->p;
+    uint8_t* registers = (uint8_t*)calloc(size, 1);
+    HyperLogLog* hll = hll_init(array->p, array->seed, false, 0, 0);
+    if (!registers || !hll) {
+        free(registers);
+        hll_free(hll);
+        Py_DECREF(indexes);
+        return PyErr_NoMemory();
+    }
+
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = hll_array_union(array, (const uint64_t*)PyArray_DATA(indexes), (uint64_t)PyArray_SIZE(indexes), registers) &&
+         hll_merge_registers(hll, registers, size);
+    Py_END_ALLOW_THREADS
+
+    free(registers);
+    Py_DECREF(indexes);
+    if (!ok) {
+        hll_free(hll);
+        PyErr_SetString(PyExc_ValueError, "Index out of range or corrupt registers");
+        return NULL;
+    }
+
+    return wrap_counter(hll);
+}
+
+static PyMethodDef PyHllArray_methods[] = {
+    {"registers", (PyCFunction)PyHllArray_registers, METH_NOARGS,
+     "registers(): the mapped registers as a read-only (counters, 2^p) uint8 array, without copying."},
+    {"merge", (PyCFunction)PyHllArray_merge, METH_VARARGS,
+     "merge(index, counter): merges counter index into a HyperLogLog with the same p."},
+    {"union", (PyCFunction)PyHllArray_union, METH_VARARGS,
+     "union(indexes): a new HyperLogLog holding the union of the given counters."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PySequenceMethods PyHllArray_sequence = {
+    .sq_length = (lenfunc)PyHllArray_length,
+};
+
+static PyTypeObject PyHllArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "hll_module.HllArray",
+    .tp_doc = "HllArray(path): memory-mapped array of counters written by save_hll_array.",
+    .tp_basicsize = sizeof(PyHllArray),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)PyHllArray_init,
+    .tp_dealloc = (destructor)PyHllArray_dealloc,
+    .tp_methods = PyHllArray_methods,
+    .tp_as_sequence = &PyHllArray_sequence,
+};
+
+// Python wrapper around HyperANF kept up to date as edges are added
+typedef struct {
+    PyObject_HEAD
+    AnfIncremental* incremental;
+    bool busy;                    // An update is running without the GIL
+} PyIncrementalHyperAnf;
+
+static void PyIncrementalHyperAnf_dealloc(PyIncrementalHyperAnf* self) {
+    anf_incremental_free(self->incremental);
+    Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static int PyIncrementalHyperAnf_init(PyIncrementalHyperAnf* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"p", "graph", "targets", "threads", "register_width", NULL};
+    unsigned short p;
+    PyObject* first;
+    PyObject* second = NULL;
+    unsigned int threads = 0;
+    unsigned int register_width = 8;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "HO|OII", kwlist, &p, &first, &second, &threads,
+                                     &register_width)) {
+        return -1;
+    }
+
+    if (p < 4 || p > 16) {
+        PyErr_SetString(PyExc_ValueError, "p must be between 4 and 16");
+        return -1;
+    }
+    if (register_width != 5 && register_width != 6 && register_width != 8) {
+        PyErr_SetString(PyExc_ValueError, "register_width must be 5, 6 or 8");
+        return -1;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "IncrementalHyperANF is being updated by another thread");
+        return -1;
+    }
+
+    PyArrayObject* offsets;
+    PyArrayObject* targets;
+    Graph* graph = graph_from_csr(first, second, &offsets, &targets);
+    if (!graph) {
+        return -1;
+    }
+
+    AnfOptions options;
+    anf_options_init(&options);
+    options.p = p;
+    options.threads = threads;
+    options.registerWidth = register_width;
+
+    AnfIncremental* incremental;
+    Py_BEGIN_ALLOW_THREADS
+    incremental = anf_incremental_init(graph, &options);
+    Py_END_ALLOW_THREADS
+    graph_free(graph);
+    Py_DECREF(offsets);
+    Py_DECREF(targets);
+    if (!incremental) {
+        PyErr_SetString(PyExc_RuntimeError, "Failed to allocate HyperANF counters");
+        return -1;
+    }
+
+    anf_incremental_free(self->incremental);
+    self->incremental = incremental;
+    return 0;
+}
+
+// Gets the run, raising if __init__ did not run or another thread is
+// updating it
+static AnfIncremental* started_run(PyIncrementalHyperAnf* self) {
+    if (!self->incremental) {
+        PyErr_SetString(PyExc_ValueError, "HyperANF not run");
+        return NULL;
+    }
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "IncrementalHyperANF is being updated by another thread");
+        return NULL;
+    }
+    return self->incremental;
+}
+
+static Py_ssize_t PyIncrementalHyperAnf_length(PyIncrementalHyperAnf* self) {
+    if (self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "IncrementalHyperANF is being updated by another thread");
+        return -1;
+    }
+    return self->incremental ? (Py_ssize_t)anf_incremental_nodes(self->incremental) : 0;
+}
+
+// Adds the edges sources[e] -> targets[e] without holding the GIL. The
+// update rewrites counters that every other method reads, so while it runs
+// the object is marked busy and calls from other threads raise.
+static PyObject* PyIncrementalHyperAnf_add_edges(PyIncrementalHyperAnf* self, PyObject* args) {
+    PyObject* first;
+    PyObject* second;
+    if (!PyArg_ParseTuple(args, "OO", &first, &second)) {
+        return NULL;
+    }
+
+    AnfIncremental* incremental = started_run(self);
+    if (!incremental) {
+        return NULL;
+    }
+
+    PyArrayObject* sources = (PyArrayObject*)PyArray_FROMANY(first, NPY_UINT64, 1, 1,
+                                                             NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    PyArrayObject* targets = sources ? (PyArrayObject*)PyArray_FROMANY(second, NPY_UINT64, 1, 1,
+                                                                       NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST)
+                                     : NULL;
+    if (!sources || !targets) {
+        Py_XDECREF(sources);
+        return NULL;
+    }
+    if (PyArray_DIM(sources, 0) != PyArray_DIM(targets, 0)) {
+        Py_DECREF(sources);
+        Py_DECREF(targets);
+        PyErr_SetString(PyExc_ValueError, "sources and targets must have the same length");
+        return NULL;
+    }
+
+    AnfUpdateStats stats;
+    bool ok;
+    self->busy = true;
+    Py_BEGIN_ALLOW_THREADS
+    ok = anf_incremental_add_arcs(incremental, (uint64_t)PyArray_DIM(sources, 0),
+                                  (const uint64_t*)PyArray_DATA(sources),
+                                  (const uint64_t*)PyArray_DATA(targets), &stats);
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+    Py_DECREF(sources);
+    Py_DECREF(targets);
+    if (!ok) {
+        return PyErr_NoMemory();
+    }
+
+    return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:d}",
+                         "rounds", (unsigned long long)stats.rounds,
+                         "active", (unsigned long long)stats.active,
+                         "modified", (unsigned long long)stats.modified,
+                         "merges", (unsigned long long)stats.merges,
+                         "added_nodes", (unsigned long long)stats.addedNodes,
+                         "seconds", stats.seconds);
+}
+
+static PyObject* PyIncrementalHyperAnf_neighborhood_function(PyIncrementalHyperAnf* self,
+                                                             PyObject* Py_UNUSED(args)) {
+    AnfIncremental* incremental = started_run(self);
+    if (!incremental) {
+        return NULL;
+    }
+
+    uint64_t rounds;
+    const uint64_t* nf = anf_incremental_nf(incremental, &rounds);
+    return nf_to_list(nf, 1, (Py_ssize_t)rounds);
+}
+
+static PyMethodDef PyIncrementalHyperAnf_methods[] = {
+    {"add_edges", (PyCFunction)PyIncrementalHyperAnf_add_edges, METH_VARARGS,
+     "add_edges(sources, targets): adds the edges sources[i] -> targets[i] and updates the result, touching only "
+     "the counters they change. Ids past the last node add nodes. Returns a dict of the work done. Other threads "
+     "keep running during the update; calls on the same object from them raise RuntimeError."},
+    {"neighborhood_function", (PyCFunction)PyIncrementalHyperAnf_neighborhood_function, METH_NOARGS,
+     "neighborhood_function(): the list hyperanf_csr would return for the graph with every added edge."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PySequenceMethods PyIncrementalHyperAnf_sequence = {
+    .sq_length = (lenfunc)PyIncrementalHyperAnf_length,
+};
+
+static PyTypeObject PyIncrementalHyperAnfType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "hll_module.IncrementalHyperANF",
+    .tp_doc = "IncrementalHyperANF(p, graph, targets=None, threads=0, register_width=8): HyperANF over a CSR graph "
+              "that keeps the counters of every round, so that added edges update the result incrementally.",
+    .tp_basicsize = sizeof(PyIncrementalHyperAnf),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)PyIncrementalHyperAnf_init,
+    .tp_dealloc = (destructor)PyIncrementalHyperAnf_dealloc,
+    .tp_methods = PyIncrementalHyperAnf_methods,
+    .tp_as_sequence = &PyIncrementalHyperAnf_sequence,
+};
+
+static PyObject* py_save_hll_array(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"path", "counters", NULL};
+    const char* path;
+    PyObject* obj;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "sO", kwlist, &path, &obj)) {
+        return NULL;
+    }
+
+    PyObject* sequence = PySequence_Fast(obj, "counters must be a sequence of HyperLogLog");
+    if (!sequence) {
+        return NULL;
+    }
+
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(sequence);
+    HyperLogLog** counters = (HyperLogLog**)malloc((n > 0 ? n : 1) * sizeof(HyperLogLog*));
+    if (!counters) {
+        Py_DECREF(sequence);
+        return PyErr_NoMemory();
+    }
+
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject* item = PySequence_Fast_GET_ITEM(sequence, i);
+        if (!PyObject_TypeCheck(item, &PyHyperLogLogType)) {
+            free(counters);
+            Py_DECREF(sequence);
+            PyErr_SetString(PyExc_TypeError, "counters must be a sequence of HyperLogLog");
+            return NULL;
         }
+        counters[i] = ((PyHyperLogLog*)item)->hll;
+    }
+
+    bool ok = hll_array_save(counters, (uint64_t)n, path);
+    free(counters);
+    Py_DECREF(sequence);
+    if (!ok) {
+        PyErr_Format(PyExc_ValueError, "Cannot write '%s' (counters must be nonempty and share p and seed)", path);
+        return NULL;
+    }
 
-        // Free old counters and update
-        for (npy_intp i = 0; i < N; i++) {
-            hll_free(hll_array[i]);
+    Py_RETURN_NONE;
+}
+
+static PyObject* py_kernel_name(PyObject* self, PyObject* Py_UNUSED(args)) {
+    return PyUnicode_FromString(hll_kernel_name());
+}
+
+static PyObject* py_select_kernel(PyObject* self, PyObject* args) {
+    const char* name;
+    if (!PyArg_ParseTuple(args, "s", &name)) {
+        return NULL;
+    }
+
+    if (!hll_kernel_select(name)) {
+        PyErr_Format(PyExc_ValueError, "Unknown kernel '%s' or not supported by this CPU", name);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+// Converts obj to a uint8 register array of 2^p registers for a p with
+// fixed-size kernels and stores p
+static PyArrayObject* register_array(PyObject* obj, unsigned short* p) {
+    PyArrayObject* regs = (PyArrayObject*)PyArray_FROMANY(obj, NPY_UINT8, 1, 1,
+                                                          NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (!regs) {
+        return NULL;
+    }
+
+    npy_intp n = PyArray_DIM(regs, 0);
+    for (*p = HLL_FIXED_MIN_P; *p <= HLL_FIXED_MAX_P; (*p)++) {
+        if (n == ((npy_intp)1 << *p)) {
+            return regs;
         }
-        free(hll_array);
-        hll_array = new_hll_array;
-        t++;
+    }
 
-    } while (changed);
+    Py_DECREF(regs);
+    PyErr_Format(PyExc_ValueError, "Register arrays must hold 2^p registers for p between %d and %d",
+                 HLL_FIXED_MIN_P, HLL_FIXED_MAX_P);
+    return NULL;
+}
 
-    // Calculate average graph distance
-    double avg_distance = 0.0;
-    double total_pairs = 0.0;
-    Py_ssize_t num_steps = PyList_Size(node_pairs);
-    
-    for (Py_ssize_t i = 0; i < num_steps; i++) {
-        PyObject* pairs = PyList_GetItem(node_pairs, i);
-        double pair_count = (double)PyLong_AsUnsignedLongLong(pairs);
-        total_pairs += pair_count;
-        avg_distance += (i + 1) * pair_count;
+static PyObject* py_register_max(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"dst", "src", "fixed", NULL};
+    PyObject* dst_obj;
+    PyObject* src_obj;
+    int fixed = 0;
+    unsigned short p;
+    unsigned short src_p;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|p", kwlist, &dst_obj, &src_obj, &fixed)) {
+        return NULL;
     }
-    
-    avg_distance = avg_distance / total_pairs;
 
-    // Clean up
-    for (npy_intp i = 0; i < N; i++) {
-        hll_free(hll_array[i]);
+    PyArrayObject* src = register_array(src_obj, &src_p);
+    if (!src) {
+        return NULL;
+    }
+    PyArrayObject* dst = register_array(dst_obj, &p);
+    PyObject* out = dst ? PyArray_NewCopy(dst, NPY_CORDER) : NULL;
+    Py_XDECREF(dst);
+    if (out && p != src_p) {
+        Py_CLEAR(out);
+        PyErr_SetString(PyExc_ValueError, "Register arrays must be the same size");
+    }
+    if (!out) {
+        Py_DECREF(src);
+        return NULL;
     }
-    free(hll_array);
-    Py_DECREF(NFs);
-    Py_DECREF(node_pairs);
 
-    return PyFloat_FromDouble(avg_distance);
+    uint8_t* regs = (uint8_t*)PyArray_DATA((PyArrayObject*)out);
+    bool changed;
+    if (fixed) {
+        changed = hll_fixed_kernels(p)->max(regs, (const uint8_t*)PyArray_DATA(src));
+    } else {
+        changed = hll_max_u8(regs, (const uint8_t*)PyArray_DATA(src), (uint64_t)1 << p);
+    }
+    Py_DECREF(src);
+
+    return Py_BuildValue("(NO)", out, changed ? Py_True : Py_False);
+}
+
+static PyObject* py_register_sums(PyObject* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"registers", "fixed", NULL};
+    PyObject* obj;
+    int fixed = 0;
+    unsigned short p;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|p", kwlist, &obj, &fixed)) {
+        return NULL;
+    }
+
+    PyArrayObject* regs = register_array(obj, &p);
+    if (!regs) {
+        return NULL;
+    }
+
+    HllRegisterSums sums;
+    if (fixed) {
+        hll_fixed_kernels(p)->sums((const uint8_t*)PyArray_DATA(regs), &sums);
+    } else {
+        hll_register_sums((const uint8_t*)PyArray_DATA(regs), (uint64_t)1 << p, (uint8_t)(64 - p),
+                          (uint8_t)(p + 1), &sums);
+    }
+    Py_DECREF(regs);
+
+    return Py_BuildValue("(dKK)", sums.inverseSum, (unsigned long long)sums.zeros,
+                         (unsigned long long)sums.matches);
 }
 
 static PyMethodDef HllMethods[] = {
-    {"hyperanf", py_hyperanf, METH_VARARGS, "Compute approximate neighborhood function using HyperANF."},
-    {"hyperanf_distance", py_hyperanf_distance, METH_VARARGS, "Compute average graph distance using HyperANF."},
+    {"hyperanf", (PyCFunction)(void(*)(void))py_hyperanf, METH_VARARGS | METH_KEYWORDS,
+     "hyperanf(p, adjacency_matrix, threads=0): approximate neighborhood function using HyperANF. p must be "
+     "between 4 and 16 (ValueError otherwise); the list holds N(1), N(2), ... up to the first round in which no "
+     "register changed, so it can end with repeated values."},
+    {"hyperanf_distance", (PyCFunction)(void(*)(void))py_hyperanf_distance, METH_VARARGS | METH_KEYWORDS,
+     "hyperanf_distance(p, adjacency_matrix, threads=0): average graph distance using HyperANF. p must be "
+     "between 4 and 16 (ValueError otherwise); rounds run until no register changes."},
+    {"hyperanf_csr", (PyCFunction)(void(*)(void))py_hyperanf_csr, METH_VARARGS | METH_KEYWORDS,
+     "hyperanf_csr(p, offsets, targets, threads=0, counter_path=None, callback=None, checkpoint_path=None, "
+     "checkpoint_rounds=1, resume_path=None, register_width=8) or hyperanf_csr(p, csr_matrix, ...): HyperANF "
+     "over a CSR graph; counter_path keeps the counters in a memory-mapped file, callback is called with a dict "
+     "of statistics after each round, checkpoint_path gets a checkpoint every checkpoint_rounds rounds, "
+     "resume_path carries on from one, register_width 5 or 6 packs the registers to save memory and order "
+     "('bfs', 'degree' or 'community') reorders the nodes for cache locality without changing the result. "
+     "On NUMA machines placement ('first-touch', 'interleave' or 'partitioned') places the counter pages and "
+     "pin_threads=True pins the worker threads node by node ('partitioned' always pins them). strategy "
+     "('auto', 'dense', 'sparse', 'push' or 'full') sets how rounds pick the counters to recompute."},
+    {"hyperanf_distance_csr", (PyCFunction)(void(*)(void))py_hyperanf_distance_csr, METH_VARARGS | METH_KEYWORDS,
+     "hyperanf_distance_csr(p, offsets, targets, threads=0, counter_path=None, callback=None, ...) or hyperanf_distance_csr(p, csr_matrix, ...): "
+     "average distance over a CSR graph."},
+    {"reorder_graph", (PyCFunction)(void(*)(void))py_reorder_graph, METH_VARARGS | METH_KEYWORDS,
+     "reorder_graph(offsets, targets, order='bfs') or reorder_graph(csr_matrix, order='bfs'): renumbers the "
+     "nodes in 'none', 'bfs' (Cuthill-McKee), 'degree' or 'community' order. Returns a dict with the new "
+     "offsets and targets, the permutation (new id of each node) and the locality metrics 'before' and 'after' "
+     "(gap_bits, distance, bandwidth, near_fraction)."},
+    {"load_metis", (PyCFunction)(void(*)(void))py_load_metis, METH_VARARGS | METH_KEYWORDS,
+     "load_metis(path, threads=0): loads a METIS adjacency file as (offsets, targets) CSR arrays."},
+    {"load_edge_list", (PyCFunction)(void(*)(void))py_load_edge_list, METH_VARARGS | METH_KEYWORDS,
+     "load_edge_list(path, threads=0): loads a 0-based 'source target' edge list as (offsets, targets) CSR arrays."},
+    {"compress_graph", (PyCFunction)(void(*)(void))py_compress_graph, METH_VARARGS | METH_KEYWORDS,
+     "compress_graph(path, offsets, targets) or compress_graph(path, csr_matrix): writes a gap/varint "
+     "compressed graph file and returns the size of its successor data in bytes."},
+    {"hyperanf_compressed", (PyCFunction)(void(*)(void))py_hyperanf_compressed, METH_VARARGS | METH_KEYWORDS,
+     "hyperanf_compressed(p, path, threads=0, counter_path=None, callback=None, checkpoint_path=None, "
+     "checkpoint_rounds=1, resume_path=None, register_width=8, placement=None, pin_threads=False): HyperANF over "
+     "a memory-mapped compressed graph file."},
+    {"save_hll_array", (PyCFunction)(void(*)(void))py_save_hll_array, METH_VARARGS | METH_KEYWORDS,
+     "save_hll_array(path, counters): writes HyperLogLog counters sharing p and seed as a file HllArray can map."},
+    {"kernel_name", (PyCFunction)py_kernel_name, METH_NOARGS,
+     "kernel_name(): the register kernels in use ('scalar', 'sse2', 'avx2' or 'avx512bw')."},
+    {"select_kernel", (PyCFunction)py_select_kernel, METH_VARARGS,
+     "select_kernel(name): forces the register kernels, e.g. to compare them; raises ValueError if the CPU lacks them."},
+    {"register_max", (PyCFunction)(void(*)(void))py_register_max, METH_VARARGS | METH_KEYWORDS,
+     "register_max(dst, src, fixed=False): (max of two arrays of 2^p byte registers, whether dst changed), "
+     "using the kernels specialized for p if fixed."},
+    {"register_sums", (PyCFunction)(void(*)(void))py_register_sums, METH_VARARGS | METH_KEYWORDS,
+     "register_sums(registers, fixed=False): (sum of 2^-r over ranks 1 ... 64 - p, zero count, count of rank "
+     "p + 1) of 2^p byte registers, using the kernels specialized for p if fixed."},
     {NULL, NULL, 0, NULL}
 };
 
@@ -225,5 +1468,37 @@ static struct PyModuleDef hllmodule = {
 
 PyMODINIT_FUNC PyInit_hll_module(void) {
     import_array(); // Required for numpy integration
-    return PyModule_Create(&hllmodule);
+
+    if (PyType_Ready(&PyHyperLogLogType) < 0 || PyType_Ready(&PyHllArrayType) < 0 ||
+        PyType_Ready(&PyIncrementalHyperAnfType) < 0) {
+        return NULL;
+    }
+
+    PyObject* module = PyModule_Create(&hllmodule);
+    if (!module) {
+        return NULL;
+    }
+
+    Py_INCREF(&PyHyperLogLogType);
+    if (PyModule_AddObject(module, "HyperLogLog", (PyObject*)&PyHyperLogLogType) < 0) {
+        Py_DECREF(&PyHyperLogLogType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    Py_INCREF(&PyHllArrayType);
+    if (PyModule_AddObject(module, "HllArray", (PyObject*)&PyHllArrayType) < 0) {
+        Py_DECREF(&PyHllArrayType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    Py_INCREF(&PyIncrementalHyperAnfType);
+    if (PyModule_AddObject(module, "IncrementalHyperANF", (PyObject*)&PyIncrementalHyperAnfType) < 0) {
+        Py_DECREF(&PyIncrementalHyperAnfType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
 }
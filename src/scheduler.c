@@ -0,0 +1,394 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "scheduler.h"
+#include "topology.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* CPU affinity of a thread, saved to restore it later */
+typedef struct CpuAffinity {
+#ifdef _WIN32
+    DWORD_PTR mask;               /* Processor mask */
+#elif defined(__linux__)
+    cpu_set_t set;                /* CPU set */
+#endif
+    bool saved;                   /* If the affinity was read */
+} CpuAffinity;
+
+/* Chunk range [front, back) owned by one thread, packed as front << 32 | back
+ * so the owner (taking the front) and thieves (taking the back) can both
+ * claim a chunk with one compare-and-swap. Padded to a cache line. */
+typedef struct ChunkQueue {
+    _Atomic uint64_t range;
+    char pad[64 - sizeof(uint64_t)];
+} ChunkQueue;
+
+typedef struct Worker {
+    struct Scheduler* sched;      /* Pool the worker belongs to */
+    unsigned id;                  /* Thread number, 1 ... numThreads - 1 */
+    int cpu;                      /* CPU to pin to, or -1 */
+    unsigned node;                /* NUMA node of that CPU */
+    bool pinned;                  /* If the thread has pinned itself */
+} Worker;
+
+/* Scheduler structure definition */
+struct Scheduler {
+    pthread_t* threads;           /* Worker threads (the caller is thread 0) */
+    Worker* workers;              /* Per-thread arguments */
+    ChunkQueue* queues;           /* Per-thread chunk ranges */
+    unsigned numThreads;          /* Number of threads including the caller */
+    CpuAffinity callerAffinity;   /* Affinity of the calling thread before sched_pin */
+
+    pthread_mutex_t lock;         /* Guards the fields below */
+    pthread_cond_t start;         /* Signalled when a new job is posted */
+    pthread_cond_t done;          /* Signalled when the last worker finishes */
+    uint64_t generation;          /* Incremented for every job */
+    unsigned running;             /* Workers still busy with the job */
+    bool stop;                    /* If the workers should exit */
+
+    /* Current job */
+    const uint64_t* bounds;       /* Chunk boundaries */
+    sched_task_fn task;           /* Task to run */
+    void* arg;                    /* Task argument */
+};
+
+/* Takes the first chunk of a queue, or returns false if it is empty */
+static inline bool popFront(ChunkQueue* queue, uint64_t* chunk)
+{
+    uint64_t range = atomic_load_explicit(&queue->range, memory_order_relaxed);
+
+    while ((range >> 32) < (range & 0xFFFFFFFFULL)) {
+        if (atomic_compare_exchange_weak(&queue->range, &range, range + (1ULL << 32))) {
+            *chunk = range >> 32;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Takes the last chunk of a queue, or returns false if it is empty */
+static inline bool popBack(ChunkQueue* queue, uint64_t* chunk)
+{
+    uint64_t range = atomic_load_explicit(&queue->range, memory_order_relaxed);
+
+    while ((range >> 32) < (range & 0xFFFFFFFFULL)) {
+        if (atomic_compare_exchange_weak(&queue->range, &range, range - 1)) {
+            *chunk = (range & 0xFFFFFFFFULL) - 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Pins the calling thread to one CPU, first saving its affinity if saved
+ * is not NULL */
+static bool pinSelf(unsigned cpu, CpuAffinity* saved)
+{
+#ifdef _WIN32
+    if (cpu >= 8 * sizeof(DWORD_PTR)) return false;
+
+    DWORD_PTR old = SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+
+    if (saved && old != 0) {
+        saved->mask = old;
+        saved->saved = true;
+    }
+
+    return old != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+
+    if (saved) {
+        saved->saved = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &saved->set) == 0;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set) == 0;
+#else
+    (void)cpu;
+    (void)saved;
+    return false;
+#endif
+}
+
+/* Restores the affinity saved by pinSelf */
+static void restoreSelf(const CpuAffinity* saved)
+{
+    if (!saved->saved) return;
+
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(), saved->mask);
+#elif defined(__linux__)
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &saved->set);
+#endif
+}
+
+/* Runs own chunks front to back, then steals until every queue is empty */
+static void runChunks(Scheduler* sched, unsigned id)
+{
+    uint64_t chunk;
+
+    while (popFront(&sched->queues[id], &chunk)) {
+        sched->task(sched->bounds[chunk], sched->bounds[chunk + 1], id, sched->arg);
+    }
+
+    for (unsigned k = 1; k < sched->numThreads; k++) {
+        ChunkQueue* victim = &sched->queues[(id + k) % sched->numThreads];
+
+        while (popBack(victim, &chunk)) {
+            sched->task(sched->bounds[chunk], sched->bounds[chunk + 1], id, sched->arg);
+        }
+    }
+}
+
+static void* workerMain(void* arg)
+{
+    Worker* worker = (Worker*)arg;
+    Scheduler* sched = worker->sched;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&sched->lock);
+
+    while (true) {
+        while (sched->generation == seen && !sched->stop) {
+            pthread_cond_wait(&sched->start, &sched->lock);
+        }
+
+        if (sched->stop) {
+            break;
+        }
+
+        seen = sched->generation;
+        int cpu = worker->pinned ? -1 : worker->cpu;
+        worker->pinned = worker->pinned || cpu >= 0;
+        pthread_mutex_unlock(&sched->lock);
+
+        if (cpu >= 0) {
+            pinSelf((unsigned)cpu, NULL);
+        }
+
+        runChunks(sched, worker->id);
+
+        pthread_mutex_lock(&sched->lock);
+        if (--sched->running == 0) {
+            pthread_cond_signal(&sched->done);
+        }
+    }
+
+    pthread_mutex_unlock(&sched->lock);
+
+    return NULL;
+}
+
+/* Create a thread pool */
+Scheduler* sched_init(unsigned numThreads)
+{
+    Scheduler* sched = (Scheduler*)calloc(1, sizeof(Scheduler));
+
+    if (!sched) return NULL;
+
+    if (numThreads == 0) {
+        numThreads = sched_cpu_count();
+    }
+
+    sched->numThreads = numThreads;
+    sched->threads = (pthread_t*)calloc(numThreads, sizeof(pthread_t));
+    sched->workers = (Worker*)calloc(numThreads, sizeof(Worker));
+    sched->queues = (ChunkQueue*)calloc(numThreads, sizeof(ChunkQueue));
+
+    if (!sched->threads || !sched->workers || !sched->queues) {
+        free(sched->threads);
+        free(sched->workers);
+        free(sched->queues);
+        free(sched);
+        return NULL;
+    }
+
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->start, NULL);
+    pthread_cond_init(&sched->done, NULL);
+
+    for (unsigned t = 0; t < numThreads; t++) {
+        sched->workers[t].cpu = -1;
+    }
+
+    for (unsigned t = 1; t < numThreads; t++) {
+        sched->workers[t].sched = sched;
+        sched->workers[t].id = t;
+
+        if (pthread_create(&sched->threads[t], NULL, workerMain, &sched->workers[t]) != 0) {
+            /* Run with the threads we managed to start */
+            sched->numThreads = t;
+            break;
+        }
+    }
+
+    return sched;
+}
+
+/* Stop the workers and free the pool */
+void sched_free(Scheduler* sched)
+{
+    if (!sched) return;
+
+    pthread_mutex_lock(&sched->lock);
+    sched->stop = true;
+    pthread_cond_broadcast(&sched->start);
+    pthread_mutex_unlock(&sched->lock);
+
+    for (unsigned t = 1; t < sched->numThreads; t++) {
+        pthread_join(sched->threads[t], NULL);
+    }
+
+    restoreSelf(&sched->callerAffinity);
+
+    pthread_mutex_destroy(&sched->lock);
+    pthread_cond_destroy(&sched->start);
+    pthread_cond_destroy(&sched->done);
+    free(sched->threads);
+    free(sched->workers);
+    free(sched->queues);
+    free(sched);
+}
+
+/* Get the number of threads */
+unsigned sched_threads(Scheduler* sched)
+{
+    return sched->numThreads;
+}
+
+/* Run a task over every chunk */
+void sched_run(Scheduler* sched, const uint64_t* bounds, uint64_t numChunks,
+               sched_task_fn task, void* arg)
+{
+    unsigned T = sched->numThreads;
+
+    if (T == 1 || numChunks <= 1) {
+        for (uint64_t c = 0; c < numChunks; c++) {
+            task(bounds[c], bounds[c + 1], 0, arg);
+        }
+        return;
+    }
+
+    /* Hand each thread a contiguous run of chunks */
+    for (unsigned t = 0; t < T; t++) {
+        uint64_t front;
+        uint64_t back;
+
+        sched_thread_chunks(sched, numChunks, t, &front, &back);
+        atomic_store(&sched->queues[t].range, (front << 32) | back);
+    }
+
+    pthread_mutex_lock(&sched->lock);
+    sched->bounds = bounds;
+    sched->task = task;
+    sched->arg = arg;
+    sched->running = T - 1;
+    sched->generation++;
+    pthread_cond_broadcast(&sched->start);
+    pthread_mutex_unlock(&sched->lock);
+
+    runChunks(sched, 0);
+
+    pthread_mutex_lock(&sched->lock);
+    while (sched->running > 0) {
+        pthread_cond_wait(&sched->done, &sched->lock);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+/* Get the chunks a thread starts on */
+void sched_thread_chunks(Scheduler* sched, uint64_t numChunks, unsigned thread, uint64_t* first, uint64_t* end)
+{
+    *first = numChunks * thread / sched->numThreads;
+    *end = numChunks * (thread + 1) / sched->numThreads;
+}
+
+/* Pin the threads node by node */
+bool sched_pin(Scheduler* sched)
+{
+    unsigned max = sched_cpu_count() + 64;
+    unsigned* cpus = (unsigned*)malloc(max * sizeof(unsigned));
+    unsigned* nodes = (unsigned*)malloc(max * sizeof(unsigned));
+    unsigned count = cpus && nodes ? topo_cpus(cpus, nodes, max) : 0;
+    bool ok = count > 0;
+
+    if (ok) {
+        pthread_mutex_lock(&sched->lock);
+
+        for (unsigned t = 0; t < sched->numThreads; t++) {
+            sched->workers[t].cpu = (int)cpus[t % count];
+            sched->workers[t].node = nodes[t % count];
+        }
+
+        pthread_mutex_unlock(&sched->lock);
+
+        if (!sched->callerAffinity.saved) {
+            ok = pinSelf(cpus[0], &sched->callerAffinity);
+        }
+    }
+
+    free(cpus);
+    free(nodes);
+
+    return ok;
+}
+
+/* Get the node a thread is pinned on */
+unsigned sched_thread_node(Scheduler* sched, unsigned thread)
+{
+    return sched->workers[thread].node;
+}
+
+/* Split nodes into chunks of roughly equal node + arc cost */
+uint64_t sched_balance(const uint64_t* offsets, uint64_t numNodes, uint64_t maxChunks, uint64_t* bounds)
+{
+    uint64_t total = numNodes + offsets[numNodes] - offsets[0];
+    uint64_t target = total / (maxChunks ? maxChunks : 1) + 1;
+    uint64_t numChunks = 0;
+    uint64_t chunkStart = 0;
+
+    bounds[0] = 0;
+
+    for (uint64_t i = 0; i < numNodes; i++) {
+        /* Cost of nodes [chunkStart, i] */
+        uint64_t cost = (i + 1 - chunkStart) + offsets[i + 1] - offsets[chunkStart];
+
+        if (cost >= target && numChunks + 1 < maxChunks) {
+            bounds[++numChunks] = i + 1;
+            chunkStart = i + 1;
+        }
+    }
+
+    if (bounds[numChunks] < numNodes || numChunks == 0) {
+        bounds[++numChunks] = numNodes;
+    }
+
+    return numChunks;
+}
+
+/* Get the number of online CPUs */
+unsigned sched_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (unsigned)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Pool of worker threads that runs a task over precomputed chunks of a
+ * node range. Each thread starts on its own contiguous run of chunks and
+ * steals from the far end of other threads' runs once it is done. */
+typedef struct Scheduler Scheduler;
+
+/* Task run on nodes [begin, end) by worker thread number thread */
+typedef void (*sched_task_fn)(uint64_t begin, uint64_t end, unsigned thread, void* arg);
+
+/* Creates a pool of numThreads threads (0 = one per online CPU). The
+ * calling thread counts as thread 0. */
+Scheduler* sched_init(unsigned numThreads);
+
+/* Stops the workers and frees the pool */
+void sched_free(Scheduler* sched);
+
+/* Gets the number of threads, including the caller */
+unsigned sched_threads(Scheduler* sched);
+
+/* Runs task over chunks [bounds[c], bounds[c + 1]) for c < numChunks and
+ * returns when every chunk is done */
+void sched_run(Scheduler* sched, const uint64_t* bounds, uint64_t numChunks,
+               sched_task_fn task, void* arg);
+
+/* Gets the chunks [*first, *end) of numChunks that sched_run starts thread
+ * on; the threads take contiguous runs in thread order */
+void sched_thread_chunks(Scheduler* sched, uint64_t numChunks, unsigned thread, uint64_t* first, uint64_t* end);
+
+/* Pins thread t to the t-th online CPU listed node by node (wrapping
+ * around), so that the chunk runs of consecutive threads, and the memory
+ * they first touch, fill one NUMA node before the next. Workers pin
+ * themselves when the next task starts; the calling thread's own affinity
+ * is restored by sched_free. Returns false if pinning is not supported. */
+bool sched_pin(Scheduler* sched);
+
+/* Gets the NUMA node thread is pinned on, or 0 if the pool is not pinned */
+unsigned sched_thread_node(Scheduler* sched, unsigned thread);
+
+/* Splits nodes [0, numNodes) into at most maxChunks chunks of roughly equal
+ * cost, where node i costs 1 + offsets[i + 1] - offsets[i]. Writes the
+ * chunk boundaries to bounds (maxChunks + 1 entries) and returns the
+ * number of chunks. */
+uint64_t sched_balance(const uint64_t* offsets, uint64_t numNodes, uint64_t maxChunks, uint64_t* bounds);
+
+/* Gets the number of online CPUs */
+unsigned sched_cpu_count(void);
+
+#endif /* SCHEDULER_H */
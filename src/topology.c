@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "topology.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+/* mbind policies, from linux/mempolicy.h */
+#define TOPO_MPOL_PREFERRED 1
+#define TOPO_MPOL_INTERLEAVE 3
+
+/* Words of a node mask */
+#define TOPO_MASK_WORDS (TOPO_MAX_NODES / (8 * sizeof(unsigned long)))
+
+#ifdef __linux__
+/* Reads a sysfs list such as "0-3,8-11" into present[0 ... max - 1].
+ * Returns false if the file cannot be read. */
+static bool readList(const char* path, bool* present, unsigned max)
+{
+    FILE* file = fopen(path, "r");
+    unsigned long first;
+    unsigned long last;
+    int c = ',';
+
+    if (!file) return false;
+
+    memset(present, 0, max * sizeof(bool));
+
+    while (c == ',' && fscanf(file, "%lu", &first) == 1) {
+        last = first;
+        c = fgetc(file);
+
+        if (c == '-' && fscanf(file, "%lu", &last) == 1) {
+            c = fgetc(file);
+        }
+
+        for (unsigned long i = first; i <= last && i < max; i++) {
+            present[i] = true;
+        }
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+/* Gets the online nodes */
+static bool onlineNodes(bool* present)
+{
+    return readList("/sys/devices/system/node/online", present, TOPO_MAX_NODES);
+}
+#endif
+
+/* Get the number of NUMA nodes */
+unsigned topo_node_count(void)
+{
+#ifdef _WIN32
+    ULONG highest;
+
+    return GetNumaHighestNodeNumber(&highest) ? (unsigned)highest + 1 : 1;
+#elif defined(__linux__)
+    bool present[TOPO_MAX_NODES];
+    unsigned count = 0;
+
+    if (!onlineNodes(present)) return 1;
+
+    for (unsigned n = 0; n < TOPO_MAX_NODES; n++) {
+        if (present[n]) count = n + 1;
+    }
+
+    return count > 0 ? count : 1;
+#else
+    return 1;
+#endif
+}
+
+/* List the online CPUs node by node */
+unsigned topo_cpus(unsigned* cpus, unsigned* nodes, unsigned max)
+{
+    unsigned count = 0;
+
+#ifdef _WIN32
+    ULONG highest;
+
+    if (GetNumaHighestNodeNumber(&highest)) {
+        for (ULONG n = 0; n <= highest; n++) {
+            ULONGLONG mask;
+
+            if (!GetNumaNodeProcessorMask((UCHAR)n, &mask)) continue;
+
+            for (unsigned cpu = 0; cpu < 64 && count < max; cpu++) {
+                if ((mask >> cpu) & 1) {
+                    cpus[count] = cpu;
+                    nodes[count++] = (unsigned)n;
+                }
+            }
+        }
+    }
+#elif defined(__linux__)
+    bool present[TOPO_MAX_NODES];
+    long online = sysconf(_SC_NPROCESSORS_CONF);
+    unsigned numCpus = online > 0 ? (unsigned)online : 1;
+    bool* cpuPresent = (bool*)malloc(numCpus * sizeof(bool));
+
+    if (cpuPresent && onlineNodes(present)) {
+        for (unsigned n = 0; n < TOPO_MAX_NODES; n++) {
+            char path[64];
+
+            if (!present[n]) continue;
+
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", n);
+
+            if (!readList(path, cpuPresent, numCpus)) continue;
+
+            for (unsigned cpu = 0; cpu < numCpus && count < max; cpu++) {
+                if (cpuPresent[cpu]) {
+                    cpus[count] = cpu;
+                    nodes[count++] = n;
+                }
+            }
+        }
+    }
+
+    free(cpuPresent);
+#endif
+
+    /* Unknown topology: one node with CPUs 0 ... n - 1 */
+    if (count == 0) {
+#ifdef _WIN32
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        long online = (long)info.dwNumberOfProcessors;
+#else
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+        for (long cpu = 0; cpu < online && count < max; cpu++) {
+            cpus[count] = (unsigned)cpu;
+            nodes[count++] = 0;
+        }
+    }
+
+    return count;
+}
+
+/* Allocate untouched pages */
+void* topo_alloc_pages(uint64_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(NULL, (SIZE_T)size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    void* pages = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return pages == MAP_FAILED ? NULL : pages;
+#endif
+}
+
+/* Free untouched pages */
+void topo_free_pages(void* pages, uint64_t size)
+{
+    if (!pages) return;
+
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(pages, 0, MEM_RELEASE);
+#else
+    munmap(pages, (size_t)size);
+#endif
+}
+
+#if defined(__linux__) && defined(SYS_mbind)
+/* Sets the memory policy of the pages overlapping [start, start + size) */
+static bool bindPages(void* start, uint64_t size, int mode, const unsigned long* mask)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)start & ~(page - 1);
+    uintptr_t end = ((uintptr_t)start + size + page - 1) & ~(page - 1);
+
+    if (size == 0) return true;
+
+    return syscall(SYS_mbind, first, end - first, mode, mask, (unsigned long)TOPO_MAX_NODES + 1, 0) == 0;
+}
+#endif
+
+/* Interleave pages over every node */
+bool topo_interleave(void* start, uint64_t size)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    bool present[TOPO_MAX_NODES];
+    unsigned long mask[TOPO_MASK_WORDS] = {0};
+    const unsigned bits = 8 * sizeof(unsigned long);
+
+    if (!onlineNodes(present)) return false;
+
+    for (unsigned n = 0; n < TOPO_MAX_NODES; n++) {
+        if (present[n]) mask[n / bits] |= 1UL << (n % bits);
+    }
+
+    return bindPages(start, size, TOPO_MPOL_INTERLEAVE, mask);
+#else
+    (void)start;
+    (void)size;
+    return false;
+#endif
+}
+
+/* Prefer a node for pages */
+bool topo_prefer(void* start, uint64_t size, unsigned node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    unsigned long mask[TOPO_MASK_WORDS] = {0};
+    const unsigned bits = 8 * sizeof(unsigned long);
+
+    if (node >= TOPO_MAX_NODES) return false;
+
+    mask[node / bits] = 1UL << (node % bits);
+
+    return bindPages(start, size, TOPO_MPOL_PREFERRED, mask);
+#else
+    (void)start;
+    (void)size;
+    (void)node;
+    return false;
+#endif
+}
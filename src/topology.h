@@ -0,0 +1,38 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* NUMA topology and page placement. Where the OS does not report its NUMA
+ * nodes the machine counts as a single node holding every online CPU, and
+ * where it cannot place pages the placement calls return false and leave
+ * the pages to first touch. */
+
+/* Largest number of NUMA nodes handled */
+#define TOPO_MAX_NODES 1024
+
+/* Gets the number of NUMA nodes */
+unsigned topo_node_count(void);
+
+/* Lists up to max online CPUs node by node, lowest node first, writing each
+ * CPU number to cpus and its node to nodes. Returns the number listed. */
+unsigned topo_cpus(unsigned* cpus, unsigned* nodes, unsigned max);
+
+/* Allocates size bytes of page aligned, zero-filled memory whose pages are
+ * not touched yet, so that each lands on the node chosen by its policy or
+ * by the thread that first touches it. Returns NULL if it fails. */
+void* topo_alloc_pages(uint64_t size);
+
+/* Frees memory from topo_alloc_pages */
+void topo_free_pages(void* pages, uint64_t size);
+
+/* Spreads the untouched pages of [start, start + size) round-robin over
+ * every node */
+bool topo_interleave(void* start, uint64_t size);
+
+/* Puts the untouched pages of [start, start + size) on a node, falling back
+ * to other nodes when it is full. The range is widened to whole pages. */
+bool topo_prefer(void* start, uint64_t size, unsigned node);
+
+#endif /* TOPOLOGY_H */
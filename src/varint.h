@@ -0,0 +1,47 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Varints hold 7 bits per byte, low groups first, with the top bit set on
+ * every byte but the last. Used by serialized counters and compressed
+ * graphs. */
+
+/* Appends a varint to a byte buffer, which must have room for it */
+static inline uint64_t writeVarint(uint8_t* out, uint64_t value)
+{
+    uint64_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    out[n++] = (uint8_t)value;
+
+    return n;
+}
+
+/* Reads a varint that must end before end; returns false if it does not */
+static inline bool readVarintBounded(const uint8_t** pos, const uint8_t* end, uint64_t* value)
+{
+    const uint8_t* p = *pos;
+    uint64_t v = 0;
+
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+
+        v |= (uint64_t)(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80)) {
+            *pos = p;
+            *value = v;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif /* VARINT_H */
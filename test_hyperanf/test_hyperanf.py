@@ -1,10 +1,14 @@
 from hyperanf.hyperanf import HyperANF
 import os
+import threading
+
+import pytest
 
 import sys
 sys.path.append('src')
 
-import hll_moduQle
+import hll_module
+import numpy as np
 
 def create_small_test_graph():
     """Creates a small test graph."""
@@ -43,6 +47,39 @@ def create_large_test_graph():
     }
 
 
+def to_csr(graph):
+    """Converts a dict-of-sets graph on nodes 0..n-1 to CSR arrays."""
+    offsets = [0]
+    targets = []
+    for v in range(len(graph)):
+        targets.extend(sorted(graph[v]))
+        offsets.append(len(targets))
+    return np.array(offsets, dtype=np.int64), np.array(targets, dtype=np.int64)
+
+
+def to_dense(graph):
+    """Converts a dict-of-sets graph on nodes 0..n-1 to a dense uint8 matrix."""
+    matrix = np.zeros((len(graph), len(graph)), dtype=np.uint8)
+    for v, neighbors in graph.items():
+        for w in neighbors:
+            matrix[v, w] = 1
+    return matrix
+
+
+def create_tailed_random_csr():
+    """A random graph with a long path hanging off it, as CSR arrays. The
+    random part settles in a few rounds while the path keeps a handful of
+    counters changing for hundreds more, so AUTO leaves dense rounds."""
+    rng = np.random.default_rng(5)
+    n, tail = 2000, 300
+    sources = np.concatenate([rng.integers(0, n, 3 * n), [0], np.arange(n + 1, n + tail + 1)])
+    targets = np.concatenate([rng.integers(0, n, 3 * n), [n], np.arange(n, n + tail)])
+    order = np.lexsort((targets, sources))
+    offsets = np.zeros(n + tail + 2, dtype=np.int64)
+    np.add.at(offsets, sources + 1, 1)
+    return np.cumsum(offsets), targets[order].astype(np.int64)
+
+
 def test_cnr2000_graph():
     """ Taken from http://konect.cc/networks/dimacs10-cnr-2000/ """
     fp = os.path.join("test_hyperanf", "data", "cnr-2000.txt")
@@ -144,3 +181,492 @@ def test_disconnected_graph():
 #     result = HyperANF(graph, precision=10)
 #     assert result[0] == 1  # A single node should have itself in its neighborhood
 
+
+def test_csr_matches_dense():
+    """CSR and dense entry points compute the same neighborhood function."""
+    for graph in (create_small_test_graph(), create_medium_test_graph(), create_large_test_graph()):
+        offsets, targets = to_csr(graph)
+        dense = hll_module.hyperanf(10, to_dense(graph))
+        assert hll_module.hyperanf_csr(10, offsets, targets) == dense
+        assert hll_module.hyperanf_distance_csr(10, offsets, targets) == \
+            hll_module.hyperanf_distance(10, to_dense(graph))
+
+
+def test_csr_rejects_bad_targets():
+    """Targets must be valid node ids."""
+    with pytest.raises(ValueError):
+        hll_module.hyperanf_csr(10, np.array([0, 1]), np.array([5]))
+
+
+def test_csr_threads_match_single_thread():
+    """The parallel engine computes the same result for any thread count."""
+    offsets, targets = to_csr(create_large_test_graph())
+    expected = hll_module.hyperanf_csr(10, offsets, targets, threads=1)
+    for threads in (2, 4, 7):
+        assert hll_module.hyperanf_csr(10, offsets, targets, threads=threads) == expected
+
+
+def test_hll_add_many_matches_add():
+    """Batch adds give the same counter as adding the keys one at a time."""
+    keys = np.random.default_rng(7).integers(0, 2**40, 50000)
+    for dtype in (np.uint32, np.uint64, np.int64):
+        array = keys.astype(dtype)
+        single = hll_module.HyperLogLog(12)
+        for key in array[:20000]:
+            single.add(key.tobytes())
+        batch = hll_module.HyperLogLog(12)
+        batch.add_many(array[:20000])
+        assert batch.cardinality() == single.cardinality()
+
+        prefixed = hll_module.HyperLogLog(12)
+        prefixed.add_prefixed(b"".join(len(k.tobytes()).to_bytes(4, sys.byteorder) + k.tobytes()
+                                       for k in array[:20000]))
+        assert prefixed.cardinality() == single.cardinality()
+
+
+def test_csr_out_of_core_matches_in_memory(tmp_path):
+    """Counters in a memory-mapped file give the same result as in RAM."""
+    offsets, targets = to_csr(create_large_test_graph())
+    path = str(tmp_path / "counters.bin")
+    assert hll_module.hyperanf_csr(10, offsets, targets, counter_path=path) == \
+        hll_module.hyperanf_csr(10, offsets, targets)
+    assert not os.path.exists(path)
+
+
+def test_native_loaders_match_csr(tmp_path):
+    """METIS and edge list files load into the same CSR arrays as the dict graph."""
+    graph = create_large_test_graph()
+    offsets, targets = to_csr(graph)
+
+    metis = tmp_path / "graph.metis"
+    lines = ["% comment", f"{len(graph)} {len(targets) // 2}"]
+    lines += [" ".join(str(w + 1) for w in sorted(graph[v])) for v in range(len(graph))]
+    metis.write_text("\n".join(lines) + "\n")
+
+    edges = tmp_path / "graph.txt"
+    edges.write_text("# source target\n" + "".join(f"{v}\t{w}\n" for v in range(len(graph)) for w in sorted(graph[v])))
+
+    for loaded in (hll_module.load_metis(str(metis)), hll_module.load_edge_list(str(edges), threads=3)):
+        assert np.array_equal(loaded[0], offsets)
+        assert np.array_equal(loaded[1], targets)
+        assert hll_module.hyperanf_csr(10, *loaded) == hll_module.hyperanf_csr(10, offsets, targets)
+
+    metis.write_text("2 1\n2\n3\n")
+    with pytest.raises(ValueError):
+        hll_module.load_metis(str(metis))
+
+
+def test_hyperanf_rounds_run_until_no_register_changes():
+    """The dense entry points take p in 4..16 and stop on the first round with no register change."""
+    path = np.zeros((6, 6), dtype=np.uint8)
+    for v in range(5):
+        path[v, v + 1] = path[v + 1, v] = 1
+
+    # Diameter 5, then one round in which nothing changes
+    assert hll_module.hyperanf(10, path) == [16, 24, 30, 34, 36, 36]
+    for p in (3, 17):
+        with pytest.raises(ValueError):
+            hll_module.hyperanf(p, path)
+        with pytest.raises(ValueError):
+            hll_module.hyperanf_distance(p, path)
+
+
+def test_edge_list_rejects_huge_ids(tmp_path):
+    """Edge list ids that overflow 64 bits or the node count are rejected."""
+    edges = tmp_path / "graph.txt"
+
+    for line in ("0 18446744073709551616\n", "0 99999999999999999999999\n", "18446744073709551615 0\n"):
+        edges.write_text(line)
+        with pytest.raises(ValueError):
+            hll_module.load_edge_list(str(edges))
+
+
+def test_compressed_graph_matches_csr(tmp_path):
+    """HyperANF over a compressed graph file matches the CSR arrays it came from."""
+    offsets, targets = to_csr(create_large_test_graph())
+    path = str(tmp_path / "graph.cg")
+    assert hll_module.compress_graph(path, offsets, targets) > 0
+    assert hll_module.hyperanf_compressed(10, path, threads=2) == hll_module.hyperanf_csr(10, offsets, targets)
+
+    with open(path, "r+b") as f:
+        f.truncate(40)
+    with pytest.raises(ValueError):
+        hll_module.hyperanf_compressed(10, path)
+
+
+def test_round_callback_reports_each_round():
+    """The callback sees every round, and its N(t) matches the result."""
+    offsets, targets = to_csr(create_large_test_graph())
+    stats = []
+    result = hll_module.hyperanf_csr(10, offsets, targets, callback=stats.append)
+    assert [s["round"] for s in stats] == list(range(len(result) + 1))
+    assert [s["neighborhood"] for s in stats[1:]] == result
+    assert stats[0]["modified"] == len(offsets) - 1
+    assert stats[-1]["modified"] == 0
+    assert all(s["registers_changed"] >= s["modified"] for s in stats)
+
+    def stop(s):
+        raise ZeroDivisionError
+    with pytest.raises(ZeroDivisionError):
+        hll_module.hyperanf_csr(10, offsets, targets, callback=stop)
+
+
+def test_concurrent_hll_matches_single_threaded():
+    """Threads adding into one concurrent counter give the same registers."""
+    import threading
+    keys = np.arange(200000, dtype=np.uint64)
+    shared = hll_module.HyperLogLog(p=12, concurrent=True)
+    threads = [threading.Thread(target=shared.add_many, args=(part,)) for part in np.array_split(keys, 4)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    single = hll_module.HyperLogLog(p=12)
+    single.add_many(keys)
+    assert shared.cardinality() == single.cardinality()
+    assert not single.merge(shared)
+    assert not shared.merge(single)
+
+
+def test_concurrent_hll_refuses_reinit_while_adding():
+    """Re-initialising a concurrent counter raises while another thread adds into it."""
+    keys = np.arange(4000000, dtype=np.uint64)
+    shared = hll_module.HyperLogLog(p=12, concurrent=True)
+    adder = threading.Thread(target=shared.add_many, args=(keys,))
+    refused = 0
+    adder.start()
+    while adder.is_alive():
+        try:
+            shared.__init__(p=12, concurrent=True)
+        except RuntimeError:
+            refused += 1
+    adder.join()
+
+    assert refused > 0
+    shared.__init__(p=12, concurrent=True)
+    assert shared.cardinality() == 0
+
+
+def test_checkpoint_resume_matches_uninterrupted(tmp_path):
+    """A run stopped after a checkpoint and resumed from it gives the same result."""
+    offsets, targets = to_csr(create_large_test_graph())
+    expected = hll_module.hyperanf_csr(10, offsets, targets)
+    path = str(tmp_path / "run.ck")
+
+    def stop(s):
+        if s["round"] == 3:
+            raise KeyboardInterrupt
+    with pytest.raises(KeyboardInterrupt):
+        hll_module.hyperanf_csr(10, offsets, targets, callback=stop, checkpoint_path=path)
+    assert hll_module.hyperanf_csr(10, offsets, targets, resume_path=path, threads=3) == expected
+
+    with pytest.raises(RuntimeError):
+        hll_module.hyperanf_csr(11, offsets, targets, resume_path=path)
+
+
+def test_sparse_counter_matches_dense():
+    """A sparse counter has the dense registers and estimate through buffer flushes and promotion."""
+    keys = np.random.default_rng(5).integers(0, 2**40, 20000).astype(np.uint64)
+    sparse = hll_module.HyperLogLog(p=12, sparse=True)
+    dense = hll_module.HyperLogLog(p=12)
+    sizes = []
+    for start in range(0, len(keys), 97):
+        sparse.add_many(keys[start:start + 97])
+        dense.add_many(keys[start:start + 97])
+        sparse.add(b"key %d" % start)
+        dense.add(b"key %d" % start)
+        assert np.array_equal(sparse.registers(), dense.registers())
+        assert sparse.cardinality() == dense.cardinality()
+        sizes.append(len(sparse.serialize()))
+
+    # Starts sparse and ends promoted to the dense size
+    assert sizes[0] < sizes[-1] and sizes[-1] == len(dense.serialize())
+
+
+def test_merge_matches_union_of_keys():
+    """Every sparse/dense/concurrent pairing merges to the counter of the union of the keys."""
+    rng = np.random.default_rng(8)
+    for sizes in ((300, 200), (300, 20000), (20000, 300), (20000, 20000)):
+        first = rng.integers(0, 2**40, sizes[0]).astype(np.uint64)
+        second = rng.integers(0, 2**40, sizes[1]).astype(np.uint64)
+        union = hll_module.HyperLogLog(p=12)
+        union.add_many(np.concatenate([first, second]))
+
+        for dest_kwargs, src_kwargs in (({"sparse": True}, {"sparse": True}), ({"sparse": True}, {}),
+                                        ({}, {"sparse": True}), ({}, {}),
+                                        ({"concurrent": True}, {"concurrent": True})):
+            dest = hll_module.HyperLogLog(p=12, **dest_kwargs)
+            src = hll_module.HyperLogLog(p=12, **src_kwargs)
+            dest.add_many(first)
+            src.add_many(second)
+            dest.merge(src)
+            assert np.array_equal(dest.registers(), union.registers())
+            assert dest.cardinality() == union.cardinality()
+
+
+def test_serialize_round_trips_counters():
+    """Serialized counters come back with the same registers, sparse ones smaller."""
+    keys = np.arange(3000, dtype=np.uint64)
+    for kwargs in ({"p": 12}, {"p": 14, "sparse": True}, {"p": 10, "concurrent": True}):
+        counter = hll_module.HyperLogLog(**kwargs)
+        counter.add_many(keys[:300])
+        data = counter.serialize()
+        copy = hll_module.HyperLogLog.deserialize(data)
+        assert np.array_equal(copy.registers(), counter.registers())
+        assert copy.cardinality() == counter.cardinality()
+        if kwargs.get("sparse"):
+            assert len(data) < 2 ** 14 * 6 // 8
+
+    with pytest.raises(ValueError):
+        hll_module.HyperLogLog.deserialize(data[:-1])
+
+
+def test_hll_array_unions_mapped_counters(tmp_path):
+    """Counters merged from a mapped array file match merging the originals."""
+    shards = []
+    for shard in range(4):
+        counter = hll_module.HyperLogLog(p=12, sparse=shard % 2 == 0)
+        counter.add_many(np.arange(shard * 1000, shard * 1000 + 1500, dtype=np.uint64))
+        shards.append(counter)
+    path = str(tmp_path / "shards.hll")
+    hll_module.save_hll_array(path, shards)
+
+    array = hll_module.HllArray(path)
+    registers = array.registers()
+    assert len(array) == 4 and registers.shape == (4, 2 ** 12) and not registers.flags.writeable
+    assert np.array_equal(registers[1], shards[1].registers())
+
+    expected = hll_module.HyperLogLog(p=12)
+    for shard in (0, 2, 3):
+        expected.merge(shards[shard])
+    assert np.array_equal(array.union([0, 2, 3]).registers(), expected.registers())
+
+    merged = hll_module.HyperLogLog(p=12)
+    array.merge(3, merged)
+    assert merged.cardinality() == shards[3].cardinality()
+
+    with pytest.raises(ValueError):
+        array.merge(3, hll_module.HyperLogLog(p=12, seed=7))
+    with pytest.raises(ValueError):
+        hll_module.save_hll_array(str(tmp_path / "empty.hll"), [])
+
+    # A rank past 65 - p in the file fails the union instead of leaking out
+    corrupt = tmp_path / "corrupt.hll"
+    data = bytearray(open(path, "rb").read())
+    data[64 + (2 << 12) + 5] = 60
+    corrupt.write_bytes(bytes(data))
+    with pytest.raises(ValueError):
+        hll_module.HllArray(str(corrupt)).union([0, 2])
+
+
+def test_packed_register_widths_match_bytes(tmp_path):
+    """Packed 5 and 6-bit registers give the byte result, and checkpoints convert between widths."""
+    offsets, targets = to_csr(create_large_test_graph())
+    expected = hll_module.hyperanf_csr(10, offsets, targets)
+    for width in (5, 6):
+        assert hll_module.hyperanf_csr(10, offsets, targets, register_width=width, threads=3) == expected
+
+    path = str(tmp_path / "run.ck")
+
+    def stop(s):
+        if s["round"] == 2:
+            raise KeyboardInterrupt
+    with pytest.raises(KeyboardInterrupt):
+        hll_module.hyperanf_csr(10, offsets, targets, callback=stop, checkpoint_path=path, register_width=5)
+    assert hll_module.hyperanf_csr(10, offsets, targets, resume_path=path) == expected
+
+    with pytest.raises(ValueError):
+        hll_module.hyperanf_csr(10, offsets, targets, register_width=4)
+
+
+def test_reordering_keeps_the_result():
+    """Reordered runs give the same result, and reorder_graph returns a permutation of the graph."""
+    offsets, targets = to_csr(create_large_test_graph())
+    expected = hll_module.hyperanf_csr(10, offsets, targets)
+    for order in ("bfs", "degree", "community"):
+        assert hll_module.hyperanf_csr(10, offsets, targets, order=order, threads=3) == expected
+
+        reordered = hll_module.reorder_graph(offsets, targets, order=order)
+        perm = reordered["permutation"]
+        assert sorted(perm) == list(range(len(offsets) - 1))
+        arcs = {(perm[u], perm[v]) for u in range(len(offsets) - 1) for v in targets[offsets[u]:offsets[u + 1]]}
+        new_offsets, new_targets = reordered["offsets"], reordered["targets"]
+        assert arcs == {(u, v) for u in range(len(new_offsets) - 1)
+                        for v in new_targets[new_offsets[u]:new_offsets[u + 1]]}
+        assert reordered["after"]["bandwidth"] <= len(offsets) - 1
+
+    with pytest.raises(ValueError):
+        hll_module.hyperanf_csr(10, offsets, targets, order="random")
+
+
+def test_counter_placement_keeps_the_result():
+    """Every NUMA placement gives the same result; partitioned pins the threads even when not asked to."""
+    offsets, targets = to_csr(create_large_test_graph())
+    expected = hll_module.hyperanf_csr(10, offsets, targets)
+    for placement in ("default", "first-touch", "interleave", "partitioned"):
+        for pin_threads in (False, True):
+            assert hll_module.hyperanf_csr(10, offsets, targets, threads=3, placement=placement,
+                                           pin_threads=pin_threads) == expected
+
+    with pytest.raises(ValueError):
+        hll_module.hyperanf_csr(10, offsets, targets, placement="local")
+
+
+def test_incremental_matches_full_run():
+    """Edges added to an incremental run give the result of a full run over the grown graph."""
+    graph = create_large_test_graph()
+    removed = [(0, 9), (9, 0), (4, 5), (7, 8)]
+    initial = {v: neighbors - {w for u, w in removed if u == v} for v, neighbors in graph.items()}
+    run = hll_module.IncrementalHyperANF(10, *to_csr(initial), threads=2)
+    assert run.neighborhood_function() == hll_module.hyperanf_csr(10, *to_csr(initial))
+
+    for u, w in removed:
+        stats = run.add_edges([u], [w])
+        assert stats["added_nodes"] == 0
+        initial[u].add(w)
+        assert run.neighborhood_function() == hll_module.hyperanf_csr(10, *to_csr(initial))
+    assert initial == graph
+
+    # Edges to ids past the last node add nodes
+    stats = run.add_edges([3, 10], [10, 11])
+    graph[3].add(10)
+    graph[10] = {11}
+    graph[11] = set()
+    assert stats["added_nodes"] == 2 and len(run) == 12
+    assert run.neighborhood_function() == hll_module.hyperanf_csr(10, *to_csr(graph))
+
+
+def test_incremental_update_releases_the_gil():
+    """Other threads run during an update, and calls on the run from them raise instead of racing it."""
+    offsets, targets = create_tailed_random_csr()
+    sources = np.repeat(np.arange(len(offsets) - 1), np.diff(offsets))
+    # Hold back the arc joining the path to the random part
+    link = np.flatnonzero((sources == 0) & (targets == 2000))[0]
+    kept = np.delete(np.arange(len(targets)), link)
+    initial = np.zeros(len(offsets), dtype=np.int64)
+    np.add.at(initial, sources[kept] + 1, 1)
+    run = hll_module.IncrementalHyperANF(8, np.cumsum(initial), targets[kept], threads=2)
+
+    errors = []
+    update = threading.Thread(target=lambda: errors.append(run.add_edges([0], [2000])))
+    update.start()
+    while update.is_alive():
+        try:
+            run.neighborhood_function()
+        except RuntimeError:
+            pass
+    update.join()
+
+    assert isinstance(errors[0], dict)
+    assert run.neighborhood_function() == hll_module.hyperanf_csr(8, offsets, targets)
+
+
+def test_running_estimate_matches_histogram():
+    """The running estimate tracks the histogram one through adds and merges."""
+    keys = np.random.default_rng(11).integers(0, 2**40, 40000).astype(np.uint64)
+    for sparse in (False, True):
+        exact = hll_module.HyperLogLog(12, sparse=sparse)
+        running = hll_module.HyperLogLog(12, sparse=sparse, running=True)
+        for start in range(0, 20000, 500):
+            exact.add_many(keys[start:start + 500])
+            running.add_many(keys[start:start + 500])
+            assert abs(running.cardinality() - exact.cardinality()) <= 1
+
+        other = hll_module.HyperLogLog(12, sparse=sparse)
+        other.add_many(keys[20000:])
+        exact.merge(other)
+        running.merge(other)
+        assert abs(running.cardinality() - exact.cardinality()) <= 1
+
+
+def test_round_strategies_match():
+    """Every round strategy gives the same result, including the sparse and push rounds AUTO picks."""
+    offsets, targets = create_tailed_random_csr()
+    stats = []
+    expected = hll_module.hyperanf_csr(8, offsets, targets, callback=stats.append)
+    assert any(s["push"] for s in stats)
+    assert any(s["sparse"] for s in stats)
+
+    # Sparse frontier rounds pull into the predecessors of modified nodes
+    stats = []
+    assert hll_module.hyperanf_csr(8, offsets, targets, strategy="sparse", callback=stats.append) == expected
+    assert all(s["sparse"] and not s["push"] for s in stats[1:])
+
+    for strategy in ("auto", "dense", "sparse", "push", "full"):
+        for threads in (1, 4):
+            for width in (5, 8):
+                assert hll_module.hyperanf_csr(8, offsets, targets, threads=threads, register_width=width,
+                                               strategy=strategy) == expected
+
+    with pytest.raises(ValueError):
+        hll_module.hyperanf_csr(8, offsets, targets, strategy="random")
+
+
+def test_max_kernels_match_numpy():
+    """Each register max kernel gives numpy's maximum and reports whether it raised any register."""
+    rng = np.random.default_rng(3)
+    default = hll_module.kernel_name()
+    tested = []
+    try:
+        for kernel in ("scalar", "sse2", "avx2", "avx512bw"):
+            try:
+                hll_module.select_kernel(kernel)
+            except ValueError:
+                continue
+            tested.append(kernel)
+
+            for p in range(4, 17):
+                dst = rng.integers(0, 40, 2**p).astype(np.uint8)
+                src = rng.integers(0, 40, 2**p).astype(np.uint8)
+                merged, changed = hll_module.register_max(dst, src)
+                assert np.array_equal(merged, np.maximum(dst, src)) and changed
+                assert not hll_module.register_max(merged, src)[1]
+
+                # A raise in the last register alone is still seen
+                last = merged.copy()
+                last[-1] += 1
+                assert hll_module.register_max(merged, last)[1]
+    finally:
+        hll_module.select_kernel(default)
+
+    assert "scalar" in tested
+
+
+def test_fixed_kernels_match_generic():
+    """The kernels specialized for each p match the generic ones, and every kernel gives the same counters."""
+    rng = np.random.default_rng(13)
+    keys = rng.integers(0, 2**40, 30000).astype(np.uint64)
+    default = hll_module.kernel_name()
+    results = []
+    try:
+        for kernel in ("scalar", "sse2", "avx2", "avx512bw"):
+            try:
+                hll_module.select_kernel(kernel)
+            except ValueError:
+                continue
+
+            for p in range(4, 17):
+                dst = rng.integers(0, 12, 2**p).astype(np.uint8)
+                src = rng.integers(0, 12, 2**p).astype(np.uint8)
+                src[:3] = (0, 64 - p, p + 1)
+                assert hll_module.register_max(dst, src, fixed=True)[1] == hll_module.register_max(dst, src)[1]
+                assert (hll_module.register_max(dst, src, fixed=True)[0] ==
+                        hll_module.register_max(dst, src)[0]).all()
+                assert hll_module.register_sums(src, fixed=True) == hll_module.register_sums(src)
+                assert not hll_module.register_max(src, src, fixed=True)[1]
+
+            counters = []
+            for p in (4, 12, 16, 18):
+                a = hll_module.HyperLogLog(p)
+                b = hll_module.HyperLogLog(p)
+                shared = hll_module.HyperLogLog(p, concurrent=True)
+                a.add_many(keys[:20000])
+                b.add_many(keys[10000:])
+                shared.add_many(keys[:20000])
+                a.merge(b)
+                counters.append((a.cardinality(), shared.cardinality(), a.registers().tolist()))
+            results.append(counters)
+    finally:
+        hll_module.select_kernel(default)
+
+    assert all(r == results[0] for r in results)